@@ -0,0 +1,123 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ *
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_APNS2_BACKEND__H
+#define OSHIYA_APNS2_BACKEND__H
+
+#include "Backend.hpp"
+#include "HttpClient.hpp"
+#include "json/json.h"
+
+#include <openssl/evp.h>
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <memory>
+
+namespace Oshiya
+{
+    /**
+     * APNs backend using the HTTP/2 provider API with token-based
+     * authentication. Every notification is a stream of its own, APNs
+     * answers each of them with a status code.
+     */
+    class Apns2Backend : public Backend
+    {
+        public:
+        ///////
+
+        struct ApnsParameters
+        {
+            static const unsigned int MaxPayloadSize {4096};
+            // APNs rejects provider tokens older than an hour
+            static const unsigned int TokenRefreshInterval {50 * 60}; // 50 min
+        };
+
+        struct Credentials
+        {
+            Credentials() : sandbox {false} { }
+
+            // PKCS#8 file holding the ES256 signing key
+            std::string keyFile;
+            std::string keyId;
+            std::string teamId;
+            // the app's bundle id
+            std::string topic;
+            bool sandbox;
+        };
+
+        Apns2Backend(const Jid& host,
+                     const std::string& appName,
+                     const Credentials& credentials,
+                     const Options& options);
+
+        ~Apns2Backend() override;
+
+        /**
+         * the request body, a bare wakeup if payload doesn't fit
+         */
+        static std::string makePayload(const PayloadT& payload);
+
+        /**
+         * the lowercase hex form APNs expects a device token in
+         */
+        static std::string binaryToHex(const std::string& binaryToken);
+
+        private:
+        ////////
+
+        NotificationQueueT send(const NotificationQueueT& notifications,
+                                std::size_t worker) override;
+
+        /**
+         * returns a valid provider token, signing a new one if it is due
+         */
+        std::string getProviderToken();
+
+        /**
+         * evaluates APNs' answer for n, n is added to retryQueue on
+         * recoverable errors
+         */
+        void completeRequest(const HttpClient::Request& request,
+                             const PushNotification& n,
+                             NotificationQueueT& retryQueue);
+
+        /**
+         * signed JWT, see "Establishing a Token-Based Connection to APNs"
+         */
+        std::string makeProviderToken();
+
+        static std::string base64UrlEncode(const std::string& input);
+
+        const Credentials mCredentials;
+        const std::string mUrlPrefix;
+
+        EVP_PKEY* mSigningKey;
+
+        // the workers share one provider token
+        std::mutex mProviderTokenMutex;
+        std::string mProviderToken;
+        std::chrono::steady_clock::time_point mProviderTokenTime;
+
+        // one per worker
+        std::vector<std::unique_ptr<HttpClient>> mClients;
+    };
+}
+
+#endif
@@ -25,6 +25,8 @@ extern "C"
     #include "apn.h"
 }
 
+#include <vector>
+
 namespace Oshiya
 {
     class ApnsBackend : public Backend
@@ -36,7 +38,8 @@ namespace Oshiya
 
         ApnsBackend(const Jid& host,
                     const std::string& appName,
-                    const std::string& certFile);
+                    const std::string& certFile,
+                    const Options& options);
 
         ~ApnsBackend() override;
 
@@ -44,21 +47,32 @@ namespace Oshiya
         ////////
 
         using PayloadDeleterT = void(*)(apn_payload_ctx_ref);
+
+        /**
+         * a worker's connection to APNs
+         */
+        struct Connection
+        {
+            Connection() : connected {false}, apnCtx {nullptr} { }
+
+            bool connected;
+            apn_ctx_ref apnCtx;
+        };
         
-        NotificationQueueT send(const NotificationQueueT& notifications) override;
+        NotificationQueueT send(const NotificationQueueT& notifications,
+                                std::size_t worker) override;
         
-        void connectApns();
+        void connectApns(Connection& connection);
 
-        void disconnectApns();
+        void disconnectApns(Connection& connection);
 
         std::unique_ptr<__apn_payload, PayloadDeleterT>
         makePayload(const std::string& token, const PayloadT& payload);
 
         static std::string binaryToHex(const std::string& binaryToken);
 
-        bool mConnected;
-        apn_ctx_ref mApnCtx;
-        apn_error_ref mError;
+        // one per worker
+        std::vector<Connection> mConnections;
     };
 }
 
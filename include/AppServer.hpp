@@ -21,17 +21,26 @@
 
 #include <Component.hpp>
 #include <ApnsBackend.hpp>
+#include <Apns2Backend.hpp>
 #include <GcmBackend.hpp>
 //#include <MozillaBackend.hpp>
 #include <UbuntuBackend.hpp>
 //#include <WnsBackend.hpp>
 #include "Registration.hpp"
+#include "RegistrationTable.hpp"
+#include "RegistrationStore.hpp"
+#include "RegistrationJournal.hpp"
+#include "RegistrationSnapshot.hpp"
+#include "TimerWheel.hpp"
 #include "config.h"
 
 #include <map>
 #include <queue>
+#include <deque>
+#include <list>
 #include <algorithm>
-#include <fstream>
+#include <condition_variable>
+#include <thread>
 
 namespace Oshiya
 {
@@ -40,6 +49,38 @@ namespace Oshiya
         public:
         ///////
 
+        struct Parameters
+        {
+            // defaults of the provisioning options, see ProvisioningOptions
+            static const unsigned int DefaultMaxProvisioning {256};
+            static const unsigned int DefaultMaxQueuedRegs {4096};
+            static const unsigned int DefaultIqTimeout {10000}; // ms
+            static const unsigned int DefaultIqRetries {2};
+            // resolution and size of the IQ deadline wheel
+            static const unsigned int DeadlineTick {100}; // ms
+            static const std::size_t DeadlineSlots {1024};
+            // imports and exports log their progress every that many
+            // registrations
+            static const std::size_t JobProgressInterval {100000};
+        };
+
+        /**
+         * what an import or export got through
+         */
+        struct TransferStats
+        {
+            TransferStats() : processed {0}, transferred {0}, failed {0}
+            { }
+
+            // registrations read (import) or about to be written (export)
+            std::size_t processed;
+            // added (and provisioned if asked to) or written
+            std::size_t transferred;
+            // invalid lines, nodes already taken, failed provisioning,
+            // registrations of unknown backends
+            std::size_t failed;
+        };
+
         AppServer(const Config& config);
 
         AppServer(const AppServer&) = delete;
@@ -47,6 +88,17 @@ namespace Oshiya
 
         ~AppServer();
 
+        /**
+         * offline counterparts of the import-push-registrations and
+         * export-push-registrations commands (oshiya --import / --export),
+         * for a component that isn't running. Imported registrations whose
+         * node is taken or whose device is registered already are skipped,
+         * their pubsub nodes have to exist. See RegistrationDump for the
+         * format.
+         */
+        static bool importRegs(const Config& config, std::istream& in, TransferStats& stats);
+        static bool exportRegs(const Config& config, std::ostream& out, TransferStats& stats);
+
         private:
         ////////
 
@@ -64,14 +116,23 @@ namespace Oshiya
 
             PendingReg(const std::string& secret,
                        const std::string& registerId,
-                       const Registration& registration)
+                       const Registration& registration,
+                       bool imported = false)
                 :
+                    mStarted {false},
+                    mImported {imported},
                     mCompletedActions {0},
                     mSecret {secret},
                     mRegisterId {registerId},
                     mRegistration {registration}
             { }
 
+            // the node is being provisioned, it has left the queue
+            void start() {mStarted = true;}
+            bool isStarted() const {return mStarted;}
+            // added by an import, there's no client to answer
+            bool isImported() const {return mImported;}
+
             int completeAction(Action action) {return mCompletedActions |= action;}
             int getCompletedActions() const {return mCompletedActions;}
             std::string getSecret() const {return mSecret;}
@@ -82,6 +143,8 @@ namespace Oshiya
             private:
             ////////
 
+            bool mStarted;
+            const bool mImported;
             int mCompletedActions;
             const std::string mSecret;
             const std::string mRegisterId;
@@ -94,6 +157,60 @@ namespace Oshiya
                              const std::string& node,
                              const XData& payload) override;
 
+        /**
+         * registrations are provisioned on the pubsub service in three steps:
+         * the node is created (with its secret), then the user's affiliation
+         * is set and the node subscribed to. Each step's IQ has a deadline,
+         * a timed out step is retried and the registration rolled back when
+         * it runs out of retries.
+         */
+        struct ProvisioningOptions
+        {
+            // registrations being provisioned at once, more wait in a queue
+            std::size_t maxProvisioning;
+            // the queue's length, further requests are asked to wait
+            std::size_t maxQueuedRegs;
+            std::chrono::milliseconds iqTimeout;
+            unsigned int iqRetries;
+            // sends all steps right away, the pubsub service processes them
+            // in order (RFC 6120, 10.1), which saves a round trip
+            bool pipelined;
+        };
+
+        struct PendingAction
+        {
+            PendingReg::Action action;
+            NodeIdT node;
+            // retries so far
+            unsigned int attempt;
+        };
+
+        struct ActionDeadline
+        {
+            StanzaIdT id;
+            std::chrono::steady_clock::time_point dueTime;
+        };
+
+        /**
+         * the import or export last started by an admin command, one at a
+         * time
+         */
+        struct AdminJob
+        {
+            AdminJob() : running {false}, ok {true}, reading {false}, provisioning {0}
+            { }
+
+            std::string name;
+            std::string path;
+            bool running;
+            bool ok;
+            // the job thread is still at it
+            bool reading;
+            // imported registrations being provisioned
+            std::size_t provisioning;
+            TransferStats stats;
+        };
+
         void iqResultReceived(const Jid& from,
                               const std::string& id) override;
 
@@ -104,7 +221,7 @@ namespace Oshiya
 
         void pushNotificationReceived(const Jid& from,
                                       const std::string& node,
-                                      const XData& payload) override;
+                                      const Backend::PayloadT& payload) override;
 
         void addRegistration(const Jid& user,
                              const std::string& stanzaId,
@@ -115,32 +232,173 @@ namespace Oshiya
                                  const std::string& stanzaId,
                                  const XData& payload);
 
-        template <typename UnaryPredicate>
-        bool deleteRegistration(const std::string& node, UnaryPredicate pred);
+        bool deleteRegistration(const std::string& node,
+                                const RegistrationStore::PredicateT& pred);
 
         void deleteRegCb(const std::string& node, std::time_t timestamp);
 
+        /**
+         * import-push-registrations, export-push-registrations and
+         * push-registrations-job, for the JIDs listed in "admins"
+         */
+        void adminCommandReceived(const Jid& from,
+                                  const std::string& id,
+                                  const std::string& node,
+                                  const XData& payload);
+
+        bool isAdmin(const Jid& jid) const;
+
+        /**
+         * name's path in the transfer directory, empty if name is absolute or
+         * has a ".." component
+         */
+        std::string makeTransferPath(const std::string& name) const;
+
+        /**
+         * the job threads. An import hands its registrations to the
+         * provisioning pipeline as slots become free.
+         */
+        void runImport(const std::string& path, bool provision);
+        void runExport(const std::string& path);
+
+        /**
+         * with mPendingMutex held
+         */
+        XData makeJobStatus() const;
+        void finishJob();
+
+        using PendingRegMapT = std::unordered_map<NodeIdT, PendingReg>;
+        using PendingActionMapT = std::unordered_map<StanzaIdT, PendingAction>;
+        using DeviceKeyT = std::string;
+
+        /**
+         * called by mRegs for every change, keep the counts per backend and
+         * the journal
+         */
+        void registrationInserted(const NodeIdT& node, const Registration& reg);
+        void registrationErased(const RegistrationTable& regs,
+                                RegistrationTable::IdT id);
+
+        /**
+         * same for mPendingRegs, with mPendingMutex held
+         */
+        void insertPendingReg(const NodeIdT& node, const PendingReg& pending);
+        void erasePendingReg(PendingRegMapT::iterator it);
+        PendingRegMapT::iterator findPendingReg(const Jid& user,
+                                                const std::string& deviceId);
+
+        /**
+         * the provisioning steps, all with mPendingMutex held
+         */
+        void startQueuedRegs();
+        void sendAction(const NodeIdT& node, PendingReg::Action action, unsigned int attempt);
+        void actionCompleted(PendingRegMapT::iterator it, PendingReg::Action action);
+        void actionTimedOut(const StanzaIdT& id);
+
+        /**
+         * tells the user, deletes the node if it may exist and drops the
+         * registration
+         */
+        void failPendingReg(PendingRegMapT::iterator it,
+                            const std::string& errorType,
+                            const std::string& condition,
+                            bool deleteNode);
+
+        /**
+         * the deadline thread, expires mDeadlines
+         */
+        void runDeadlines();
+
+        ProvisioningOptions makeProvisioningOptions() const;
+
+        /**
+         * bare JID and device id joined by '/', which can't be part of a bare JID
+         */
+        static DeviceKeyT makeDeviceKey(const Jid& user, const std::string& deviceId);
+
+        /**
+         * throws Config::InvalidConfig if two backends have the same type,
+         * apns and apns2 included
+         */
         std::unordered_map<Backend::IdT, std::unique_ptr<Backend>> makeBackends();
 
-        std::unique_ptr<Backend> makeBackendPtr(Backend::Type type,
+        /**
+         * returns an empty pointer for unsupported backend types
+         */
+        std::unique_ptr<Backend> makeBackendPtr(const Config& backendConfig,
                                                 const Jid& host,
-                                                const std::string& appName,
-                                                const std::string& certFile,
-                                                const std::string& authKey);
+                                                const Backend::Options& commonOptions);
+
+        /**
+         * identifies the registration a notification was sent for, a backend
+         * spools it with the notification. The timestamp makes sure a device
+         * registered again under the same node isn't unregistered.
+         */
+        static std::string makeUnregisterKey(const NodeIdT& node, std::time_t timestamp);
+
+        static bool parseUnregisterKey(const std::string& unregisterKey,
+                                       NodeIdT& node,
+                                       std::time_t& timestamp);
 
         Backend::Type getRegType(const Registration& reg);
 
-        static std::size_t makeDeviceHash(const Jid& user, const std::string& deviceId);
+        /**
+         * loads the snapshot into one table per decoding thread, see
+         * RegistrationSnapshot::read(). A snapshot in the legacy text format
+         * is converted on the fly.
+         */
+        static std::vector<RegistrationTable> readRegs(const std::string& storagePath);
+
+        /**
+         * atomically replaces the snapshot with regs
+         */
+        static bool writeRegs(const std::string& storagePath, const RegistrationTable& regs);
+
+        /**
+         * called by the journal: snapshots mRegs and drops the journaled
+         * records the snapshot covers
+         */
+        void compactRegs();
+
+        std::string getStoragePath() const;
+        std::string getJournalPath() const;
 
-        std::unordered_map<NodeIdT, Registration> readRegs() const;
-        void writeRegs() const;
+        static std::string makeStoragePath(const Config& config, const Jid& host);
+        static std::string makeJournalPath(const std::string& storagePath);
 
         std::unordered_map<Backend::IdT, std::unique_ptr<Backend>> mBackends;
-        std::unordered_map<NodeIdT, Registration> mRegs;
-        std::unordered_map<NodeIdT, PendingReg> mPendingRegs;
-        std::unordered_map<StanzaIdT, std::pair<PendingReg::Action, NodeIdT>>
-        mPendingActions;
-        std::mutex mRegsMutex;
+        RegistrationStore mRegs;
+        // registrations per backend, for the metrics
+        std::unordered_map<Backend::IdT, std::size_t> mRegCounts;
+        std::mutex mRegCountsMutex;
+        const ProvisioningOptions mProvisioning;
+        // bare JIDs allowed to run the admin commands
+        const std::vector<std::string> mAdmins;
+        // where the admin commands read and write their files, ends with a
+        // slash like storage_dir
+        const std::string mTransferDir;
+        PendingRegMapT mPendingRegs;
+        std::unordered_map<DeviceKeyT, NodeIdT> mPendingDeviceNodes;
+        // nodes of the pending registrations not started yet, in order
+        std::deque<NodeIdT> mQueuedNodes;
+        // started pending registrations
+        std::size_t mProvisioningCount;
+        std::unique_ptr<RegistrationJournal> mJournal;
+        PendingActionMapT mPendingActions;
+        // by stanza id, entries of answered IQs are skipped once due
+        TimerWheel<ActionDeadline> mDeadlines;
+        Metrics::Counter* mTimeoutCounter;
+        // guards the pending registrations, their actions and deadlines,
+        // taken before any lock of mRegs
+        std::mutex mPendingMutex;
+        std::condition_variable mDeadlinesCv;
+        bool mStopDeadlines;
+        std::thread mDeadlinesThread;
+        // guarded by mPendingMutex as well
+        AdminJob mJob;
+        // an import waits for free provisioning slots
+        std::condition_variable mImportCv;
+        std::thread mJobThread;
     };
 }
 
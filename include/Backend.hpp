@@ -20,17 +20,29 @@
 #define OSHIYA_BACKEND__H
 
 #include "Jid.hpp"
+#include "RNG.hpp"
+#include "TimerWheel.hpp"
+#include "CircuitBreaker.hpp"
+#include "ConcurrencyLimiter.hpp"
+#include "Metrics.hpp"
 
 #include <map>
 #include <list>
+#include <unordered_map>
+#include <vector>
 #include <functional>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
+#include <memory>
+#include <cstdint>
+#include <ctime>
 
 namespace Oshiya
 {
+    class NotificationSpool;
+
     class Backend
     {
         public:
@@ -54,36 +66,111 @@ namespace Oshiya
             static const unsigned int NotificationExpireTime {60 * 60 * 24};
             static const unsigned int HttpTimeout {10000};
             static const unsigned int ConnectTimeout {10000};
-            static const unsigned int RetryPeriod {10000};
+            // a failed notification is retried after a random delay between
+            // half and all of MinRetryDelay * 2^(attempts - 1), capped at
+            // MaxRetryDelay (ms)
+            static const unsigned int MinRetryDelay {1000};
+            static const unsigned int MaxRetryDelay {10 * 60 * 1000};
+            // attempts before a notification is dropped
+            static const unsigned int MaxAttempts {10};
+            // resolution and size of the retry timer wheel
+            static const unsigned int RetryTick {250};
+            static const std::size_t RetrySlots {4096};
+            // a batch with more failed notifications, or taking longer (ms),
+            // counts against the circuit breaker and concurrency limit
+            static const unsigned int MaxFailurePercent {50};
+            static const unsigned int MaxSendTime {HttpTimeout / 2};
+            // idle HTTP connections send TCP keepalive probes this often (ms)
+            static const unsigned int KeepAliveInterval {60000};
+            static const std::size_t DefaultMaxBatchSize {100};
+            static const std::size_t DefaultConcurrentRequests {100};
             // TODO: ciphersuites
         };
 
+        /**
+         * makes the callback unregistering the device a notification was
+         * dispatched for, see dispatch()
+         */
+        using UnregisterCbFactoryT =
+        std::function<std::function<void()>(const std::string& unregisterKey)>;
+
+        /**
+         * per-backend settings from the backend's config section
+         */
+        struct Options
+        {
+            Options()
+                :
+                    maxBatchSize {Parameters::DefaultMaxBatchSize},
+                    linger {0},
+                    concurrentRequests {Parameters::DefaultConcurrentRequests},
+                    workers {1}
+            { }
+
+            // upper bound for the notifications handed to send() at once
+            std::size_t maxBatchSize;
+            // ms to wait for more notifications before sending a batch that
+            // isn't full yet
+            unsigned int linger;
+            // requests (HTTP/2 streams) a backend keeps in flight at once
+            std::size_t concurrentRequests;
+            // worker threads (at least 1), each with a connection of its own
+            std::size_t workers;
+            // directory keeping queued notifications across restarts, no
+            // spool if empty
+            std::string spoolPath;
+            // replaces the push service's endpoint, e.g. with a local mock,
+            // the default endpoint if empty
+            std::string url;
+            UnregisterCbFactoryT makeUnregisterCb;
+        };
+
         struct PushNotification
         {
-            PushNotification(std::size_t _deviceHash,
-                             const PayloadT& _payload,
-                             const std::string& _token,
-                             const std::string& _appId,
-                             const std::function<void()>& _unregisterCb)
+            PushNotification(uint64_t _spoolId,
+                             std::time_t _createdAt,
+                             std::size_t _deviceHash,
+                             PayloadT _payload,
+                             std::string _token,
+                             std::string _appId,
+                             std::string _unregisterKey,
+                             std::function<void()> _unregisterCb)
                 :
+                    spoolId {_spoolId},
+                    createdAt {_createdAt},
                     deviceHash {_deviceHash},
-                    payload {_payload},
-                    token {_token},
-                    appId {_appId},
-                    unregisterCb {_unregisterCb}
+                    payload {std::move(_payload)},
+                    token {std::move(_token)},
+                    appId {std::move(_appId)},
+                    unregisterKey {std::move(_unregisterKey)},
+                    unregisterCb {std::move(_unregisterCb)},
+                    attempts {0},
+                    retryAfter {0}
             { }
 
+            const uint64_t spoolId;
+            // dropped NotificationExpireTime seconds after this
+            const std::time_t createdAt;
             const std::size_t deviceHash;
             const PayloadT payload;
             const std::string token;
             const std::string appId;
+            const std::string unregisterKey;
             const std::function<void()> unregisterCb;
+
+            // retry state, kept by Backend
+            unsigned int attempts;
+            std::chrono::steady_clock::time_point retryTime;
+            // seconds the push service asked to wait before the next attempt
+            // (Retry-After), set by send() on failed notifications
+            unsigned int retryAfter;
         };
 
         Backend(Type _type,
                 const Jid& _host,
                 const std::string& _appName,
-                const std::string& _certFile);
+                const std::string& _certFile,
+                const Options& _options);
 
         Backend(const Backend&) = delete;
         Backend(Backend&&) = default;
@@ -94,6 +181,7 @@ namespace Oshiya
         const Jid host;
         const std::string appName;
         const std::string certFile;
+        const Options options;
 
         IdT getId();
 
@@ -103,36 +191,102 @@ namespace Oshiya
         static Type makeType(const std::string& typeStr);
         static std::string getTypeStr(Type type);
 
+        /**
+         * queues a notification, replacing one still queued for the same
+         * device. unregisterKey is handed to options.makeUnregisterCb, it is
+         * spooled along with the notification.
+         */
         void dispatch(std::size_t deviceHash,
                       const PayloadT& payload,
-                      const std::string& token,
-                      const std::string& appId,
-                      std::function<void()> unregisterCb);
-
-        void doWork();
+                      std::string token,
+                      std::string appId,
+                      std::string unregisterKey);
 
         protected:
         /////////
 
         using NotificationQueueT = std::list<PushNotification>;
 
-        void startWorker();
+        /**
+         * starts options.workers threads. Implementations call this once the
+         * per-worker connections exist.
+         */
+        void startWorkers();
+
+        /**
+         * joins the worker threads. Implementations call this first thing in
+         * their destructor, so send() never runs on a partly destroyed object.
+         */
+        void stopWorkers();
 
         private:
         ////////
 
         /**
-         * hand the dispatch queue to the backend implementation. The implementation
-         * can return a list of notifications for retrying.
+         * hand a batch of at most options.maxBatchSize notifications to the
+         * backend implementation, which may coalesce them into fewer requests.
+         * The implementation can return a list of notifications for retrying.
+         * Called by all workers concurrently, worker (< options.workers) tells
+         * which connection to use.
          */
-        virtual NotificationQueueT send(const NotificationQueueT& notifications) = 0;
+        virtual NotificationQueueT send(const NotificationQueueT& notifications,
+                                        std::size_t worker) = 0;
+
+        /**
+         * worker thread: takes batches from the shared queues as long as there
+         * are any, so a worker stuck on a slow request doesn't hold up the rest
+         */
+        void doWork(std::size_t worker);
+
+        std::function<void()> makeUnregisterCb(const std::string& unregisterKey) const;
+
+        /**
+         * appends n to mDispatchQueue, a notification already queued for the
+         * device is dropped. mDispatchMutex must be held.
+         */
+        void enqueue(PushNotification&& n);
+
+        /**
+         * schedules the notification at it in failed for another attempt, or
+         * drops it if it ran out of attempts or expires before the retry.
+         * mDispatchMutex must be held.
+         */
+        void scheduleRetry(NotificationQueueT& failed, NotificationQueueT::iterator it);
+
+        /**
+         * moves up to count notifications from the front of from to the end of to
+         */
+        static void spliceFront(NotificationQueueT& to,
+                                NotificationQueueT& from,
+                                std::size_t count);
       
-        volatile bool mShutdown;
+        // guards everything below except the worker threads
         std::mutex mDispatchMutex;
-        std::mutex mSendMutex;
+        bool mShutdown;
         std::condition_variable mSendCv;
         NotificationQueueT mDispatchQueue;
-        std::thread mWorkerThread;
+        // the queued notification of each device, list iterators stay valid
+        // until the element is erased or spliced to another list
+        std::unordered_map<std::size_t, NotificationQueueT::iterator> mDispatchIndex;
+        // failed notifications waiting for their retryTime
+        TimerWheel<PushNotification> mRetryWheel;
+        // notifications due for a retry, sent after the fresh ones
+        NotificationQueueT mRetryQueue;
+        // retry jitter
+        RNG mRNG;
+        CircuitBreaker mBreaker;
+        // notifications in flight across all workers
+        ConcurrencyLimiter mLimiter;
+        std::vector<std::thread> mWorkerThreads;
+        std::unique_ptr<NotificationSpool> mSpool;
+        uint64_t mNextSpoolId;
+
+        // owned by Metrics::getRegistry()
+        Metrics::Counter* mSentCounter;
+        Metrics::Counter* mRetryCounter;
+        Metrics::Counter* mDropCounter;
+        Metrics::Counter* mUnregisterCounter;
+        Metrics::Histogram* mSendDuration;
     };
 }
 
@@ -0,0 +1,102 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_CIRCUIT_BREAKER__H
+#define OSHIYA_CIRCUIT_BREAKER__H
+
+#include <chrono>
+#include <cstddef>
+
+namespace Oshiya
+{
+    /**
+     * stops a backend from sending while its push service is failing. After
+     * Parameters::FailureThreshold unhealthy batches in a row the circuit
+     * opens and nothing is sent. Once the open time has passed a single small
+     * probe batch is let through (half-open): if it is healthy the circuit
+     * closes, otherwise it opens again for twice as long.
+     *
+     * Not thread-safe.
+     */
+    class CircuitBreaker
+    {
+        public:
+        ///////
+
+        using Clock = std::chrono::steady_clock;
+
+        enum class State
+        {
+            Closed,
+            Open,
+            HalfOpen
+        };
+
+        struct Parameters
+        {
+            static const unsigned int FailureThreshold {5};
+            // ms
+            static const unsigned int MinOpenTime {10000};
+            static const unsigned int MaxOpenTime {5 * 60 * 1000};
+            static const std::size_t ProbeBatchSize {10};
+        };
+
+        CircuitBreaker();
+
+        State getState() const {return mState;}
+
+        /**
+         * whether a batch may be started at now
+         */
+        bool isSendAllowed(Clock::time_point now) const;
+
+        /**
+         * when an open circuit lets the next probe through
+         */
+        Clock::time_point getProbeTime() const {return mProbeTime;}
+
+        /**
+         * the most notifications the next batch may hold
+         */
+        std::size_t getBatchLimit() const;
+
+        /**
+         * to be called when a batch is started, returns whether the batch is
+         * a probe
+         */
+        bool startSend(Clock::time_point now);
+
+        /**
+         * to be called with the outcome of each batch started
+         */
+        void record(bool healthy, bool probe, Clock::time_point now);
+
+        private:
+        ////////
+
+        void open(Clock::time_point now);
+
+        State mState;
+        unsigned int mFailures;
+        std::chrono::milliseconds mOpenTime;
+        Clock::time_point mProbeTime;
+        bool mProbing;
+    };
+}
+
+#endif
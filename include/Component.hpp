@@ -27,10 +27,12 @@
 #include "XmppUtils.hpp"
 #include "SmartPointerUtil.hpp"
 #include "RNG.hpp"
+#include "MpscQueue.hpp"
+#include "Metrics.hpp"
 
 #include <thread>
 #include <mutex>
-#include <queue>
+#include <cstdint>
 extern "C"
 {
     #include "strophe.h"
@@ -49,8 +51,10 @@ namespace Oshiya
 
         struct Parameters
         {
-            static const int StropheLoopTimeout {1}; // 1 ms
+            static const int MaxEventWait {1000}; // 1000 ms, bounds strophe's timed handlers
             static const int ReconnectInterval {10000}; // 10000 ms
+            static const std::size_t OutPacketQueueCapacity {1 << 16};
+            static const std::size_t OutPacketBatchSize {256};
         };
 
         Component(const Config& config);
@@ -92,6 +96,11 @@ namespace Oshiya
         
         void shutdown();
 
+        std::size_t getOutQueueDepth() const {return mOutPackets.size();}
+
+        std::size_t getOutQueueHighWatermark() const
+        {return mOutPackets.highWatermark();}
+
         protected:
         //////////
 
@@ -101,11 +110,13 @@ namespace Oshiya
 
         std::string makeRandomString(std::size_t length = 12);
 
-        Config getConfig() const {return mConfig;}
-        Jid getJid() const {return mJid;}
-        Jid getServerJid() const {return mServerJid;}
+        const Config& getConfig() const {return mConfig;}
+        const Jid& getJid() const {return mJid;}
+        const Jid& getServerJid() const {return mServerJid;}
         unsigned short getPort() const {return mPort;}
-        Jid getPubsubJid() const {return mPubsubJid;}
+        const Jid& getPubsubJid() const {return mPubsubJid;}
+
+        using NotificationPayloadT = InStanza<InPacket::Type::PushNotification>::PayloadT;
 
         virtual void commandReceived(const Jid& from,
                                      const std::string& id,
@@ -123,7 +134,7 @@ namespace Oshiya
 
         virtual void pushNotificationReceived(const Jid& from,
                                               const std::string& node,
-                                              const XData& payload) = 0;
+                                              const NotificationPayloadT& payload) = 0;
 
         private:
         ////////
@@ -136,6 +147,23 @@ namespace Oshiya
 
         void run();
 
+        /**
+         * serializes up to OutPacketBatchSize queued OutPackets and hands them
+         * to strophe
+         */
+        void sendOutPackets();
+
+        /**
+         * blocks until the strophe socket becomes ready, sendPacket() or
+         * shutdown() signal the wakeup descriptor, or MaxEventWait passes
+         */
+        void waitForEvents();
+
+        /**
+         * wakes the XMPP thread up from waitForEvents()
+         */
+        void notifyEventLoop();
+
         void invalidStanzaReceived(const XmlElement& packet);
 
         // strophe callbacks
@@ -147,6 +175,14 @@ namespace Oshiya
                                  xmpp_stanza_t* const stanza,
                                  void* const userdata);
 
+        /**
+         * hands strophe's log messages to the Logger's xmpp module
+         */
+        static void logHandler(void* const userdata,
+                               const xmpp_log_level_t level,
+                               const char* const area,
+                               const char* const msg);
+
         static void connHandler(xmpp_conn_t* const conn,
                                 const xmpp_conn_event_t status,
                                 const int error,
@@ -154,7 +190,7 @@ namespace Oshiya
                                 void* const userData);
 
         Config mConfig;
-        xmpp_log_t* mLogger;
+        xmpp_log_t mLogger;
         xmpp_ctx_t* mContext;
         xmpp_conn_t* mConnection;
         Jid mJid;
@@ -164,8 +200,12 @@ namespace Oshiya
         StanzaDispatcher mStanzaDispatcher;
         std::thread mXmppThread;
         volatile bool mShutdown;
-        std::mutex mOutPacketsMutex;
-        std::queue<std::unique_ptr<OutPacket>> mOutPackets;
+        int mWakeupFd;
+        int mEpollFd;
+        int mPolledSock;
+        uint32_t mPolledEvents;
+        MpscQueue<std::unique_ptr<OutPacket>> mOutPackets;
+        std::mutex mRNGMutex;
         RNG mRNG;
     };
 } // namespace Oshiya
@@ -0,0 +1,74 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_CONCURRENCY_LIMITER__H
+#define OSHIYA_CONCURRENCY_LIMITER__H
+
+#include <chrono>
+#include <cstddef>
+
+namespace Oshiya
+{
+    /**
+     * limits the notifications a backend has in flight at once (AIMD): the
+     * limit grows by one with every healthy batch and is halved by an
+     * unhealthy one, down to Parameters::MinLimit. Batches started before
+     * the last decrease don't decrease it again, so a burst of failures
+     * from the same episode halves the limit only once.
+     *
+     * Not thread-safe.
+     */
+    class ConcurrencyLimiter
+    {
+        public:
+        ///////
+
+        using Clock = std::chrono::steady_clock;
+
+        struct Parameters
+        {
+            static const std::size_t MinLimit {1};
+        };
+
+        /**
+         * starts at maxLimit
+         */
+        explicit ConcurrencyLimiter(std::size_t maxLimit);
+
+        std::size_t getLimit() const {return mLimit;}
+
+        std::size_t getAvailable() const;
+
+        void acquire(std::size_t count);
+
+        /**
+         * gives back count notifications of a batch started at startTime
+         */
+        void release(std::size_t count, bool healthy, Clock::time_point startTime);
+
+        private:
+        ////////
+
+        const std::size_t mMaxLimit;
+        std::size_t mLimit;
+        std::size_t mInFlight;
+        Clock::time_point mDecreaseTime;
+    };
+}
+
+#endif
@@ -22,9 +22,9 @@
 #include <yaml-cpp/yaml.h>
 
 #include <string>
+#include <vector>
+#include <stdexcept>
 
-// DEBUG:
-#include <iostream>
 
 namespace Oshiya
 {
@@ -53,7 +53,6 @@ namespace Oshiya
 
             if(not node.IsDefined())
             {
-                std::cout << "throwing InvalidConfig 1" << std::endl;
                 throw InvalidConfig {"Invalid config: Option " + key + " not defined"};
             }
 
@@ -63,7 +62,6 @@ namespace Oshiya
             }
             catch(const YAML::Exception&)
             {
-                std::cout << "throwing InvalidConfig 2" << std::endl;
                 throw
                 InvalidConfig {"Invalid config: Option " + key + " has invalid value"};
             }
@@ -95,7 +93,6 @@ namespace Oshiya
 
             if(not node.IsDefined())
             {
-                std::cout << "throwing InvalidConfig 3" << std::endl;
                 throw InvalidConfig {"Invalid config: Option " + key + " not defined"};
             }
 
@@ -20,8 +20,11 @@
 #define OSHIYA_GCM_BACKEND__H
 
 #include "Backend.hpp"
+#include "HttpClient.hpp"
 #include "json/json.h"
-#include "curl_easy.h"
+
+#include <vector>
+#include <memory>
 
 namespace Oshiya
 {
@@ -33,33 +36,52 @@ namespace Oshiya
         struct GcmParameters
         {
             static const unsigned int MaxPayloadSize {4096};
+            // GCM accepts up to 1000 registration_ids per request
+            static const std::size_t MaxMulticastSize {1000};
         };
 
         GcmBackend(const Jid& host,
                    const std::string& appName,
                    const std::string& certFile,
-                   const std::string& authKey);
+                   const std::string& authKey,
+                   const Options& options);
 
         ~GcmBackend() override;
 
+        using RecipientsT = std::vector<const PushNotification*>;
+
+        /**
+         * the request body sending payload to recipients
+         */
+        static std::string makePayload(const RecipientsT& recipients,
+                                       const PayloadT& payload);
+
         private:
         ////////
 
-        NotificationQueueT send(const NotificationQueueT& notification) override;
-
-        static std::size_t bodyWriteCb(char* ptr,
-                                       std::size_t size,
-                                       std::size_t nmemb,
-                                       void* userdata);
+        NotificationQueueT send(const NotificationQueueT& notification,
+                                std::size_t worker) override;
 
-        std::string makePayload(const std::string& token, const PayloadT& n);
+        /**
+         * evaluates a finished multicast request, recipients to retry are
+         * added to retryQueue
+         */
+        void completeRequest(const HttpClient::Request& request,
+                             const RecipientsT& recipients,
+                             NotificationQueueT& retryQueue);
 
-        bool processSuccessResponse(const std::string& responseBody,
-                                    const PushNotification& notification);
+        /**
+         * handles the per-recipient results of a request GCM answered with
+         * status 200
+         */
+        void processSuccessResponse(const std::string& responseBody,
+                                    const RecipientsT& recipients,
+                                    NotificationQueueT& retryQueue);
 
         std::string mAuthKey;
-        Json::StyledWriter mWriter;
-        curl::curl_easy mCurl;
+        curl_slist* mHeaders;
+        // one per worker
+        std::vector<std::unique_ptr<HttpClient>> mClients;
     };
 }
 
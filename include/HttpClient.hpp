@@ -0,0 +1,123 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ *
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_HTTP_CLIENT__H
+#define OSHIYA_HTTP_CLIENT__H
+
+#include <curl/curl.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace Oshiya
+{
+    /**
+     * issues POST requests as concurrent HTTP/2 streams. The connections are
+     * kept open between calls to perform(), and so are the easy handles. Idle
+     * connections send TCP keepalive probes, so middleboxes don't drop them
+     * between batches.
+     * Not thread-safe, every backend worker owns its own client.
+     */
+    class HttpClient
+    {
+        public:
+        ///////
+
+        struct Request
+        {
+            Request(const std::string& _url,
+                    const curl_slist* _headers,
+                    std::string&& _body,
+                    std::size_t _tag)
+                :
+                    url {_url},
+                    headers {_headers},
+                    body {std::move(_body)},
+                    tag {_tag},
+                    result {CURLE_OK},
+                    responseCode {0},
+                    retryAfter {0},
+                    mHandle {nullptr}
+            { }
+
+            const std::string url;
+            // owned by the caller, must live until the request is completed
+            const curl_slist* headers;
+            const std::string body;
+            // lets the caller find whatever belongs to the request
+            const std::size_t tag;
+
+            // set once the request is completed
+            CURLcode result;
+            long responseCode;
+            // seconds from the Retry-After header, 0 if there was none
+            long retryAfter;
+            std::string responseBody;
+
+            private:
+            ////////
+
+            friend class HttpClient;
+
+            CURL* mHandle;
+        };
+
+        using CompletionCbT = std::function<void(Request&)>;
+
+        /**
+         * certFile is used as TLS client certificate unless it is empty
+         */
+        HttpClient(const std::string& certFile, std::size_t maxConcurrentRequests);
+
+        HttpClient(const HttpClient&) = delete;
+        HttpClient(HttpClient&&) = delete;
+
+        ~HttpClient();
+
+        /**
+         * runs all requests, at most maxConcurrentRequests at a time, and
+         * calls completionCb for each one as soon as it is done. Requests
+         * which couldn't be started are completed with CURLE_FAILED_INIT.
+         */
+        void perform(std::vector<Request>& requests,
+                     const CompletionCbT& completionCb);
+
+        private:
+        ////////
+
+        bool start(Request& request);
+
+        CURL* acquireHandle();
+
+        void releaseHandle(CURL* handle);
+
+        static std::size_t bodyWriteCb(char* ptr,
+                                       std::size_t size,
+                                       std::size_t nmemb,
+                                       void* userdata);
+
+        const std::string mCertFile;
+        const std::size_t mMaxConcurrentRequests;
+
+        CURLM* mMulti;
+        std::vector<CURL*> mIdleHandles;
+    };
+}
+
+#endif
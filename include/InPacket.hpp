@@ -24,6 +24,8 @@
 #include "XmlElement.hpp"
 
 #include <functional>
+#include <map>
+#include <utility>
 
 namespace Oshiya
 {
@@ -40,6 +42,7 @@ namespace Oshiya
 
         virtual ~InPacket() = 0;
 
+        virtual Type getType() const = 0;
         virtual bool hasHandler() const = 0;
         virtual void callHandler() const = 0;
     };
@@ -64,20 +67,21 @@ namespace Oshiya
                            const XData&)>;
 
         InStanza(FuncT _handler,
-                 const Jid& _from,
-                 const std::string& _id,
-                 const std::string& _action,
-                 const std::string& _node,
-                 const XData& _payload)
+                 Jid _from,
+                 std::string _id,
+                 std::string _action,
+                 std::string _node,
+                 XData _payload)
             :
-                handler {_handler},
-                from {_from},
-                id {_id},
-                action {_action},
-                node {_node},
-                payload {_payload}
+                handler {std::move(_handler)},
+                from {std::move(_from)},
+                id {std::move(_id)},
+                action {std::move(_action)},
+                node {std::move(_node)},
+                payload {std::move(_payload)}
         { }
 
+        Type getType() const override {return Type::AdhocCommand;}
         bool hasHandler() const override {return handler != nullptr;}
         void callHandler() const override {handler(from, id, action, node, payload);}
 
@@ -97,14 +101,15 @@ namespace Oshiya
         std::function<void(const Jid&, const std::string&)>;
 
         InStanza(FuncT _handler,
-                 const Jid& _from,
-                 const std::string& _id)
+                 Jid _from,
+                 std::string _id)
             :
-                handler {_handler},
-                from {_from},
-                id {_id}
+                handler {std::move(_handler)},
+                from {std::move(_from)},
+                id {std::move(_id)}
         { }
 
+        Type getType() const override {return Type::IqResult;}
         bool hasHandler() const override {return handler != nullptr;}
         void callHandler() const override {handler(from, id);}
 
@@ -124,18 +129,19 @@ namespace Oshiya
                            const std::vector<std::string>&)>;
 
         InStanza(FuncT _handler,
-                 const Jid& _from,
-                 const std::string& _id,
-                 const std::string& _errorType,
-                 const std::vector<std::string>& _errors)
+                 Jid _from,
+                 std::string _id,
+                 std::string _errorType,
+                 std::vector<std::string> _errors)
             :
-                handler {_handler},
-                from {_from},
-                id {_id},
-                errorType {_errorType},
-                errors {_errors}
+                handler {std::move(_handler)},
+                from {std::move(_from)},
+                id {std::move(_id)},
+                errorType {std::move(_errorType)},
+                errors {std::move(_errors)}
         { }
 
+        Type getType() const override {return Type::IqError;}
         bool hasHandler() const {return handler != nullptr;}
         void callHandler() const override {handler(from, id, errorType, errors);}
 
@@ -150,29 +156,33 @@ namespace Oshiya
     template <>
     struct InStanza<InPacket::Type::PushNotification> : public InPacket
     {
+        // the summary's text-single fields by var
+        using PayloadT = std::map<std::string, std::string>;
+
         using FuncT =
         std::function<void(const Jid&,
                            const std::string&,
-                           const XData&)>;
+                           const PayloadT&)>;
 
         InStanza(FuncT _handler,
-                 const Jid& _from,
-                 const std::string& _node,
-                 const XData& _payload)
+                 Jid _from,
+                 std::string _node,
+                 PayloadT _payload)
             :
-                handler {_handler},
-                from {_from},
-                node {_node},
-                payload {_payload}
+                handler {std::move(_handler)},
+                from {std::move(_from)},
+                node {std::move(_node)},
+                payload {std::move(_payload)}
         { }
 
+        Type getType() const override {return Type::PushNotification;}
         bool hasHandler() const override {return handler != nullptr;}
         void callHandler() const override {handler(from, node, payload);}
  
         const FuncT handler;
         const Jid from;
         const std::string node;
-        const XData payload;
+        const PayloadT payload;
     };
 
     // invalid stanza (non of the above)
@@ -183,12 +193,13 @@ namespace Oshiya
         std::function<void(const XmlElement&)>;
 
         InStanza(FuncT _handler,
-                 const XmlElement& _stanzaError)
+                 XmlElement _stanzaError)
             :
-                handler {_handler},
-                stanzaError {_stanzaError}
+                handler {std::move(_handler)},
+                stanzaError {std::move(_stanzaError)}
         { }
 
+        Type getType() const override {return Type::Invalid;}
         bool hasHandler() const override {return handler != nullptr;}
         void callHandler() const override {handler(stanzaError);}
  
@@ -202,7 +213,7 @@ namespace Oshiya
     {
         using FuncT = typename InStanza<T>::FuncT;
 
-        InStanzaHandler(FuncT _func) : func {_func}
+        InStanzaHandler(FuncT _func) : func {std::move(_func)}
         { }
 
         FuncT func;
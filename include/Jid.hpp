@@ -19,27 +19,50 @@
 #ifndef OSHIYA_JID__H
 #define OSHIYA_JID__H
 
+#include "StringView.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
 #include <string>
+#include <utility>
 
 namespace Oshiya
 {
+    /**
+     * immutable JID. user@server/resource is kept in one buffer together
+     * with the bare JID and the hashes of both, and shared between copies.
+     * intern() returns the one representation kept for equal JIDs, so
+     * comparing two interned JIDs compares pointers.
+     */
     class Jid
     {
         public:
         ///////
 
-        Jid() = default;
+        Jid();
 
         Jid(const std::string& user,
             const std::string& server,
-            const std::string& resource)
-            : mUser{user}, mServer{server}, mResource{resource}
-        { }
+            const std::string& resource);
+
+        // moves copy as well, a moved-from Jid stays usable
+        Jid(const Jid&) = default;
+        Jid& operator=(const Jid&) = default;
 
         bool operator==(const Jid& j) const
-        { 
-            return
-            j.mUser == mUser and j.mServer == mServer and j.mResource == mResource;
+        {
+            if(mData == j.mData)
+            {
+                return true;
+            }
+
+            if(mData->interned and j.mData->interned)
+            {
+                return false;
+            }
+
+            return mData->hash == j.mData->hash and mData->full == j.mData->full;
         }
 
         bool operator!=(const Jid& j) const
@@ -47,34 +70,91 @@ namespace Oshiya
             return not (*this == j);
         }
 
-        std::string getUser() const { return mUser; }
-        std::string getServer() const { return mServer; }
-        std::string getResource() const { return mResource; }
+        /**
+         * compares the bare JIDs only
+         */
+        bool equalsBare(const Jid& j) const
+        {
+            return
+            mData == j.mData or
+            (mData->bareHash == j.mData->bareHash and bare() == j.bare());
+        }
+
+        StringView getUser() const
+        {
+            return StringView {mData->full.data(), mData->userLength};
+        }
+
+        StringView getServer() const
+        {
+            return StringView {mData->full.data() + mData->serverOffset,
+                               bare().size() - mData->serverOffset};
+        }
+
+        StringView getResource() const
+        {
+            return
+            mData->hasResource ?
+            StringView {mData->full.data() + bare().size() + 1,
+                        mData->full.size() - bare().size() - 1} :
+            StringView {};
+        }
+
+        const std::string& bare() const
+        { return mData->hasResource ? mData->bare : mData->full; }
 
-        void setUser(const std::string& user) {mUser = user;}
-        void setServer(const std::string& server) {mServer = server;}
-        void setResource(const std::string& resource) {mResource = resource;}
+        const std::string& full() const
+        { return mData->full; }
 
-        std::string bare() const
-        { return mUser.empty() ? mServer : mUser + '@' + mServer; }
+        std::size_t hash() const {return mData->hash;}
+        std::size_t bareHash() const {return mData->bareHash;}
 
-        std::string full() const
-        { return mResource.empty() ? bare() : bare() + '/' + mResource; }
+        bool isInterned() const {return mData->interned;}
 
         static Jid removeResource(const Jid& jid)
         {
-            return Jid {jid.mUser, jid.mServer, ""};
+            return Jid {jid.getUser().str(), jid.getServer().str(), ""};
         }
 
-        bool isValid()
-        { return not mServer.empty(); }
+        /**
+         * the representation shared by all interned JIDs equal to jid,
+         * thread-safe. Meant for JIDs that are kept and compared often, e.g.
+         * those of registrations.
+         */
+        static Jid intern(const Jid& jid);
+
+        bool isValid() const
+        { return not getServer().empty(); }
 
         private:
         ////////
 
-        std::string mUser;
-        std::string mServer;
-        std::string mResource;
+        struct Data
+        {
+            std::string full;
+            // only set if there's a resource, full is the bare JID otherwise
+            std::string bare;
+            std::size_t userLength;
+            std::size_t serverOffset;
+            bool hasResource;
+            std::size_t hash;
+            std::size_t bareHash;
+            bool interned;
+        };
+
+        explicit Jid(std::shared_ptr<const Data> data) : mData {std::move(data)}
+        { }
+
+        std::shared_ptr<const Data> mData;
+    };
+}
+
+namespace std
+{
+    template <>
+    struct hash<Oshiya::Jid>
+    {
+        std::size_t operator()(const Oshiya::Jid& jid) const {return jid.hash();}
     };
 }
 
@@ -0,0 +1,183 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_LOGGER__H
+#define OSHIYA_LOGGER__H
+
+#include "MpscQueue.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+// levels below this one are compiled out (0: debug ... 3: error)
+#ifndef OSHIYA_LOG_MIN_LEVEL
+#define OSHIYA_LOG_MIN_LEVEL 0
+#endif
+
+/**
+ * LOG_DEBUG(Backend, "sending " << count << " notifications");
+ *
+ * The message is only formatted, and its operands only evaluated, if the
+ * level is enabled for the module.
+ */
+#define OSHIYA_LOG(module, level, message)                                      \
+    do                                                                          \
+    {                                                                           \
+        using OshiyaLogLevelT = ::Oshiya::Logger::Level;                        \
+        using OshiyaLogModuleT = ::Oshiya::Logger::Module;                      \
+                                                                                \
+        if(static_cast<unsigned int>(OshiyaLogLevelT::level) >=                 \
+               OSHIYA_LOG_MIN_LEVEL and                                         \
+           ::Oshiya::Logger::getInstance().isEnabled(OshiyaLogModuleT::module,  \
+                                                     OshiyaLogLevelT::level))   \
+        {                                                                       \
+            std::ostringstream oshiyaLogStream;                                 \
+            oshiyaLogStream << message;                                         \
+            ::Oshiya::Logger::getInstance().log(OshiyaLogModuleT::module,       \
+                                                OshiyaLogLevelT::level,         \
+                                                oshiyaLogStream.str());         \
+        }                                                                       \
+    } while(false)
+
+#define LOG_DEBUG(module, message) OSHIYA_LOG(module, Debug, message)
+#define LOG_INFO(module, message) OSHIYA_LOG(module, Info, message)
+#define LOG_WARNING(module, message) OSHIYA_LOG(module, Warning, message)
+#define LOG_ERROR(module, message) OSHIYA_LOG(module, Error, message)
+
+namespace Oshiya
+{
+    /**
+     * asynchronous leveled logger. Logging threads format their message and
+     * push it to a lock-free ring buffer, a background thread writes the
+     * records to stdout in logfmt (time=... level=... module=... msg="...").
+     * A full buffer drops records rather than blocking, the number of
+     * dropped records is logged once there is room again.
+     */
+    class Logger
+    {
+        public:
+        ///////
+
+        enum class Level : unsigned int
+        {
+            Debug,
+            Info,
+            Warning,
+            Error,
+            Off
+        };
+
+        enum class Module : std::size_t
+        {
+            Main,
+            Component,
+            Stanza,
+            AppServer,
+            Storage,
+            Backend,
+            Http,
+            Metrics,
+            Xmpp,
+            Count
+        };
+
+        struct Parameters
+        {
+            static const std::size_t QueueCapacity {1 << 14};
+            // the writer waits at most this long for new records (ms)
+            static const unsigned int FlushInterval {100};
+            static const Level DefaultLevel {Level::Info};
+        };
+
+        static Logger& getInstance();
+
+        Logger(const Logger&) = delete;
+        Logger(Logger&&) = delete;
+
+        /**
+         * writes what is still queued
+         */
+        ~Logger();
+
+        bool isEnabled(Module module, Level level) const
+        {
+            return
+            level >= mLevels[static_cast<std::size_t>(module)].load(std::memory_order_relaxed);
+        }
+
+        /**
+         * for all modules
+         */
+        void setLevel(Level level);
+
+        void setLevel(Module module, Level level);
+
+        void log(Module module, Level level, std::string&& message);
+
+        /**
+         * "debug", "info", "warning", "error" or "off"
+         */
+        static bool parseLevel(const std::string& str, Level& level);
+
+        /**
+         * the module's name in lower case, "app_server" for AppServer
+         */
+        static bool parseModule(const std::string& str, Module& module);
+
+        static const char* getLevelStr(Level level);
+        static const char* getModuleStr(Module module);
+
+        private:
+        ////////
+
+        Logger();
+
+        struct Record
+        {
+            std::chrono::system_clock::time_point time;
+            Module module;
+            Level level;
+            std::string message;
+        };
+
+        void run();
+
+        void write(const Record& record, std::string& out);
+
+        std::array<std::atomic<Level>, static_cast<std::size_t>(Module::Count)> mLevels;
+        MpscQueue<Record> mRecords;
+        std::atomic<uint64_t> mDropped;
+
+        std::mutex mMutex;
+        std::condition_variable mCv;
+        bool mShutdown;
+        // the writer is (about to go) asleep
+        std::atomic<bool> mWaiting;
+        std::thread mThread;
+    };
+}
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_METRICS__H
+#define OSHIYA_METRICS__H
+
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+namespace Oshiya
+{
+    /**
+     * process-wide registry of counters, gauges and histograms, rendered in
+     * the Prometheus text exposition format.
+     *
+     * Looking a metric up takes the registry's lock, so components do that
+     * once when they are set up and keep the reference; counters and
+     * histograms are updated with relaxed atomics only. Gauges are callbacks
+     * evaluated at scrape time, with the registry's lock held.
+     */
+    class Metrics
+    {
+        public:
+        ///////
+
+        using LabelsT = std::vector<std::pair<std::string, std::string>>;
+        using GaugeFnT = std::function<double()>;
+
+        class Counter
+        {
+            public:
+            ///////
+
+            Counter() : mValue {0} { }
+
+            void increment(uint64_t by = 1)
+            {mValue.fetch_add(by, std::memory_order_relaxed);}
+
+            uint64_t get() const {return mValue.load(std::memory_order_relaxed);}
+
+            private:
+            ////////
+
+            std::atomic<uint64_t> mValue;
+        };
+
+        /**
+         * latency histogram with log-linear buckets à la HdrHistogram: every
+         * power of two of microseconds is split into SubBucketCount buckets,
+         * so a value is recorded with a relative error below 1/SubBucketCount
+         */
+        class Histogram
+        {
+            public:
+            ///////
+
+            static const unsigned int SubBucketBits {3};
+            static const std::size_t SubBucketCount {1 << SubBucketBits};
+            static const std::size_t BucketCount {(64 - SubBucketBits + 1) * SubBucketCount};
+
+            Histogram();
+
+            void observe(std::chrono::microseconds duration);
+
+            /**
+             * values recorded up to upperBound (µs), within the buckets'
+             * precision
+             */
+            uint64_t getCount(uint64_t upperBound) const;
+
+            uint64_t getCount() const {return mCount.load(std::memory_order_relaxed);}
+
+            // µs
+            uint64_t getSum() const {return mSum.load(std::memory_order_relaxed);}
+
+            private:
+            ////////
+
+            static std::size_t getBucket(uint64_t value);
+
+            // the smallest value of the bucket following index
+            static uint64_t getBucketEnd(std::size_t index);
+
+            std::array<std::atomic<uint64_t>, BucketCount> mBuckets;
+            std::atomic<uint64_t> mCount;
+            std::atomic<uint64_t> mSum;
+        };
+
+        static Metrics& getRegistry();
+
+        Metrics(const Metrics&) = delete;
+        Metrics(Metrics&&) = delete;
+
+        /**
+         * returns the counter for name and labels, creating it if needed. The
+         * reference stays valid for the lifetime of the process.
+         */
+        Counter& getCounter(const std::string& name,
+                            const std::string& help,
+                            const LabelsT& labels);
+
+        Histogram& getHistogram(const std::string& name,
+                                const std::string& help,
+                                const LabelsT& labels);
+
+        /**
+         * owner has to remove its gauges with removeGauges() before anything
+         * fn refers to goes away
+         */
+        void addGauge(const std::string& name,
+                      const std::string& help,
+                      const LabelsT& labels,
+                      const GaugeFnT& fn,
+                      const void* owner);
+
+        void removeGauges(const void* owner);
+
+        /**
+         * all metrics in the Prometheus text format (version 0.0.4)
+         */
+        std::string render();
+
+        private:
+        ////////
+
+        Metrics() = default;
+
+        enum class Kind
+        {
+            Counter,
+            Gauge,
+            Histogram
+        };
+
+        struct Gauge
+        {
+            GaugeFnT fn;
+            const void* owner;
+        };
+
+        struct Family
+        {
+            Kind kind;
+            std::string help;
+            std::map<LabelsT, std::unique_ptr<Counter>> counters;
+            std::map<LabelsT, std::unique_ptr<Histogram>> histograms;
+            std::map<LabelsT, Gauge> gauges;
+        };
+
+        Family& getFamily(const std::string& name, const std::string& help, Kind kind);
+
+        static std::string formatLabels(const LabelsT& labels);
+
+        static std::string formatValue(double value);
+
+        std::mutex mMutex;
+        // ordered by name, so a scrape lists the families in a stable order
+        std::map<std::string, Family> mFamilies;
+    };
+}
+
+#endif
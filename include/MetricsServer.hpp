@@ -0,0 +1,70 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_METRICS_SERVER__H
+#define OSHIYA_METRICS_SERVER__H
+
+#include "Metrics.hpp"
+
+#include <string>
+#include <thread>
+
+namespace Oshiya
+{
+    /**
+     * serves Metrics::getRegistry() to Prometheus over plain HTTP/1.0, one
+     * request per connection, on its own thread. Meant for a local scraper,
+     * there is neither TLS nor authentication.
+     */
+    class MetricsServer
+    {
+        public:
+        ///////
+
+        struct Parameters
+        {
+            static const unsigned int ConnectionTimeout {5000}; // ms
+            static const std::size_t MaxRequestSize {8192};
+        };
+
+        /**
+         * address is "unix:<path>" for a unix socket, or "<ipv4 address>:<port>".
+         * Throws std::system_error if it can't be listened on.
+         */
+        explicit MetricsServer(const std::string& address);
+
+        MetricsServer(const MetricsServer&) = delete;
+        MetricsServer(MetricsServer&&) = delete;
+
+        ~MetricsServer();
+
+        private:
+        ////////
+
+        void run();
+
+        void handleConnection(int fd);
+
+        const std::string mAddress;
+        int mListenFd;
+        int mWakeupFd;
+        std::thread mThread;
+    };
+}
+
+#endif
@@ -0,0 +1,215 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ *
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_MPSC_QUEUE__H
+#define OSHIYA_MPSC_QUEUE__H
+
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace Oshiya
+{
+    /**
+     * bounded lock-free multi-producer/single-consumer ring buffer. Every
+     * slot carries a sequence number telling producers and the consumer
+     * whether it is free or filled (D. Vyukov's bounded queue). push() may be
+     * called from any thread, pop() only from the consumer thread.
+     */
+    template <typename T>
+    class MpscQueue
+    {
+        public:
+        ///////
+
+        explicit MpscQueue(std::size_t capacity)
+            :
+                mMask {roundUpToPowerOfTwo(capacity) - 1},
+                mCells {new Cell[mMask + 1]},
+                mTail {0},
+                mHead {0},
+                mHighWatermark {0}
+        {
+            for(std::size_t i {0}; i <= mMask; ++i)
+            {
+                mCells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        /**
+         * returns false if the queue is full, value is left untouched then
+         */
+        bool tryPush(T&& value)
+        {
+            Cell* cell;
+            std::size_t pos {mTail.load(std::memory_order_relaxed)};
+
+            while(true)
+            {
+                cell = &mCells[pos & mMask];
+
+                std::size_t seq {cell->sequence.load(std::memory_order_acquire)};
+                std::intptr_t diff
+                {static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos)};
+
+                if(diff == 0)
+                {
+                    if(mTail.compare_exchange_weak(pos,
+                                                   pos + 1,
+                                                   std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+
+                else if(diff < 0)
+                {
+                    return false;
+                }
+
+                else
+                {
+                    pos = mTail.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->value = std::move(value);
+            cell->sequence.store(pos + 1, std::memory_order_release);
+
+            // the consumer may already have popped past this element
+            std::size_t head {mHead.load(std::memory_order_relaxed)};
+
+            if(pos + 1 > head)
+            {
+                updateHighWatermark(std::min(pos + 1 - head, capacity()));
+            }
+
+            return true;
+        }
+
+        /**
+         * consumer side, returns false if the queue is empty
+         */
+        bool tryPop(T& value)
+        {
+            std::size_t pos {mHead.load(std::memory_order_relaxed)};
+            Cell& cell = mCells[pos & mMask];
+
+            if(cell.sequence.load(std::memory_order_acquire) != pos + 1)
+            {
+                return false;
+            }
+
+            value = std::move(cell.value);
+            cell.value = T {};
+            cell.sequence.store(pos + mMask + 1, std::memory_order_release);
+            mHead.store(pos + 1, std::memory_order_relaxed);
+
+            return true;
+        }
+
+        /**
+         * consumer side, moves up to maxCount elements to out and returns how
+         * many were moved
+         */
+        template <typename OutputIt>
+        std::size_t popBatch(OutputIt out, std::size_t maxCount)
+        {
+            std::size_t count {0};
+            T value;
+
+            while(count < maxCount and tryPop(value))
+            {
+                *out++ = std::move(value);
+                ++count;
+            }
+
+            return count;
+        }
+
+        /**
+         * number of queued elements, only approximate while producers are active
+         */
+        std::size_t size() const
+        {
+            std::size_t head {mHead.load(std::memory_order_relaxed)};
+            std::size_t tail {mTail.load(std::memory_order_relaxed)};
+
+            return tail > head ? tail - head : 0;
+        }
+
+        std::size_t capacity() const {return mMask + 1;}
+
+        std::size_t highWatermark() const
+        {
+            return mHighWatermark.load(std::memory_order_relaxed);
+        }
+
+        private:
+        ////////
+
+        static const std::size_t CacheLineSize {64};
+
+        struct Cell
+        {
+            std::atomic<std::size_t> sequence;
+            T value;
+        };
+
+        static std::size_t roundUpToPowerOfTwo(std::size_t n)
+        {
+            std::size_t ret {2};
+
+            while(ret < n)
+            {
+                ret <<= 1;
+            }
+
+            return ret;
+        }
+
+        void updateHighWatermark(std::size_t depth)
+        {
+            std::size_t current {mHighWatermark.load(std::memory_order_relaxed)};
+
+            while(depth > current and
+                  not mHighWatermark.compare_exchange_weak(current,
+                                                           depth,
+                                                           std::memory_order_relaxed))
+            { }
+        }
+
+        const std::size_t mMask;
+        const std::unique_ptr<Cell[]> mCells;
+
+        // producers and the consumer touch different cache lines
+        char mPad0[CacheLineSize];
+        std::atomic<std::size_t> mTail;
+        char mPad1[CacheLineSize - sizeof(std::atomic<std::size_t>)];
+        std::atomic<std::size_t> mHead;
+        char mPad2[CacheLineSize - sizeof(std::atomic<std::size_t>)];
+        std::atomic<std::size_t> mHighWatermark;
+    };
+}
+
+#endif
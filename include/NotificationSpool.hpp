@@ -0,0 +1,173 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ *
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_NOTIFICATION_SPOOL__H
+#define OSHIYA_NOTIFICATION_SPOOL__H
+
+#include "Backend.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+namespace Oshiya
+{
+    /**
+     * keeps a backend's queued and retrying notifications on disk, so they
+     * survive a restart. The spool is a directory of fixed-size segment files
+     * which are memory-mapped; appending a record is a memcpy into the
+     * current segment, commit() msyncs everything appended since the last
+     * commit at once, without blocking add() and remove().
+     *
+     * A segment is deleted once neither it nor an older segment holds a live
+     * notification. Live notifications keeping too many segments around are
+     * copied to the current segment. Deleting a segment waits for the next
+     * successful commit, which makes the copies durable first.
+     *
+     * record layout (host byte order):
+     * uint32 payload length | uint32 checksum of payload | payload
+     *
+     * payload: uint8 record type, uint64 notification id, and for additions
+     * the notification.
+     */
+    class NotificationSpool
+    {
+        public:
+        ///////
+
+        using IdT = uint64_t;
+
+        struct Parameters
+        {
+            static const std::size_t SegmentSize {8 << 20};
+            // segments pinned by old notifications before they are copied
+            static const std::size_t MaxSegments {4};
+        };
+
+        /**
+         * a notification read back from the spool
+         */
+        struct Entry
+        {
+            IdT id;
+            // seconds since the epoch
+            uint64_t createdAt;
+            uint64_t deviceHash;
+            Backend::PayloadT payload;
+            std::string token;
+            std::string appId;
+            std::string unregisterKey;
+        };
+
+        /**
+         * opens the spool at dirPath, creating the directory if needed
+         */
+        explicit NotificationSpool(const std::string& dirPath);
+
+        NotificationSpool(const NotificationSpool&) = delete;
+        NotificationSpool(NotificationSpool&&) = delete;
+
+        /**
+         * commits and unmaps all segments
+         */
+        ~NotificationSpool();
+
+        /**
+         * reads all segments and returns the live notifications ordered by
+         * id. Must be called once before anything is added.
+         */
+        std::vector<Entry> replay();
+
+        void add(const Backend::PushNotification& n);
+
+        void remove(IdT id);
+
+        /**
+         * makes everything appended so far durable
+         */
+        void commit();
+
+        private:
+        ////////
+
+        enum class RecordType : uint8_t
+        {
+            Add = 1,
+            Remove = 2
+        };
+
+        struct Segment
+        {
+            uint64_t seq;
+            int fd;
+            char* data;
+            // bytes holding records
+            std::size_t used;
+            // bytes msync'ed by commit()
+            std::size_t committed;
+            // notifications added to this segment and not removed since
+            std::size_t live;
+        };
+
+        struct Location
+        {
+            uint64_t seq;
+            // of the record header
+            std::size_t offset;
+        };
+
+        static const std::size_t HeaderSize {2 * sizeof(uint32_t)};
+
+        std::string makeSegmentPath(uint64_t seq) const;
+
+        /**
+         * creates and maps the segment following the current one
+         */
+        bool openSegment(uint64_t seq, bool create);
+
+        void closeSegment(Segment& segment, bool unlinkFile);
+
+        Segment& getSegment(uint64_t seq);
+
+        /**
+         * appends a record to the current segment, returns its location
+         */
+        bool append(const std::string& payload, Location& location);
+
+        /**
+         * moves live notifications out of old segments and retires segments
+         * nothing refers to anymore
+         */
+        void collectGarbage();
+
+        const std::string mDirPath;
+
+        std::mutex mMutex;
+        std::mutex mCommitMutex;
+        // oldest first, the last one is appended to
+        std::deque<Segment> mSegments;
+        // dead segments, still mapped and on disk until the next commit
+        std::vector<Segment> mRetired;
+        std::unordered_map<IdT, Location> mLive;
+    };
+}
+
+#endif
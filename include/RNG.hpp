@@ -40,7 +40,7 @@ namespace Oshiya
 
         template <typename IntT>
 		IntT getRandomNumber(IntT min = std::numeric_limits<IntT>::min(),
-                             IntT max = std::numeric_limits<IntT>::max()) const
+                             IntT max = std::numeric_limits<IntT>::max())
         {
             std::uniform_int_distribution<IntT> dist {min, max};
 
@@ -0,0 +1,89 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OSHIYA_RW_LOCK__H
+#define OSHIYA_RW_LOCK__H
+
+#include <pthread.h>
+
+namespace Oshiya
+{
+    /**
+     * reader-writer lock (C++11 has none), waiting writers keep new readers
+     * out so a steady stream of readers can't starve them. lock() and
+     * unlock() take it exclusively, which works with std::lock_guard.
+     */
+    class RWLock
+    {
+        public:
+        ///////
+
+        RWLock()
+        {
+            pthread_rwlockattr_t attr;
+            pthread_rwlockattr_init(&attr);
+            pthread_rwlockattr_setkind_np(&attr,
+                                          PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+            pthread_rwlock_init(&mLock, &attr);
+            pthread_rwlockattr_destroy(&attr);
+        }
+
+        RWLock(const RWLock&) = delete;
+        RWLock& operator=(const RWLock&) = delete;
+
+        ~RWLock() {pthread_rwlock_destroy(&mLock);}
+
+        void lock() {pthread_rwlock_wrlock(&mLock);}
+        void unlock() {pthread_rwlock_unlock(&mLock);}
+
+        void lockShared() {pthread_rwlock_rdlock(&mLock);}
+        void unlockShared() {pthread_rwlock_unlock(&mLock);}
+
+        private:
+        ////////
+
+        pthread_rwlock_t mLock;
+    };
+
+    /**
+     * holds a RWLock shared for its lifetime
+     */
+    class ReadLock
+    {
+        public:
+        ///////
+
+        explicit ReadLock(RWLock& lock) : mLock (lock)
+        {
+            mLock.lockShared();
+        }
+
+        ReadLock(const ReadLock&) = delete;
+        ReadLock& operator=(const ReadLock&) = delete;
+
+        ~ReadLock() {mLock.unlockShared();}
+
+        private:
+        ////////
+
+        RWLock& mLock;
+    };
+}
+
+#endif
@@ -20,10 +20,11 @@
 #define OSHIYA_REGISTRATION__H
 
 #include "Backend.hpp"
+#include "StringView.hpp"
 
 #include <ctime>
-#include <iostream>
-#include <limits>
+#include <cstdint>
+#include <cstring>
 
 namespace Oshiya
 {
@@ -42,15 +43,15 @@ namespace Oshiya
                      Backend::IdT backendId,
                      std::time_t timestamp = std::time(nullptr));
 
-        Jid getUser() const {return mUser;}
-        std::string getDeviceId() const {return mDeviceId;}
-        std::string getDeviceName() const {return mDeviceName;}
-        std::string getToken() const {return mToken;}
-        std::string getAppId() const {return mAppId;}
+        const Jid& getUser() const {return mUser;}
+        const std::string& getDeviceId() const {return mDeviceId;}
+        const std::string& getDeviceName() const {return mDeviceName;}
+        const std::string& getToken() const {return mToken;}
+        const std::string& getAppId() const {return mAppId;}
         Backend::IdT getBackendId() const {return mBackendId;}
         std::time_t getTimestamp() const {return mTimestamp;}
 
-        void setUser(const Jid& jid) {mUser = jid;}
+        void setUser(const Jid& jid) {mUser = Jid::intern(jid);}
         void setDeviceId(const std::string& deviceId) {mDeviceId = deviceId;}
         void setDeviceName(const std::string& deviceName) {mDeviceName = deviceName;}
         void setToken(const std::string& token) {mToken = token;}
@@ -70,56 +71,56 @@ namespace Oshiya
         std::time_t mTimestamp;
     };
 
-    namespace
+    namespace Util
     {
         /**
-         * serialization / deserialization functions
+         * binary serialization used by the registration journal, snapshots and
+         * the notification spool.
+         * Integers are stored in host byte order, strings as uint32 length
+         * followed by the bytes. The read functions advance pos and return
+         * false if the data ends too early.
          */
-        std::ostream& operator<<(std::ostream& os, const Registration& reg)
+        template <typename IntT>
+        void appendInt(std::string& out, IntT value)
         {
-            Jid user {reg.getUser()};
-       
-            os << user.getUser() << '\n'
-               << user.getServer() << '\n'
-               << user.getResource() << '\n'
-               << reg.getDeviceId() << '\n'
-               << reg.getDeviceName() << '\n'
-               << reg.getToken() << '\n'
-               << reg.getAppId() << '\n'
-               << reg.getBackendId() << '\n'
-               << reg.getTimestamp() << '\n';
-            
-            return os;
+            out.append(reinterpret_cast<const char*>(&value), sizeof value);
         }
 
-        std::istream& operator>>(std::istream& is, Registration& reg)
+        template <typename IntT>
+        bool readInt(const char*& pos, const char* end, IntT& value)
         {
-            std::string user, server, resource, deviceId, deviceName, token, appId;
-            Backend::IdT backendId;
-            std::time_t timestamp;
-      
-            std::getline(is, user);
-            std::getline(is, server);
-            std::getline(is, resource);
-            std::getline(is, deviceId);
-            std::getline(is, deviceName);
-            std::getline(is, token);
-            std::getline(is, appId);
-            is >> backendId;
-            is.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            is >> timestamp;
-            is.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-
-            reg.setUser({user, server, resource});
-            reg.setDeviceId(deviceId);
-            reg.setDeviceName(deviceName);
-            reg.setToken(token);
-            reg.setAppId(appId);
-            reg.setBackendId(backendId);
-            reg.setTimestamp(timestamp);
-        
-            return is;
+            if(static_cast<std::size_t>(end - pos) < sizeof value)
+            {
+                return false;
+            }
+
+            std::memcpy(&value, pos, sizeof value);
+            pos += sizeof value;
+
+            return true;
         }
+
+        void appendString(std::string& out, StringView str);
+
+        /**
+         * FNV-1a hash of data, guards records against torn writes
+         */
+        uint32_t checksum(const char* data, std::size_t length);
+
+        bool readString(const char*& pos, const char* end, std::string& str);
+
+        void appendRegistration(std::string& out, const Registration& reg);
+
+        void appendRegistration(std::string& out,
+                                const Jid& user,
+                                StringView deviceId,
+                                StringView deviceName,
+                                StringView token,
+                                StringView appId,
+                                Backend::IdT backendId,
+                                std::time_t timestamp);
+
+        bool readRegistration(const char*& pos, const char* end, Registration& reg);
     }
 }
 
@@ -0,0 +1,84 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OSHIYA_REGISTRATION_DUMP__H
+#define OSHIYA_REGISTRATION_DUMP__H
+
+#include "Registration.hpp"
+#include "RegistrationTable.hpp"
+
+#include <ctime>
+#include <iostream>
+#include <string>
+
+namespace Oshiya
+{
+    /**
+     * portable registration dump for moving registrations between app
+     * servers, one JSON object per line:
+     *
+     * {"node": "...", "jid": "user@host/resource", "device_id": "...",
+     *  "device_name": "...", "token": "...", "app_id": "...",
+     *  "backend": "gcm", "timestamp": 1450000000, "secret": "..."}
+     *
+     * Backends are given by type, an importing component derives its own
+     * backend ids. "device_name", "app_id", "timestamp" and "secret" (the
+     * node's pubsub#secret, Oshiya doesn't keep it) are optional.
+     */
+    namespace RegistrationDump
+    {
+        struct Entry
+        {
+            std::string node;
+            Jid user;
+            std::string deviceId;
+            std::string deviceName;
+            std::string token;
+            std::string appId;
+            Backend::Type backendType;
+            std::time_t timestamp;
+            std::string secret;
+        };
+
+        /**
+         * returns false for anything but a registration with node, jid,
+         * device id, token and a known backend type
+         */
+        bool parse(const std::string& line, Entry& entry);
+
+        /**
+         * the registration for the component host
+         */
+        Registration makeRegistration(const Entry& entry, const Jid& host);
+
+        /**
+         * writes the registrations of regs, returns the number written.
+         * Registrations of an unknown backend are skipped.
+         */
+        std::size_t write(std::ostream& out, const RegistrationTable& regs, const Jid& host);
+
+        /**
+         * the type of the backend id was made of for host, see
+         * Backend::makeBackendId()
+         */
+        Backend::Type findBackendType(Backend::IdT backendId, const Jid& host);
+    }
+}
+
+#endif
@@ -0,0 +1,161 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ *
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_REGISTRATION_JOURNAL__H
+#define OSHIYA_REGISTRATION_JOURNAL__H
+
+#include "Registration.hpp"
+#include "RegistrationTable.hpp"
+
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace Oshiya
+{
+    /**
+     * append-only log of registration changes. Records are buffered and
+     * written by a background thread which fsyncs once per group commit. Once
+     * enough records piled up the compaction callback is called on a thread
+     * of its own, it is expected to write a snapshot (see rotate()).
+     *
+     * record layout (host byte order):
+     * uint32 payload length | uint32 FNV-1a checksum of payload | payload
+     *
+     * payload: uint8 record type, node, and for additions the registration.
+     * Strings are stored as uint32 length followed by the bytes.
+     */
+    class RegistrationJournal
+    {
+        public:
+        ///////
+
+        struct Parameters
+        {
+            static const unsigned int GroupCommitInterval {10}; // 10 ms
+            static const std::size_t GroupCommitBytes {1 << 20};
+            static const std::size_t CompactionThreshold {100000}; // records
+        };
+
+        /**
+         * opens (or creates) the journal at path for appending. It must have
+         * been replayed before, see replay().
+         */
+        RegistrationJournal(const std::string& path,
+                            std::function<void()> compactionCb);
+
+        RegistrationJournal(const RegistrationJournal&) = delete;
+        RegistrationJournal(RegistrationJournal&&) = delete;
+
+        /**
+         * commits everything still buffered
+         */
+        ~RegistrationJournal();
+
+        void logAdd(const std::string& node, const Registration& reg);
+
+        void logDelete(const std::string& node);
+
+        /**
+         * commits the buffer and moves the journal aside (path + ".1"), new
+         * records go to a fresh journal. Must be called while no records are
+         * logged, i.e. with the lock guarding the registrations held, right
+         * after copying them for a snapshot. Once the snapshot is durable call
+         * removeRotated().
+         *
+         * Returns false and keeps appending to the journal if a rotated
+         * journal is left over from a failed snapshot. The snapshot still
+         * covers both then, replaying the kept records on top of it is
+         * harmless.
+         */
+        bool rotate();
+
+        void removeRotated();
+
+        /**
+         * applies the rotated journal and the journal at path to regs. A torn
+         * record at the end (e.g. after a crash) is cut off.
+         */
+        static void replay(const std::string& path, RegistrationTable& regs);
+
+        using SetCbT = std::function<void(const std::string& node, const Registration& reg)>;
+        using EraseCbT = std::function<void(const std::string& node)>;
+
+        /**
+         * the same for registrations kept elsewhere, set adds or replaces the
+         * registration under node
+         */
+        static void replay(const std::string& path, const SetCbT& set, const EraseCbT& erase);
+
+        /**
+         * deletes the journal at path and the rotated one, once a snapshot
+         * covers them. Not while a RegistrationJournal has them open.
+         */
+        static void remove(const std::string& path);
+
+        private:
+        ////////
+
+        enum class RecordType : uint8_t
+        {
+            Add = 1,
+            Delete = 2
+        };
+
+        static std::string rotatedPath(const std::string& path);
+
+        /**
+         * returns the number of bytes belonging to complete records
+         */
+        static std::size_t replayFile(const std::string& path,
+                                      const SetCbT& set,
+                                      const EraseCbT& erase);
+
+        void appendRecord(const std::string& payload);
+
+        void openFile();
+
+        void writeAndSync(const std::string& data);
+
+        void runFlusher();
+
+        void runCompaction();
+
+        const std::string mPath;
+        const std::function<void()> mCompactionCb;
+
+        // guards mBuffer and the counters
+        std::mutex mMutex;
+        // guards mFd, held while writing
+        std::mutex mFileMutex;
+        std::condition_variable mFlushCv;
+        std::condition_variable mCompactionCv;
+        std::string mBuffer;
+        std::size_t mRecordsSinceCompaction;
+        bool mCompacting;
+        bool mShutdown;
+        int mFd;
+        std::thread mFlusherThread;
+        std::thread mCompactionThread;
+    };
+}
+
+#endif
@@ -0,0 +1,84 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_REGISTRATION_SNAPSHOT__H
+#define OSHIYA_REGISTRATION_SNAPSHOT__H
+
+#include "Registration.hpp"
+#include "RegistrationTable.hpp"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace Oshiya
+{
+    /**
+     * binary registration snapshot:
+     *
+     * header: 8 byte magic "OSHIYARS" | uint32 version | uint32 reserved |
+     *         uint64 record count
+     * records: uint32 payload length | payload (node, registration)
+     *
+     * see Util::appendRegistration() for the payload encoding. Snapshots are
+     * memory-mapped for reading and decoded in parallel chunks.
+     */
+    namespace RegistrationSnapshot
+    {
+        enum class Result
+        {
+            Ok,
+            NotFound,
+            Legacy, // the file is in the old newline-delimited text format
+            Invalid
+        };
+
+        const uint32_t Version {1};
+
+        // below that many records per thread decoding isn't split up
+        const std::size_t MinRecordsPerThread {50000};
+
+        /**
+         * adds one table per decoding thread to tables, built in parallel.
+         * A node is in one of them only.
+         */
+        Result read(const std::string& path, std::vector<RegistrationTable>& tables);
+
+        /**
+         * the same merged into regs
+         */
+        Result read(const std::string& path, RegistrationTable& regs);
+
+        /**
+         * writes to path + ".tmp" and renames it to path once it is synced
+         */
+        bool write(const std::string& path, const RegistrationTable& regs);
+
+        /**
+         * one snapshot of the registrations of all shards
+         */
+        bool write(const std::string& path, const std::vector<RegistrationTable>& shards);
+
+        /**
+         * one-shot converter for the text format older Oshiya versions wrote
+         */
+        Result readLegacy(const std::string& path, RegistrationTable& regs);
+    }
+}
+
+#endif
@@ -0,0 +1,217 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OSHIYA_REGISTRATION_STORE__H
+#define OSHIYA_REGISTRATION_STORE__H
+
+#include "RegistrationTable.hpp"
+#include "RWLock.hpp"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace Oshiya
+{
+    /**
+     * the registrations, shared by the stanza workers and the backend
+     * workers. Nodes are spread over shards, each a RegistrationTable behind
+     * its own reader-writer lock, so notifications only ever take a read
+     * lock and a registration being added or removed holds up the nodes of
+     * one shard for as long as the change takes.
+     *
+     * The callbacks passed at construction see every change that goes
+     * through insert() and the erase functions, with the shard's write lock
+     * held. That keeps them in the order of the changes to the node.
+     */
+    class RegistrationStore
+    {
+        public:
+        ///////
+
+        using IdT = RegistrationTable::IdT;
+
+        using InsertedCbT =
+        std::function<void(const std::string& node, const Registration& reg)>;
+        using ErasedCbT =
+        std::function<void(const RegistrationTable& regs, IdT id)>;
+        using PredicateT =
+        std::function<bool(const RegistrationTable& regs, IdT id)>;
+
+        struct Parameters
+        {
+            static const std::size_t ShardCount {64};
+            // below that many registrations per thread load() isn't split up
+            static const std::size_t MinLoadPerThread {50000};
+        };
+
+        RegistrationStore(InsertedCbT insertedCb, ErasedCbT erasedCb);
+
+        RegistrationStore(const RegistrationStore&) = delete;
+        RegistrationStore& operator=(const RegistrationStore&) = delete;
+
+        /**
+         * adds the registrations of regs, without calling back
+         */
+        void load(const RegistrationTable& regs);
+
+        /**
+         * the same for several tables, e.g. those RegistrationSnapshot::read()
+         * decoded in parallel. The shards are filled by several threads, a
+         * node in more than one table gets its registration from the last.
+         */
+        void load(const std::vector<RegistrationTable>& tables);
+
+        /**
+         * adds or replaces a single registration and erases one, without
+         * calling back, for replaying the journal on top of load()
+         */
+        void load(const std::string& node, const Registration& reg);
+        void unload(StringView node);
+
+        /**
+         * returns false and leaves the store as is if node is taken
+         */
+        bool insert(const std::string& node, const Registration& reg);
+
+        /**
+         * erases the registration under node if pred(regs, id) holds for it
+         */
+        bool eraseIf(StringView node, const PredicateT& pred);
+
+        /**
+         * erases the registration last added for the device and returns its
+         * node, or an empty string if there is none
+         */
+        std::string eraseDevice(const Jid& user, StringView deviceId);
+
+        bool hasDevice(const Jid& user, StringView deviceId) const;
+
+        /**
+         * calls func(regs, id) for the registration under node with the
+         * shard read-locked, returns false if there is none. func must not
+         * hold on to the StringViews it gets.
+         */
+        template <typename FuncT>
+        bool read(StringView node, FuncT func) const
+        {
+            const Shard& shard = getShard(node);
+            ReadLock lk {shard.lock};
+
+            IdT id {shard.regs.find(node)};
+
+            if(id == RegistrationTable::InvalidId)
+            {
+                return false;
+            }
+
+            func(shard.regs, id);
+            return true;
+        }
+
+        /**
+         * calls func(regs, id) for every registration, one shard at a time
+         */
+        template <typename FuncT>
+        void forEach(FuncT func) const
+        {
+            for(std::size_t i {0}; i < Parameters::ShardCount; ++i)
+            {
+                const Shard& shard = mShards[i];
+                ReadLock lk {shard.lock};
+
+                shard.regs.forEach([&shard, &func](IdT id) {func(shard.regs, id);});
+            }
+        }
+
+        /**
+         * calls func(regs, id) for every registration of the user's bare
+         * JID, one shard at a time
+         */
+        template <typename FuncT>
+        void forEachOfUser(const Jid& user, FuncT func) const
+        {
+            for(std::size_t i {0}; i < Parameters::ShardCount; ++i)
+            {
+                const Shard& shard = mShards[i];
+                ReadLock lk {shard.lock};
+
+                shard.regs.forEachOfUser(
+                    user,
+                    [&shard, &func](IdT id) {func(shard.regs, id);}
+                );
+            }
+        }
+
+        /**
+         * calls func(regs) with a copy of each shard in turn, made under the
+         * shard's read lock. Unlike copy() the shards are taken one at a
+         * time, so at most one of them is held twice in memory.
+         */
+        template <typename FuncT>
+        void forEachShard(FuncT func) const
+        {
+            for(std::size_t i {0}; i < Parameters::ShardCount; ++i)
+            {
+                RegistrationTable regs;
+
+                {
+                    ReadLock lk {mShards[i].lock};
+                    regs = mShards[i].regs;
+                }
+
+                func(regs);
+            }
+        }
+
+        /**
+         * a consistent copy of all shards. whileLocked is called before the
+         * shards are unlocked again, with no change in between.
+         */
+        std::vector<RegistrationTable> copy(const std::function<void()>& whileLocked) const;
+
+        private:
+        ////////
+
+        struct Shard
+        {
+            mutable RWLock lock;
+            RegistrationTable regs;
+        };
+
+        /**
+         * releases the read locks of the first count shards
+         */
+        void unlockShared(std::size_t count) const;
+
+        void loadTables(const std::vector<const RegistrationTable*>& tables);
+
+        std::size_t getShardIndex(StringView node) const;
+
+        Shard& getShard(StringView node);
+        const Shard& getShard(StringView node) const;
+
+        const InsertedCbT mInsertedCb;
+        const ErasedCbT mErasedCb;
+        // RWLock can't be moved, hence no vector
+        std::unique_ptr<Shard[]> mShards;
+    };
+}
+
+#endif
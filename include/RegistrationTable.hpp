@@ -0,0 +1,315 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OSHIYA_REGISTRATION_TABLE__H
+#define OSHIYA_REGISTRATION_TABLE__H
+
+#include "Registration.hpp"
+#include "StringView.hpp"
+
+#include <vector>
+#include <limits>
+#include <cstdint>
+
+namespace Oshiya
+{
+    /**
+     * registrations by node, laid out for millions of them. Every registration
+     * is a fixed-size row with a dense id, its strings live in one arena and
+     * are referred to by offset and length. Nodes, devices (bare JID and
+     * device id) and users (bare JID) are looked up through flat open
+     * addressing indexes of row ids, a user's rows are linked to each other.
+     *
+     * Not thread-safe. The StringViews handed out are invalidated by the next
+     * modification.
+     */
+    class RegistrationTable
+    {
+        public:
+        ///////
+
+        using IdT = uint32_t;
+
+        static const IdT InvalidId {std::numeric_limits<IdT>::max()};
+
+        struct Parameters
+        {
+            // the string arena is compacted once more than half of it and at
+            // least that many bytes are unused
+            static const std::size_t MinCompactionGarbage {1 << 20};
+        };
+
+        RegistrationTable();
+
+        std::size_t size() const {return mSize;}
+        bool empty() const {return mSize == 0;}
+
+        void reserve(std::size_t count);
+
+        /**
+         * returns false and leaves the table as is if node is taken
+         */
+        bool insert(const std::string& node, const Registration& reg);
+
+        /**
+         * adds reg under node or replaces the registration there
+         */
+        void set(const std::string& node, const Registration& reg);
+
+        /**
+         * adds the registrations of other, replacing those under the same
+         * nodes
+         */
+        void merge(const RegistrationTable& other);
+
+        bool erase(StringView node);
+        void erase(IdT id);
+
+        IdT find(StringView node) const;
+
+        /**
+         * the registration last added for the device
+         */
+        IdT findDevice(const Jid& user, StringView deviceId) const;
+
+        /**
+         * calls func(id) for every registration of the user's bare JID, func
+         * must not modify the table
+         */
+        template <typename FuncT>
+        void forEachOfUser(const Jid& user, FuncT func) const
+        {
+            IdT id {findUserHead(user)};
+
+            while(id != InvalidId)
+            {
+                IdT next {mRows[id].nextOfUser};
+                func(id);
+                id = next;
+            }
+        }
+
+        /**
+         * calls func(id) for every registration, func must not modify the
+         * table
+         */
+        template <typename FuncT>
+        void forEach(FuncT func) const
+        {
+            for(IdT id {0}; id < mRows.size(); ++id)
+            {
+                if(mRows[id].used)
+                {
+                    func(id);
+                }
+            }
+        }
+
+        StringView getNode(IdT id) const {return makeView(mRows[id].node);}
+        const Jid& getUser(IdT id) const {return mRows[id].user;}
+        StringView getDeviceId(IdT id) const {return makeView(mRows[id].deviceId);}
+        StringView getDeviceName(IdT id) const {return makeView(mRows[id].deviceName);}
+        StringView getToken(IdT id) const {return makeView(mRows[id].token);}
+        StringView getAppId(IdT id) const {return makeView(mRows[id].appId);}
+        Backend::IdT getBackendId(IdT id) const {return mRows[id].backendId;}
+
+        std::time_t getTimestamp(IdT id) const
+        {
+            return static_cast<std::time_t>(mRows[id].timestamp);
+        }
+
+        Registration getRegistration(IdT id) const;
+
+        /**
+         * bytes allocated by the table, not counting the shared Jids
+         */
+        std::size_t getMemoryUsage() const;
+
+        /**
+         * identifies a device across registrations, see Backend::dispatch()
+         */
+        static std::size_t makeDeviceHash(const Jid& user, StringView deviceId);
+
+        private:
+        ////////
+
+        struct StringRef
+        {
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        struct Row
+        {
+            StringRef node;
+            StringRef deviceId;
+            StringRef deviceName;
+            StringRef token;
+            StringRef appId;
+            Jid user;
+            Backend::IdT backendId;
+            int64_t timestamp;
+            // the other rows of the user, InvalidId at the ends
+            IdT prevOfUser;
+            IdT nextOfUser;
+            bool used;
+        };
+
+        /**
+         * hash -> row id, linear probing. The index doesn't know the keys, so
+         * lookups pass the comparison and rehashing the hash function.
+         */
+        class Index
+        {
+            public:
+            ///////
+
+            template <typename EqualT>
+            IdT find(std::size_t hash, EqualT equal) const
+            {
+                if(mSlots.empty())
+                {
+                    return InvalidId;
+                }
+
+                uint32_t tag {makeTag(hash)};
+
+                for(std::size_t pos {mix(hash) & mMask}; ; pos = (pos + 1) & mMask)
+                {
+                    const Slot& slot = mSlots[pos];
+
+                    if(slot.id == Empty)
+                    {
+                        return InvalidId;
+                    }
+
+                    if(slot.id != Deleted and slot.tag == tag and equal(slot.id))
+                    {
+                        return slot.id;
+                    }
+                }
+            }
+
+            /**
+             * doesn't check whether the key is there already
+             */
+            template <typename HashOfT>
+            void insert(std::size_t hash, IdT id, HashOfT hashOf)
+            {
+                if((mUsed + 1) * 4 > mSlots.size() * 3)
+                {
+                    rehash(mLive + 1, hashOf);
+                }
+
+                place(hash, id);
+            }
+
+            /**
+             * removes the entry for id, if there is one
+             */
+            void erase(std::size_t hash, IdT id);
+
+            void reserve(std::size_t count);
+
+            std::size_t getMemoryUsage() const {return mSlots.capacity() * sizeof(Slot);}
+
+            private:
+            ////////
+
+            static const IdT Empty {InvalidId};
+            static const IdT Deleted {InvalidId - 1};
+
+            struct Slot
+            {
+                uint32_t tag;
+                IdT id;
+            };
+
+            static std::size_t mix(std::size_t hash);
+            static uint32_t makeTag(std::size_t hash);
+
+            /**
+             * room for count entries, tombstones are dropped
+             */
+            template <typename HashOfT>
+            void rehash(std::size_t count, HashOfT hashOf)
+            {
+                std::vector<Slot> slots;
+                slots.swap(mSlots);
+
+                mSlots.assign(makeCapacity(count), Slot {0, Empty});
+                mMask = mSlots.size() - 1;
+                mUsed = 0;
+                mLive = 0;
+
+                for(const Slot& slot : slots)
+                {
+                    if(slot.id != Empty and slot.id != Deleted)
+                    {
+                        place(hashOf(slot.id), slot.id);
+                    }
+                }
+            }
+
+            void place(std::size_t hash, IdT id);
+
+            static std::size_t makeCapacity(std::size_t count);
+
+            std::vector<Slot> mSlots;
+            std::size_t mMask {0};
+            // live entries and tombstones
+            std::size_t mUsed {0};
+            std::size_t mLive {0};
+        };
+
+        StringView makeView(StringRef ref) const
+        {
+            return StringView {mStrings.data() + ref.offset, ref.length};
+        }
+
+        StringRef addString(StringView str);
+
+        IdT findUserHead(const Jid& user) const;
+
+        std::size_t hashNode(IdT id) const;
+        std::size_t hashDevice(IdT id) const;
+        std::size_t hashUser(IdT id) const;
+
+        void linkUser(IdT id);
+        void unlinkUser(IdT id);
+
+        /**
+         * rewrites the arena with the strings of the rows in use only
+         */
+        void compactStrings();
+
+        std::vector<Row> mRows;
+        std::vector<IdT> mFreeIds;
+        std::vector<char> mStrings;
+        // bytes in mStrings no row refers to anymore
+        std::size_t mGarbage;
+        std::size_t mSize;
+        Index mNodes;
+        Index mDevices;
+        // the first row of each user
+        Index mUsers;
+    };
+}
+
+#endif
@@ -20,7 +20,9 @@
 #define OSHIYA_STANZA_DISPATCHER__H
 
 #include "InPacket.hpp"
+#include "Metrics.hpp"
 #include "XmppUtils.hpp"
+#include "XDataView.hpp"
 #include "SmartPointerUtil.hpp"
 
 extern "C"
@@ -35,9 +37,12 @@ extern "C"
 #include <memory>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
-// DEBUG:
-#include <iostream>
 
 namespace Oshiya
 {
@@ -46,6 +51,27 @@ namespace Oshiya
         public:
         ///////
 
+        /**
+         * with workerCount == 0 handlers are called synchronously on the
+         * calling (strophe) thread. Otherwise packets are handed to a pool of
+         * workerCount threads, sharded so that packets with the same shard
+         * key are handled in order: notifications by node, commands by the
+         * sender's bare JID and IQ results and errors by stanza id.
+         * component labels the dispatcher's metrics.
+         */
+        StanzaDispatcher(const std::string& component, unsigned int workerCount = 0);
+
+        StanzaDispatcher(const StanzaDispatcher&) = delete;
+        StanzaDispatcher(StanzaDispatcher&&) = delete;
+
+        ~StanzaDispatcher();
+
+        /**
+         * stops and joins the worker threads once they handled the packets
+         * queued so far
+         */
+        void stopWorkers();
+
         template <InPacket::Type T>
         void addStanzaHandler(typename InStanza<T>::FuncT handler)
         {
@@ -120,9 +146,28 @@ namespace Oshiya
             return {};
         }
 
-        void dispatch(const InPacket& packet);
+        struct Worker
+        {
+            Worker() : stop {false}
+            { }
+
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<std::unique_ptr<InPacket>> queue;
+            // guarded by mutex
+            bool stop;
+            std::thread thread;
+        };
+
+        void dispatch(std::unique_ptr<InPacket>&& packet,
+                      const std::string& shardKey);
+
+        void runWorker(Worker& worker);
 
         DispatchMap mDispatchMap;
+        // stanzas received, indexed by InPacket::Type
+        std::vector<Metrics::Counter*> mReceivedCounters;
+        std::vector<std::unique_ptr<Worker>> mWorkers;
     };
 }
 
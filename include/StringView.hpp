@@ -0,0 +1,109 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OSHIYA_STRING_VIEW__H
+#define OSHIYA_STRING_VIEW__H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <ostream>
+
+namespace Oshiya
+{
+    /**
+     * non-owning reference to a range of characters, a stand-in for C++17's
+     * std::string_view. Whatever it refers to must outlive it.
+     */
+    class StringView
+    {
+        public:
+        ///////
+
+        StringView() : mData {""}, mSize {0}
+        { }
+
+        /**
+         * str may be null, which makes an empty view
+         */
+        StringView(const char* str)
+            :
+                mData {str ? str : ""},
+                mSize {str ? std::strlen(str) : 0}
+        { }
+
+        StringView(const char* data, std::size_t size) : mData {data}, mSize {size}
+        { }
+
+        StringView(const std::string& str) : mData {str.data()}, mSize {str.size()}
+        { }
+
+        const char* data() const {return mData;}
+        std::size_t size() const {return mSize;}
+        bool empty() const {return mSize == 0;}
+
+        const char* begin() const {return mData;}
+        const char* end() const {return mData + mSize;}
+
+        std::string str() const {return std::string(mData, mSize);}
+
+        bool operator==(StringView other) const
+        {
+            return
+            mSize == other.mSize and std::memcmp(mData, other.mData, mSize) == 0;
+        }
+
+        bool operator!=(StringView other) const {return not (*this == other);}
+
+        private:
+        ////////
+
+        const char* mData;
+        std::size_t mSize;
+    };
+
+    inline std::ostream& operator<<(std::ostream& os, StringView str)
+    {
+        return os.write(str.data(), str.size());
+    }
+}
+
+namespace std
+{
+    // FNV-1a
+    template <>
+    struct hash<Oshiya::StringView>
+    {
+        std::size_t operator()(Oshiya::StringView str) const
+        {
+            uint64_t hash {14695981039346656037ull};
+
+            for(char c : str)
+            {
+                hash ^= static_cast<unsigned char>(c);
+                hash *= 1099511628211ull;
+            }
+
+            return static_cast<std::size_t>(hash);
+        }
+    };
+}
+
+#endif
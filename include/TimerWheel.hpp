@@ -0,0 +1,171 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ *
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSHIYA_TIMER_WHEEL__H
+#define OSHIYA_TIMER_WHEEL__H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <vector>
+
+namespace Oshiya
+{
+    /**
+     * hashed timer wheel holding list elements until they are due. An
+     * element is kept in the slot of its due tick modulo the number of slots,
+     * elements due more than one rotation ahead stay there for further
+     * rounds. Elements are spliced in and out, never copied. Not thread-safe.
+     */
+    template <typename T>
+    class TimerWheel
+    {
+        public:
+        ///////
+
+        using Clock = std::chrono::steady_clock;
+        using ListT = std::list<T>;
+        using DueTimeFnT = std::function<Clock::time_point(const T&)>;
+
+        /**
+         * dueTime tells when an element is due, it must not change while the
+         * element is in the wheel
+         */
+        TimerWheel(std::chrono::milliseconds tick,
+                   std::size_t slotCount,
+                   const DueTimeFnT& dueTime)
+            :
+                mTick {tick},
+                mSlots (slotCount),
+                mDueTime {dueTime},
+                mCurrentTick {toTick(Clock::now())},
+                mSize {0}
+        { }
+
+        /**
+         * moves the element at it from list from into the wheel
+         */
+        void schedule(ListT& from, typename ListT::iterator it)
+        {
+            uint64_t tick {std::max(getDueTick(*it), mCurrentTick + 1)};
+
+            ListT& slot = mSlots[tick % mSlots.size()];
+            slot.splice(slot.end(), from, it);
+
+            ++mSize;
+        }
+
+        /**
+         * moves all elements due at now to the end of out
+         */
+        void expire(Clock::time_point now, ListT& out)
+        {
+            uint64_t nowTick {toTick(now)};
+
+            if(mSize > 0)
+            {
+                // one rotation covers all slots
+                uint64_t lastTick
+                {std::min(nowTick, mCurrentTick + mSlots.size())};
+
+                for(uint64_t tick {mCurrentTick + 1}; tick <= lastTick; ++tick)
+                {
+                    ListT& slot = mSlots[tick % mSlots.size()];
+
+                    for(auto it = slot.begin(); it != slot.end();)
+                    {
+                        auto next = std::next(it);
+
+                        if(getDueTick(*it) <= nowTick)
+                        {
+                            out.splice(out.end(), slot, it);
+                            --mSize;
+                        }
+
+                        it = next;
+                    }
+                }
+            }
+
+            mCurrentTick = std::max(mCurrentTick, nowTick);
+        }
+
+        /**
+         * the time of the earliest tick an element is due at, or a rotation
+         * ahead if all elements wait for further rounds. Only meaningful if
+         * not empty().
+         */
+        Clock::time_point nextExpiry() const
+        {
+            for(uint64_t tick {mCurrentTick + 1};
+                tick <= mCurrentTick + mSlots.size();
+                ++tick)
+            {
+                for(const T& element : mSlots[tick % mSlots.size()])
+                {
+                    if(getDueTick(element) <= tick)
+                    {
+                        return fromTick(tick);
+                    }
+                }
+            }
+
+            return fromTick(mCurrentTick + mSlots.size());
+        }
+
+        bool empty() const {return mSize == 0;}
+
+        std::size_t size() const {return mSize;}
+
+        private:
+        ////////
+
+        uint64_t toTick(Clock::time_point time) const
+        {
+            return
+            std::chrono::duration_cast<std::chrono::milliseconds>
+            (time.time_since_epoch()).count() / mTick.count();
+        }
+
+        /**
+         * the first tick starting after element is due, so it never expires
+         * early
+         */
+        uint64_t getDueTick(const T& element) const
+        {
+            return toTick(mDueTime(element)) + 1;
+        }
+
+        Clock::time_point fromTick(uint64_t tick) const
+        {
+            return Clock::time_point {tick * mTick};
+        }
+
+        const std::chrono::milliseconds mTick;
+        std::vector<ListT> mSlots;
+        const DueTimeFnT mDueTime;
+        // all slots up to and including this tick have been expired
+        uint64_t mCurrentTick;
+        std::size_t mSize;
+    };
+}
+
+#endif
@@ -23,6 +23,9 @@
 #include "json/json.h"
 #include "curl_easy.h"
 
+#include <vector>
+#include <memory>
+
 namespace Oshiya
 {
     class UbuntuBackend : public Backend
@@ -38,7 +41,8 @@ namespace Oshiya
 
         UbuntuBackend(const Jid& host,
                       const std::string& appName,
-                      const std::string& certFile);
+                      const std::string& certFile,
+                      const Options& options);
 
         ~UbuntuBackend() override;
 
@@ -47,7 +51,8 @@ namespace Oshiya
         private:
         ////////
 
-        NotificationQueueT send(const NotificationQueueT& notifications) override;
+        NotificationQueueT send(const NotificationQueueT& notifications,
+                                std::size_t worker) override;
         
         static std::size_t bodyWriteCb(char* ptr,
                                        std::size_t size,
@@ -58,8 +63,8 @@ namespace Oshiya
                                 const std::string& token,
                                 const PayloadT& n);
 
-        Json::StyledWriter mWriter;
-        curl::curl_easy mCurl;
+        // one per worker
+        std::vector<std::unique_ptr<curl::curl_easy>> mCurls;
     };
 }
 
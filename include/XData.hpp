@@ -22,6 +22,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <utility>
 
 namespace Oshiya
 {
@@ -34,30 +35,30 @@ namespace Oshiya
         {
             Field() = default;
 
-            Field(const std::string& type,
-                  const std::string& var,
-                  const std::vector<std::string>& values);
+            Field(std::string type,
+                  std::string var,
+                  std::vector<std::string> values);
 
             bool isValid() const;
 
             std::string singleValue() const;
 
-            const std::string type;
-            const std::string var;
-            const std::vector<std::string> values;
+            std::string type;
+            std::string var;
+            std::vector<std::string> values;
         };
 
         struct Item
         {
             Item() = default;
 
-            Item(const std::vector<Field>& fields);
+            Item(std::vector<Field> fields);
 
             bool empty() const {return mFields.empty();}
 
-            std::vector<Field> getFields() const {return mFields;}
+            const std::vector<Field>& getFields() const {return mFields;}
 
-            void addField(const Field& field) {mFields.push_back(field);}
+            void addField(Field field) {mFields.push_back(std::move(field));}
 
             private:
             ////////
@@ -65,26 +66,29 @@ namespace Oshiya
             std::vector<Field> mFields;
         };
 
-        XData(const std::string& type = "");
+        XData(std::string type = "");
 
-        XData(const std::string& type, const std::vector<Field>& fields);
+        XData(std::string type, std::vector<Field> fields);
 
-        XData(const std::string& type, const std::vector<Item>& items);
+        XData(std::string type, std::vector<Item> items);
 
         bool empty() const {return mFields.empty() and mItems.empty();}
 
-        std::string getType() const {return mType;}
+        const std::string& getType() const {return mType;}
 
-        Field getField(const std::string& var,
-                       const std::string& type = "text-single") const;
+        /**
+         * an invalid Field if there's no field var of the given type
+         */
+        const Field& getField(const std::string& var,
+                              const std::string& type = "text-single") const;
 
-        std::vector<Field> getFields() const {return mFields;}
+        const std::vector<Field>& getFields() const {return mFields;}
 
-        std::vector<Item> getItems() const {return mItems;}
+        const std::vector<Item>& getItems() const {return mItems;}
 
-        void addField(const Field& field);
+        void addField(Field field);
 
-        void addItem(const Item& item);
+        void addItem(Item item);
         
         private:
         ////////
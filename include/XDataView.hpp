@@ -0,0 +1,159 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OSHIYA_XDATA_VIEW__H
+#define OSHIYA_XDATA_VIEW__H
+
+#include "StringView.hpp"
+
+extern "C"
+{
+    #include "strophe.h"
+}
+
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <string>
+
+namespace Oshiya
+{
+    /**
+     * read-only view of a XEP-0004 data form, iterating its fields right on
+     * the strophe stanza tree instead of copying them into an XData. The
+     * stanza must outlive the view and everything obtained from it.
+     */
+    class XDataView
+    {
+        public:
+        ///////
+
+        class Field
+        {
+            public:
+            ///////
+
+            explicit Field(xmpp_stanza_t* field) : mField {field}
+            { }
+
+            StringView getVar() const
+            {
+                return StringView {xmpp_stanza_get_attribute(mField, "var")};
+            }
+
+            StringView getType() const
+            {
+                return StringView {xmpp_stanza_get_type(mField)};
+            }
+
+            bool hasValue() const {return getFirstValue() != nullptr;}
+
+            /**
+             * appends the text of the first value to out, which strophe may
+             * keep in several chunks
+             */
+            void appendValue(std::string& out) const;
+
+            private:
+            ////////
+
+            xmpp_stanza_t* getFirstValue() const;
+
+            xmpp_stanza_t* mField;
+        };
+
+        /**
+         * visits the form's field elements, skipping anything else
+         */
+        class FieldIterator
+        {
+            public:
+            ///////
+
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Field;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Field*;
+            using reference = Field;
+
+            explicit FieldIterator(xmpp_stanza_t* child) : mChild {skip(child)}
+            { }
+
+            Field operator*() const {return Field {mChild};}
+
+            FieldIterator& operator++()
+            {
+                mChild = skip(xmpp_stanza_get_next(mChild));
+                return *this;
+            }
+
+            FieldIterator operator++(int)
+            {
+                FieldIterator ret {*this};
+                ++*this;
+                return ret;
+            }
+
+            bool operator==(const FieldIterator& other) const {return mChild == other.mChild;}
+            bool operator!=(const FieldIterator& other) const {return mChild != other.mChild;}
+
+            private:
+            ////////
+
+            /**
+             * the first field element from child on, or null
+             */
+            static xmpp_stanza_t* skip(xmpp_stanza_t* child);
+
+            xmpp_stanza_t* mChild;
+        };
+
+        /**
+         * form is the x element
+         */
+        explicit XDataView(xmpp_stanza_t* form) : mForm {form}
+        { }
+
+        StringView getType() const {return StringView {xmpp_stanza_get_type(mForm)};}
+
+        FieldIterator begin() const
+        {
+            return FieldIterator {xmpp_stanza_get_children(mForm)};
+        }
+
+        FieldIterator end() const {return FieldIterator {nullptr};}
+
+        private:
+        ////////
+
+        xmpp_stanza_t* mForm;
+    };
+
+    namespace Util
+    {
+        /**
+         * the first value of every text-single field (or field without type)
+         * by var. Fields without var or value are left out, of fields with
+         * the same var the first one counts.
+         */
+        std::map<std::string, std::string> makeValueMap(const XDataView& form);
+    }
+}
+
+#endif
@@ -34,10 +34,14 @@ namespace Oshiya
         XmlElement();
 
         XmlElement(xmpp_stanza_t* el);
-        //XmlElement(XmlElement&& other);
+
+        /**
+         * copying deep-copies the stanza tree, moving hands the reference over
+         */
+        XmlElement(XmlElement&& other) noexcept;
         XmlElement(const XmlElement& other);
 
-        //XmlElement& operator=(XmlElement&& other);
+        XmlElement& operator=(XmlElement&& other) noexcept;
         XmlElement& operator=(const XmlElement& other);
 
         ~XmlElement();
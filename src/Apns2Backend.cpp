@@ -0,0 +1,390 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ *
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Apns2Backend.hpp"
+#include "Logger.hpp"
+#include "Base64.hpp"
+#include "SmartPointerUtil.hpp"
+
+#include <openssl/pem.h>
+#include <openssl/ecdsa.h>
+#include <openssl/bn.h>
+
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+
+using namespace Oshiya;
+
+const unsigned int Apns2Backend::ApnsParameters::MaxPayloadSize;
+const unsigned int Apns2Backend::ApnsParameters::TokenRefreshInterval;
+
+Apns2Backend::Apns2Backend(const Jid& host,
+                           const std::string& appName,
+                           const Credentials& credentials,
+                           const Options& options)
+    :
+        Backend(Backend::Type::Apns,
+                host,
+                appName,
+                credentials.keyFile,
+                options),
+        mCredentials {credentials},
+        mUrlPrefix
+        {
+            (options.url.empty() ?
+             std::string {credentials.sandbox ?
+                          "https://api.sandbox.push.apple.com" :
+                          "https://api.push.apple.com"} :
+             options.url) + "/3/device/"
+        },
+        mSigningKey {nullptr}
+{
+    std::FILE* keyFile {std::fopen(credentials.keyFile.c_str(), "r")};
+
+    if(keyFile != nullptr)
+    {
+        mSigningKey = PEM_read_PrivateKey(keyFile, nullptr, nullptr, nullptr);
+        std::fclose(keyFile);
+    }
+
+    if(mSigningKey == nullptr)
+    {
+        LOG_ERROR(Backend, "could not read APNs signing key from "
+                           << credentials.keyFile);
+    }
+
+    for(std::size_t i {0}; i < options.workers; ++i)
+    {
+        // token-based authentication, no client certificate
+        mClients.push_back(
+            make_unique<HttpClient>(std::string {}, options.concurrentRequests)
+        );
+    }
+
+    startWorkers();
+}
+
+Apns2Backend::~Apns2Backend()
+{
+    stopWorkers();
+
+    EVP_PKEY_free(mSigningKey);
+}
+
+Backend::NotificationQueueT
+Apns2Backend::send(const NotificationQueueT& notifications, std::size_t worker)
+{
+    LOG_DEBUG(Backend, "Apns2Backend::send: notifications.size(): "
+                       << notifications.size());
+
+    NotificationQueueT retryQueue;
+
+    std::string providerToken {getProviderToken()};
+
+    if(providerToken.empty())
+    {
+        // nothing APNs would accept, retrying won't help either
+        LOG_ERROR(Backend, "no APNs provider token, dropping "
+                           << notifications.size() << " notifications");
+        return retryQueue;
+    }
+
+    std::string expiration
+    {std::to_string(std::time(nullptr) + Parameters::NotificationExpireTime)};
+
+    std::unique_ptr<curl_slist, void(*)(curl_slist*)>
+    headers {nullptr, curl_slist_free_all};
+
+    for(const std::string& header :
+        {
+            std::string {"Content-Type:application/json"},
+            "authorization:bearer " + providerToken,
+            "apns-topic:" + mCredentials.topic,
+            // content-available pushes must be sent with low priority
+            std::string {"apns-push-type:background"},
+            std::string {"apns-priority:5"},
+            "apns-expiration:" + expiration
+        })
+    {
+        headers.reset(curl_slist_append(headers.release(), header.c_str()));
+    }
+
+    std::vector<const PushNotification*> pushes;
+    std::vector<HttpClient::Request> requests;
+
+    for(const PushNotification& n : notifications)
+    {
+        std::string token {binaryToHex(Util::base64Decode(n.token))};
+
+        pushes.push_back(&n);
+        requests.emplace_back(mUrlPrefix + token,
+                              headers.get(),
+                              makePayload(n.payload),
+                              pushes.size() - 1);
+    }
+
+    mClients[worker]->perform(
+        requests,
+        [this, &pushes, &retryQueue](HttpClient::Request& request)
+        {completeRequest(request, *pushes[request.tag], retryQueue);}
+    );
+
+    return retryQueue;
+}
+
+void Apns2Backend::completeRequest(const HttpClient::Request& request,
+                                   const PushNotification& n,
+                                   NotificationQueueT& retryQueue)
+{
+    if(request.result != CURLE_OK)
+    {
+        // connection error
+        retryQueue.push_back(n);
+        return;
+    }
+
+    if(request.responseCode == 200)
+    {
+        // success
+        return;
+    }
+
+    Json::Value root;
+    Json::Reader reader;
+    std::string reason;
+
+    if(reader.parse(request.responseBody, root))
+    {
+        reason = root.get("reason", "").asString();
+    }
+
+    LOG_DEBUG(Backend, "APNs status " << request.responseCode << ", reason: "
+                       << reason);
+
+    if(request.responseCode == 410 or
+       reason == "BadDeviceToken" or
+       reason == "DeviceTokenNotForTopic")
+    {
+        // the device token is no longer valid
+        n.unregisterCb();
+    }
+
+    else if(reason == "ExpiredProviderToken" or reason == "InvalidProviderToken")
+    {
+        // sign a new token for the retry
+        {
+            std::lock_guard<std::mutex> lk {mProviderTokenMutex};
+            mProviderToken.clear();
+        }
+
+        retryQueue.push_back(n);
+    }
+
+    else if(request.responseCode == 429 or request.responseCode >= 500)
+    {
+        // recoverable error
+        retryQueue.push_back(n);
+        retryQueue.back().retryAfter = request.retryAfter;
+    }
+
+    else
+    {
+        // the request is at fault rather than the device, e.g. a wrong topic
+        LOG_ERROR(Backend, "APNs rejected notification: " << reason);
+    }
+}
+
+std::string Apns2Backend::getProviderToken()
+{
+    std::lock_guard<std::mutex> lk {mProviderTokenMutex};
+
+    std::chrono::steady_clock::time_point now {std::chrono::steady_clock::now()};
+
+    if(mProviderToken.empty() or
+       now - mProviderTokenTime >=
+       std::chrono::seconds(ApnsParameters::TokenRefreshInterval))
+    {
+        mProviderToken = makeProviderToken();
+        mProviderTokenTime = now;
+    }
+
+    return mProviderToken;
+}
+
+std::string Apns2Backend::makeProviderToken()
+{
+    if(mSigningKey == nullptr)
+    {
+        return {};
+    }
+
+    Json::Value header {Json::objectValue};
+    header["alg"] = "ES256";
+    header["kid"] = mCredentials.keyId;
+
+    Json::Value claims {Json::objectValue};
+    claims["iss"] = mCredentials.teamId;
+    claims["iat"] = static_cast<Json::Int64>(std::time(nullptr));
+
+    Json::FastWriter writer;
+    std::string headerStr {writer.write(header)};
+    std::string claimsStr {writer.write(claims)};
+
+    // FastWriter terminates its output with a newline
+    headerStr.pop_back();
+    claimsStr.pop_back();
+
+    std::string signingInput
+    {base64UrlEncode(headerStr) + '.' + base64UrlEncode(claimsStr)};
+
+    std::unique_ptr<EVP_MD_CTX, void(*)(EVP_MD_CTX*)>
+    mdCtx {EVP_MD_CTX_new(), EVP_MD_CTX_free};
+
+    std::size_t derLength {0};
+
+    if(not mdCtx or
+       EVP_DigestSignInit(mdCtx.get(), nullptr, EVP_sha256(), nullptr, mSigningKey)
+       != 1 or
+       EVP_DigestSignUpdate(mdCtx.get(), signingInput.data(), signingInput.size())
+       != 1 or
+       EVP_DigestSignFinal(mdCtx.get(), nullptr, &derLength) != 1)
+    {
+        LOG_ERROR(Backend, "could not sign APNs provider token");
+        return {};
+    }
+
+    std::vector<unsigned char> der (derLength);
+
+    if(EVP_DigestSignFinal(mdCtx.get(), der.data(), &derLength) != 1)
+    {
+        LOG_ERROR(Backend, "could not sign APNs provider token");
+        return {};
+    }
+
+    // JWS wants r and s concatenated, OpenSSL returns a DER sequence
+    const unsigned char* derPos {der.data()};
+
+    std::unique_ptr<ECDSA_SIG, void(*)(ECDSA_SIG*)>
+    sig {d2i_ECDSA_SIG(nullptr, &derPos, derLength), ECDSA_SIG_free};
+
+    if(not sig)
+    {
+        LOG_ERROR(Backend, "invalid APNs provider token signature");
+        return {};
+    }
+
+    const BIGNUM* r;
+    const BIGNUM* s;
+    ECDSA_SIG_get0(sig.get(), &r, &s);
+
+    std::string rawSig (64, '\0');
+    BN_bn2binpad(r, reinterpret_cast<unsigned char*>(&rawSig[0]), 32);
+    BN_bn2binpad(s, reinterpret_cast<unsigned char*>(&rawSig[32]), 32);
+
+    return signingInput + '.' + base64UrlEncode(rawSig);
+}
+
+std::string Apns2Backend::makePayload(const PayloadT& payload)
+{
+    Json::FastWriter writer;
+    Json::Value root {Json::objectValue};
+    Json::Value aps {Json::objectValue};
+
+    aps["content-available"] = 1;
+    root["aps"] = aps;
+
+    for(const PayloadT::value_type& p : payload)
+    {
+        // the publisher's fields must not replace the aps dictionary
+        if(p.first == "aps")
+        {
+            LOG_WARNING(Backend, "dropping summary field aps from APNs payload");
+            continue;
+        }
+
+        try
+        {
+            std::size_t convertedStrLength;
+            unsigned long converted {std::stoul(p.second, &convertedStrLength)};
+
+            if(convertedStrLength == p.second.size() and converted <= UINT32_MAX)
+            {
+                root[p.first] = static_cast<uint32_t>(converted);
+            }
+
+            else
+            {
+                root[p.first] = p.second;
+            }
+        }
+
+        catch(const std::logic_error&)
+        {
+            root[p.first] = p.second;
+        }
+    }
+
+    std::string ret {writer.write(root)};
+
+    // APNs rejects larger payloads, send a bare wakeup instead
+    if(ret.size() > ApnsParameters::MaxPayloadSize)
+    {
+        Json::Value wakeup {Json::objectValue};
+        wakeup["aps"] = aps;
+        ret = writer.write(wakeup);
+    }
+
+    return ret;
+}
+
+std::string Apns2Backend::base64UrlEncode(const std::string& input)
+{
+    std::string ret {Util::base64Encode(input)};
+
+    while(not ret.empty() and ret.back() == '=')
+    {
+        ret.pop_back();
+    }
+
+    for(char& c : ret)
+    {
+        if(c == '+') {c = '-';}
+        else if(c == '/') {c = '_';}
+    }
+
+    return ret;
+}
+
+std::string Apns2Backend::binaryToHex(const std::string& binaryToken)
+{
+    static const char digits[] {"0123456789abcdef"};
+
+    std::string ret;
+    ret.reserve(2 * binaryToken.size());
+
+    for(unsigned char c : binaryToken)
+    {
+        ret.push_back(digits[c >> 4]);
+        ret.push_back(digits[c & 0x0f]);
+    }
+
+    return ret;
+}
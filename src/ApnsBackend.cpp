@@ -17,11 +17,10 @@
  */
 
 #include "ApnsBackend.hpp"
+#include "Logger.hpp"
 #include "Base64.hpp"
 #include "SmartPointerUtil.hpp"
 
-// DEBUG:
-#include <iostream>
 #include <sstream>
 #include <algorithm>
 #include <iomanip>
@@ -31,48 +30,62 @@ using namespace Oshiya;
 
 ApnsBackend::ApnsBackend(const Jid& host,
                          const std::string& appName,
-                         const std::string& certFile)
+                         const std::string& certFile,
+                         const Options& options)
     :
         Backend(Backend::Type::Apns,
                 host,
                 appName,
-                certFile),
-        mConnected {false},
-        mApnCtx {nullptr},
-        mError {nullptr}
+                certFile,
+                options),
+        mConnections (options.workers)
 {
-    if(apn_init(&mApnCtx, certFile.c_str(), certFile.c_str(), nullptr, &mError)
-       == APN_ERROR)
+    for(Connection& connection : mConnections)
     {
-        // TODO: log error
-        std::cout << "ERROR: " << apn_error_message(mError) << std::endl;
-        apn_error_free(&mError);
-    }
+        apn_error_ref error {nullptr};
+
+        if(apn_init(&connection.apnCtx,
+                    certFile.c_str(),
+                    certFile.c_str(),
+                    nullptr,
+                    &error)
+           == APN_ERROR)
+        {
+            LOG_ERROR(Backend, "APNs: " << apn_error_message(error));
+            apn_error_free(&error);
+        }
 
-    apn_set_mode(mApnCtx, APN_MODE_SANDBOX, nullptr);
+        apn_set_mode(connection.apnCtx, APN_MODE_SANDBOX, nullptr);
 
-    connectApns();
+        connectApns(connection);
+    }
 
-    startWorker();
+    startWorkers();
 }
 
 ApnsBackend::~ApnsBackend()
 {
-    apn_close(mApnCtx);
-    apn_free(&mApnCtx);
+    stopWorkers();
+
+    for(Connection& connection : mConnections)
+    {
+        apn_close(connection.apnCtx);
+        apn_free(&connection.apnCtx);
+    }
 }
 
 Backend::NotificationQueueT
-ApnsBackend::send(const NotificationQueueT& notifications)
+ApnsBackend::send(const NotificationQueueT& notifications, std::size_t worker)
 {
-    // DEBUG:
-    std::cout << "ApnsBackend::send: notifications.size(): "
-              << notifications.size() << std::endl;
+    LOG_DEBUG(Backend, "ApnsBackend::send: notifications.size(): "
+                       << notifications.size());
+
+    Connection& connection = mConnections[worker];
 
-    if(not mConnected)
+    if(not connection.connected)
     {
-        disconnectApns();
-        connectApns();
+        disconnectApns(connection);
+        connectApns(connection);
     }
 
     NotificationQueueT retryQueue;
@@ -80,39 +93,36 @@ ApnsBackend::send(const NotificationQueueT& notifications)
     for(auto it = notifications.cbegin(); it != notifications.cend(); ++it)
     {
         const PushNotification& n {*it};
-        // DEBUG:
-        std::cout << "DEBUG: token = " << n.token << std::endl;
 
         std::string binaryToken {Util::base64Decode(n.token)};
         std::string token {binaryToHex(binaryToken)};
 
-        std::cout << "DEBUG: decoded token length = " << token.size() << std::endl;
-        std::cout << "DEBUG: decoded token = " << token << std::endl;
 
         auto payloadCtxPtr = makePayload(token, n.payload);
         apn_payload_ctx_ref payloadCtx {payloadCtxPtr.get()};
-        uint8_t result {apn_send(mApnCtx, payloadCtx, &mError)};
+        apn_error_ref error {nullptr};
+        uint8_t result {apn_send(connection.apnCtx, payloadCtx, &error)};
        
         // libcapn tells us about an invalid payload size, retry once with empty
         // payload in that case
         if(result == APN_ERROR and
-           apn_error_code(mError) == APN_ERR_INVALID_PAYLOAD_SIZE) 
+           apn_error_code(error) == APN_ERR_INVALID_PAYLOAD_SIZE) 
         {
+            apn_error_free(&error);
             payloadCtxPtr = makePayload(token, {});
             apn_payload_ctx_ref fixedPayload {payloadCtxPtr.get()};
-            result = apn_send(mApnCtx, fixedPayload, &mError);
+            result = apn_send(connection.apnCtx, fixedPayload, &error);
         }
 
         if(result == APN_ERROR)
         {
-            int32_t errorCondition {apn_error_code(mError)};
+            int32_t errorCondition {apn_error_code(error)};
 
             switch(errorCondition)
             {
                 case APN_ERR_SERVICE_SHUTDOWN:
                 {
-                    // DEBUG:
-                    std::cout << "DEBUG: service shutdown" << std::endl;
+                    LOG_DEBUG(Backend, "service shutdown");
                     // recoverable error
                     retryQueue.push_back(n);
                     break;
@@ -123,32 +133,29 @@ ApnsBackend::send(const NotificationQueueT& notifications)
                 case APN_ERR_SSL_READ_FAILED:
                 case APN_ERR_SELECT:
                 {
-                    // DEBUG:
-                    std::cout << "DEBUG: connection error" << std::endl;
+                    LOG_DEBUG(Backend, "connection error");
                     // connection error
-                    disconnectApns();
-                    connectApns();
+                    disconnectApns(connection);
+                    connectApns(connection);
                     retryQueue.insert(retryQueue.end(), it, notifications.cend());
                     break;
                 }
 
                 default:
                 {
-                    // DEBUG:
-                    std::cout << "DEBUG: non-recoverable error" << std::endl;
+                    LOG_DEBUG(Backend, "non-recoverable error");
                     // non-recoverable error
                     n.unregisterCb();
                     break;
                 }
             }
 
-            apn_error_free(&mError);
+            apn_error_free(&error);
         }
 
         else
         {
-            // DEBUG:
-            std::cout << "DEBUG: success!" << std::endl;
+            LOG_DEBUG(Backend, "success!");
             // success
         }
     }
@@ -156,33 +163,33 @@ ApnsBackend::send(const NotificationQueueT& notifications)
     return retryQueue;
 }
 
-void ApnsBackend::connectApns()
+void ApnsBackend::connectApns(Connection& connection)
 {
-    // DEBUG:
-    std::cout << "DEBUG: connecting to APNS" << std::endl;
-    if(apn_connect(mApnCtx, &mError) == APN_ERROR)
+    LOG_DEBUG(Backend, "connecting to APNS");
+
+    apn_error_ref error {nullptr};
+
+    if(apn_connect(connection.apnCtx, &error) == APN_ERROR)
     {
-        std::cout << "ERROR: " << apn_error_message(mError) << std::endl;
-        apn_error_free(&mError);
+        LOG_ERROR(Backend, "APNs: " << apn_error_message(error));
+        apn_error_free(&error);
 
-        mConnected = false;
+        connection.connected = false;
     }
 
     else
     {
-        mConnected = true;
+        connection.connected = true;
     }
 
-    // DEBUG:
-    std::cout << "returning from connectApns" << std::endl;
+    LOG_DEBUG(Backend, "returning from connectApns");
 }
 
-void ApnsBackend::disconnectApns()
+void ApnsBackend::disconnectApns(Connection& connection)
 {
-    // DEBUG:
-    std::cout << "DEBUG: disconnecting APNS" << std::endl;
-    apn_close(mApnCtx);
-    mConnected = false;
+    LOG_DEBUG(Backend, "disconnecting APNS");
+    apn_close(connection.apnCtx);
+    connection.connected = false;
 }
 
 std::unique_ptr<__apn_payload, ApnsBackend::PayloadDeleterT>
@@ -190,9 +197,9 @@ ApnsBackend::makePayload(const std::string& token, const PayloadT& payload)
 {
     apn_payload_ctx_ref payloadCtx = nullptr;
     
-    apn_payload_init(&payloadCtx, &mError);
+    apn_payload_init(&payloadCtx, nullptr);
 
-    apn_payload_add_token(payloadCtx, token.c_str(), &mError);
+    apn_payload_add_token(payloadCtx, token.c_str(), nullptr);
 
     apn_payload_set_content_available(payloadCtx, 1, nullptr);
 
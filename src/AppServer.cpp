@@ -17,25 +17,184 @@
  */
 
 #include <AppServer.hpp>
+#include "Logger.hpp"
+#include "RegistrationDump.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
 
-// DEBUG:
-#include <iostream>
 
 using namespace Oshiya;
 
+namespace
+{
+    bool writeAll(int fd, const std::string& data)
+    {
+        std::size_t written {0};
+
+        while(written < data.size())
+        {
+            ssize_t result {write(fd, data.data() + written, data.size() - written)};
+
+            if(result == -1)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+
+                return false;
+            }
+
+            written += result;
+        }
+
+        return true;
+    }
+}
+
+const unsigned int AppServer::Parameters::DefaultMaxProvisioning;
+const unsigned int AppServer::Parameters::DefaultMaxQueuedRegs;
+const unsigned int AppServer::Parameters::DefaultIqTimeout;
+const unsigned int AppServer::Parameters::DefaultIqRetries;
+const unsigned int AppServer::Parameters::DeadlineTick;
+const std::size_t AppServer::Parameters::DeadlineSlots;
+const std::size_t AppServer::Parameters::JobProgressInterval;
+
 AppServer::AppServer(const Config& config)
     :
         Component {config},
-        mBackends {makeBackends()},
-        mRegs {readRegs()}
+        mRegs
+        {
+            [this](const NodeIdT& node, const Registration& reg)
+            {registrationInserted(node, reg);},
+            [this](const RegistrationTable& regs, RegistrationTable::IdT id)
+            {registrationErased(regs, id);}
+        },
+        mProvisioning {makeProvisioningOptions()},
+        mAdmins {getConfig().value<std::vector<std::string>>("admins", {})},
+        mTransferDir
+        {
+            getConfig().value("transfer_dir",
+                              getConfig().value("storage_dir", std::string {STORAGE_DIR}))
+        },
+        mProvisioningCount {0},
+        mDeadlines
+        {
+            std::chrono::milliseconds(Parameters::DeadlineTick),
+            Parameters::DeadlineSlots,
+            [](const ActionDeadline& deadline) {return deadline.dueTime;}
+        },
+        mTimeoutCounter
+        {
+            &Metrics::getRegistry().getCounter(
+                "oshiya_pubsub_timeouts_total",
+                "Pubsub requests provisioning a registration that got no reply in time.",
+                {{"component", getJid().full()}}
+            )
+        },
+        mStopDeadlines {false}
 {
+    mRegs.load(readRegs(getStoragePath()));
+
+    RegistrationJournal::replay(
+        getJournalPath(),
+        [this](const std::string& node, const Registration& reg) {mRegs.load(node, reg);},
+        [this](const std::string& node) {mRegs.unload(node);}
+    );
+
+    mRegs.forEach(
+        [this](const RegistrationTable& regs, RegistrationTable::IdT id)
+        {++mRegCounts[regs.getBackendId(id)];}
+    );
+
+    mJournal =
+    make_unique<RegistrationJournal>(getJournalPath(), [this]() {compactRegs();});
+
+    // spooled notifications may unregister devices as soon as the backends
+    // are up, so the registrations have to be in place
+    mBackends = makeBackends();
+
+    Metrics::getRegistry().addGauge(
+        "oshiya_registrations_provisioning",
+        "Registrations being set up on the pubsub service.",
+        {{"component", getJid().full()}},
+        [this]()
+        {
+            std::lock_guard<std::mutex> lk {mPendingMutex};
+            return mProvisioningCount;
+        },
+        this
+    );
+
+    Metrics::getRegistry().addGauge(
+        "oshiya_registrations_queued",
+        "Registrations waiting to be set up on the pubsub service.",
+        {{"component", getJid().full()}},
+        [this]()
+        {
+            std::lock_guard<std::mutex> lk {mPendingMutex};
+            return mQueuedNodes.size();
+        },
+        this
+    );
+
+    mDeadlinesThread = std::thread {&AppServer::runDeadlines, this};
+
+    for(const auto& b : mBackends)
+    {
+        Backend::IdT backendId {b.first};
+
+        Metrics::getRegistry().addGauge(
+            "oshiya_registrations",
+            "Registered devices, by backend.",
+            {{"component", getJid().full()},
+             {"backend", Backend::getTypeStr(b.second->type)}},
+            [this, backendId]()
+            {
+                std::lock_guard<std::mutex> lk {mRegCountsMutex};
+
+                auto result = mRegCounts.find(backendId);
+                return result == mRegCounts.end() ? 0 : result->second;
+            },
+            this
+        );
+    }
+
     connect();
 }
 
 AppServer::~AppServer()
 {
+    Metrics::getRegistry().removeGauges(this);
+
+    {
+        // stops a running import as well
+        std::lock_guard<std::mutex> lk {mPendingMutex};
+        mStopDeadlines = true;
+    }
+
+    mDeadlinesCv.notify_one();
+    mImportCv.notify_one();
+    mDeadlinesThread.join();
+
+    if(mJobThread.joinable())
+    {
+        mJobThread.join();
+    }
+
     shutdown();
-    writeRegs();
+
+    // backend workers may still unregister devices
+    mBackends.clear();
+
+    // commits the journal, no snapshot needed
+    mJournal.reset();
 }
 
 void AppServer::commandReceived(const Jid& from,
@@ -54,29 +213,25 @@ void AppServer::commandReceived(const Jid& from,
     {
         XData xdata {"result"};
 
-        {
-            std::lock_guard<std::mutex> lk {mRegsMutex};
-
-            for(const auto& p : mRegs)
+        mRegs.forEachOfUser(
+            from,
+            [&xdata](const RegistrationTable& regs, RegistrationTable::IdT regId)
             {
                 XData::Item item;
 
-                if(p.second.getUser().bare() == from.bare())
-                {
-                    std::string deviceName {p.second.getDeviceName()};
-
-                    if(not deviceName.empty())
-                    {
-                        item.addField({"", "device-name", {deviceName}});
-                    }
+                StringView deviceName {regs.getDeviceName(regId)};
 
-                    item.addField({"", "node", {p.first}});
+                if(not deviceName.empty())
+                {
+                    item.addField({"", "device-name", {deviceName.str()}});
                 }
 
-                xdata.addItem(item);
+                item.addField({"", "node", {regs.getNode(regId).str()}});
+
+                xdata.addItem(std::move(item));
             }
-        }
-        
+        );
+
         sendCommandCompleted(from, id, node, xdata);
     }
 
@@ -85,6 +240,13 @@ void AppServer::commandReceived(const Jid& from,
         deleteRegistrations(from, id, payload);
     }
 
+    else if(node == "import-push-registrations" or
+            node == "export-push-registrations" or
+            node == "push-registrations-job")
+    {
+        adminCommandReceived(from, id, node, payload);
+    }
+
     else
     {
         addRegistration(from, id, node, payload);
@@ -94,83 +256,29 @@ void AppServer::commandReceived(const Jid& from,
 void AppServer::iqResultReceived(const Jid& from,
                                  const std::string& id)
 {
-    using Action = typename PendingReg::Action;
+    std::lock_guard<std::mutex> pendingLk {mPendingMutex};
 
     auto result = mPendingActions.find(id);
 
-    if(result != mPendingActions.end())
+    if(result == mPendingActions.end())
     {
-        Action action {result->second.first};
-        NodeIdT& node = result->second.second;
-
-        auto pendingIt = mPendingRegs.find(node);
-
-        /**
-         * pending registration might alredy be deleted because of a previous
-         * stanza error
-         */
-        if(pendingIt != mPendingRegs.end())
-        {
-            PendingReg& pending = pendingIt->second;
-
-            int completedActions {pending.completeAction(action)};
-
-            if(completedActions == Action::CreateNode)
-            {
-                NodeIdT setAffiliationId {makeRandomString()};
-                NodeIdT subscribeId {makeRandomString()};
-
-                mPendingActions.insert(
-                    {setAffiliationId, {Action::SetAffiliation, node}}
-                );
-                mPendingActions.insert(
-                    {subscribeId, {Action::Subscribe, node}}
-                );
-
-                setPubsubAffiliation(
-                    setAffiliationId,
-                    node,
-                    Jid::removeResource(pending.getRegistration().getUser()),
-                    "publish-only"
-                );
-
-                pubsubSubscribe(subscribeId, node);
-            }
+        // answered after its deadline or not ours
+        return;
+    }
 
-            else if(completedActions ==
-               (Action::CreateNode | Action::SetAffiliation | Action::Subscribe))
-            {
-                XData xdata
-                {
-                    "result",
-                    {
-                        {"", "jid", {getPubsubJid().full()}},
-                        {"", "node", {node}},
-                        {"", "secret", {pending.getSecret()}}
-                    }
-                };
-                
-                std::string command
-                {
-                    "register-push-" +
-                    Backend::getTypeStr(getRegType(pending.getRegistration()))
-                };
-
-                sendCommandCompleted(pending.getRegistration().getUser(),
-                                     pending.getRegisterId(),
-                                     command,
-                                     xdata);
-                
-                {
-                    std::lock_guard<std::mutex> lk {mRegsMutex};
-                    mRegs.emplace(node, pending.getRegistration());
-                }
+    PendingAction pendingAction {std::move(result->second)};
+    mPendingActions.erase(result);
 
-                mPendingRegs.erase(pendingIt);
-            }
-        }
+    auto pendingIt = mPendingRegs.find(pendingAction.node);
 
-        mPendingActions.erase(result);
+    /**
+     * pending registration might alredy be deleted because of a previous
+     * stanza error
+     */
+    if(pendingIt != mPendingRegs.end())
+    {
+        actionCompleted(pendingIt, pendingAction.action);
+        startQueuedRegs();
     }
 }
 
@@ -181,134 +289,120 @@ void AppServer::iqErrorReceived(const Jid& from,
 {
     using Action = typename PendingReg::Action;
 
+    std::lock_guard<std::mutex> pendingLk {mPendingMutex};
+
     auto result = mPendingActions.find(id);
 
-    if(result != mPendingActions.end())
+    if(result == mPendingActions.end())
     {
-        Action action {result->second.first};
-        NodeIdT& node = result->second.second;
-
-        auto pendingIt = mPendingRegs.find(node);
-
-        /**
-         * pending registration might alredy be deleted because of a previous
-         * stanza error
-         */
-        if(pendingIt != mPendingRegs.end())
-        {
-            const PendingReg& pending = pendingIt->second;
-
-            std::string command
-            {
-                "register-push-" +
-                Backend::getTypeStr(getRegType(pending.getRegistration()))
-            };
-
-            if(errorType == "wait")
-            {
-                sendCommandError(pending.getRegistration().getUser(),
-                                 pending.getRegisterId(),
-                                 command,
-                                 "execute",
-                                 "wait",
-                                 "resource-contraint");
-            }
-
-            else
-            {
-                sendCommandError(pending.getRegistration().getUser(),
-                                 pending.getRegisterId(),
-                                 command,
-                                 "execute",
-                                 "cancel",
-                                 "internal-server-error");
-            }
+        return;
+    }
 
-            switch(action)
-            {
-                case Action::CreateNode:
-                {
-                    // TODO:
-                    // log WARNING
-                    std::cout << "WARNING: Could not create node" << std::endl;
+    PendingAction pendingAction {std::move(result->second)};
+    mPendingActions.erase(result);
 
-                    mPendingRegs.erase(pendingIt);
-                    break;
-                }
+    auto pendingIt = mPendingRegs.find(pendingAction.node);
 
-                case Action::SetAffiliation:
-                {
-                    // TODO:
-                    // log WARNING
-                    std::cout << "WARNING: Could not set affiliation" << std::endl;
+    /**
+     * pending registration might alredy be deleted because of a previous
+     * stanza error
+     */
+    if(pendingIt == mPendingRegs.end())
+    {
+        return;
+    }
 
-                    deletePubsubNode(makeRandomString(), node);
-                    mPendingRegs.erase(pendingIt);
-                    break;
-                }
+    // the request that timed out did create the node after all, or an
+    // imported registration's node exists already
+    if(pendingAction.action == Action::CreateNode and
+       (pendingAction.attempt > 0 or pendingIt->second.isImported()) and
+       std::find(errors.begin(), errors.end(), "conflict") != errors.end())
+    {
+        actionCompleted(pendingIt, pendingAction.action);
+        startQueuedRegs();
+        return;
+    }
 
-                case Action::Subscribe:
-                {
-                    // TODO:
-                    // log WARNING
-                    std::cout << "WARNING: Could not subscribe to node" << std::endl;
+    switch(pendingAction.action)
+    {
+        case Action::CreateNode:
+        {
+            LOG_WARNING(AppServer, "Could not create node");
+            break;
+        }
 
-                    deletePubsubNode(makeRandomString(), node);
-                    mPendingRegs.erase(pendingIt);
-                    break;
-                }
-            }
+        case Action::SetAffiliation:
+        {
+            LOG_WARNING(AppServer, "Could not set affiliation");
+            break;
         }
 
+        case Action::Subscribe:
+        {
+            LOG_WARNING(AppServer, "Could not subscribe to node");
+            break;
+        }
     }
+
+    // a node we failed to create isn't ours to delete
+    failPendingReg(pendingIt,
+                   errorType == "wait" ? "wait" : "cancel",
+                   errorType == "wait" ? "resource-constraint" : "internal-server-error",
+                   pendingAction.action != Action::CreateNode);
+
+    startQueuedRegs();
 }
 
 void AppServer::pushNotificationReceived(const Jid& from,
                                          const std::string& node,
-                                         const XData& payload)
+                                         const Backend::PayloadT& payload)
 {
-    std::cout << "pubsub item received!" << std::endl;
+    LOG_DEBUG(AppServer, "pubsub item received!");
     
     if(from != getPubsubJid())
     {
-        // TODO: log warning
-        std::cout << "WARNING received push notification from unknown pubsub service"
-                  << std::endl;
+        LOG_WARNING(AppServer, "received push notification from unknown pubsub service");
 
         return;
     }
 
-    auto result = mRegs.find(node);
+    std::size_t deviceHash;
+    std::string token;
+    std::string appId;
+    Backend::IdT backendId;
+    std::time_t timestamp;
 
-    if(result == mRegs.end())
+    // the table may move its strings on any modification, so what's needed
+    // is copied out under the read lock
+    bool found
     {
-        // TODO: log warning
-        std::cout << "WARNING received push notifications on unknown node" << std::endl;
-
-        return;
-    }
-
-    const Registration& reg = result->second;
-    std::time_t timestamp {reg.getTimestamp()};
-
-    Backend::PayloadT backendPayload;
+        mRegs.read(
+            node,
+            [&](const RegistrationTable& regs, RegistrationTable::IdT id)
+            {
+                deviceHash = RegistrationTable::makeDeviceHash(regs.getUser(id),
+                                                               regs.getDeviceId(id));
+                token = regs.getToken(id).str();
+                appId = regs.getAppId(id).str();
+                backendId = regs.getBackendId(id);
+                timestamp = regs.getTimestamp(id);
+            }
+        )
+    };
 
-    for(const auto& f : payload.getFields())
+    if(not found)
     {
-        if(f.isValid() and (f.type.empty() or f.type == "text-single"))
-        {
-            backendPayload.insert({f.var, f.values.front()});
-        }
-    }
+        LOG_WARNING(AppServer, "received push notifications on unknown node");
 
-    auto unregisterCb = [this, node, timestamp]() {deleteRegCb(node, timestamp);};
+        return;
+    }
 
-    mBackends.at(reg.getBackendId())->dispatch(
-        makeDeviceHash(reg.getUser(), reg.getDeviceId()),
-        backendPayload,
-        reg.getToken(),
-        reg.getAppId(),
-        unregisterCb
+    mBackends.at(backendId)->dispatch(
+        deviceHash,
+        payload,
+        std::move(token),
+        std::move(appId),
+        makeUnregisterKey(node, timestamp)
     );
 }
 
@@ -317,8 +411,6 @@ void AppServer::addRegistration(const Jid& user,
                                 const std::string& node,
                                 const XData& payload)
 {
-    using Action = typename PendingReg::Action;
-
     std::string deviceId {payload.getField("device-id").singleValue()};
     std::string deviceName {payload.getField("device-name").singleValue()};
     std::string token {payload.getField("token").singleValue()};
@@ -326,7 +418,7 @@ void AppServer::addRegistration(const Jid& user,
 
     if(deviceId.empty())
     {
-        deviceId = user.getResource();
+        deviceId = user.getResource().str();
     }
 
     bool payloadOk;
@@ -407,69 +499,64 @@ void AppServer::addRegistration(const Jid& user,
         std::time(nullptr)
     };
 
-    // DEBUG:
-    std::cout << "DEBUG: adding registration:" << std::endl
-              << "user: " << reg.getUser().full() << std::endl
-              << "deviceId: " << reg.getDeviceId() << std::endl
-              << "deviceName: " << reg.getDeviceName() << std::endl
-              << "token: " << reg.getToken() << std::endl
-              << "appId: " << reg.getAppId() << std::endl
-              << "backendId: " << reg.getBackendId() << std::endl
-              << "timestmap: " << reg.getTimestamp() << std::endl;
-
-    auto regPred =
-    [&user, &deviceId](const std::pair<NodeIdT, Registration>& p)
-    {
-        return 
-        p.second.getUser().bare() == user.bare() and
-        p.second.getDeviceId() == deviceId;
-    };
+    LOG_DEBUG(AppServer, "adding registration for " << reg.getUser().full()
+                         << ", deviceId: " << reg.getDeviceId()
+                         << ", deviceName: " << reg.getDeviceName()
+                         << ", appId: " << reg.getAppId()
+                         << ", backendId: " << reg.getBackendId()
+                         << ", timestamp: " << reg.getTimestamp());
 
+    std::lock_guard<std::mutex> pendingLk {mPendingMutex};
+
+    // bounds the registrations kept in memory while e.g. every installation
+    // of an app registers again after an update. Checked first, a rejected
+    // client keeps the registration it has.
+    if(mProvisioningCount >= mProvisioning.maxProvisioning and
+       mQueuedNodes.size() >= mProvisioning.maxQueuedRegs)
     {
-        std::lock_guard<std::mutex> lk {mRegsMutex};
+        LOG_WARNING(AppServer, "too many pending registrations, rejecting one");
+
+        sendCommandError(user,
+                         stanzaId,
+                         node,
+                         "execute",
+                         "wait",
+                         "resource-constraint");
+        return;
+    }
 
-        auto regResult = std::find_if(mRegs.begin(), mRegs.end(), regPred);
+    {
+        std::string oldNode {mRegs.eraseDevice(user, deviceId)};
 
-        if(regResult != mRegs.end())
+        if(not oldNode.empty())
         {
-            deletePubsubNode(makeRandomString(), regResult->first);
-            mRegs.erase(regResult);
+            deletePubsubNode(makeRandomString(), oldNode);
         }
     }
 
-    auto pendingPred =
-    [&user, &deviceId](const std::pair<StanzaIdT, PendingReg>& p)
-    {
-        return
-        p.second.getRegistration().getUser().bare() == user.bare() and
-        p.second.getRegistration().getDeviceId() == deviceId;
-    };
-
-    auto pendingResult =
-    std::find_if(mPendingRegs.begin(), mPendingRegs.end(), pendingPred);
+    auto pendingResult = findPendingReg(user, deviceId);
 
     if(pendingResult != mPendingRegs.end())
     {
-        deletePubsubNode(makeRandomString(), pendingResult->first);
-        mPendingRegs.erase(pendingResult); 
-    }
-
-    std::string newNode {makeRandomString()};
-    std::string createNodeId {makeRandomString()};
+        if(pendingResult->second.isImported())
+        {
+            ++mJob.stats.failed;
+        }
 
-    XData nodeConfig
-    {
-        "submit",
+        else if(pendingResult->second.isStarted())
         {
-            {"hidden", "FORM_TYPE", {"http://jabber.org/protocol/pubsub#node_config"}},
-            {"", "pubsub#secret", {secret}}
+            deletePubsubNode(makeRandomString(), pendingResult->first);
         }
-    };
 
-    mPendingRegs.insert({newNode, PendingReg {secret, stanzaId, reg}});
-    mPendingActions.insert({createNodeId, {Action::CreateNode, newNode}});
+        erasePendingReg(pendingResult); 
+    }
+
+    std::string newNode {makeRandomString()};
+
+    insertPendingReg(newNode, PendingReg {secret, stanzaId, reg});
+    mQueuedNodes.push_back(newNode);
 
-    createPubsubNode(createNodeId, newNode, nodeConfig);
+    startQueuedRegs();
 }
 
 void AppServer::deleteRegistrations(const Jid& user,
@@ -493,8 +580,8 @@ void AppServer::deleteRegistrations(const Jid& user,
             {
                 deleteRegistration(
                     *it,
-                    [&user](const Registration& r)
-                    {return r.getUser().bare() == user.bare();}
+                    [&user](const RegistrationTable& regs, RegistrationTable::IdT id)
+                    {return regs.getUser(id).equalsBare(user);}
                 )
             };
             
@@ -516,7 +603,7 @@ void AppServer::deleteRegistrations(const Jid& user,
 
         if(deviceId.empty())
         {
-            deviceId = user.getResource();
+            deviceId = user.getResource().str();
         }
 
         if(deviceId.empty())
@@ -530,49 +617,31 @@ void AppServer::deleteRegistrations(const Jid& user,
             return;
         }
 
-        auto pred =
-        [&user, &deviceId](const std::pair<NodeIdT, Registration>& p)
-        {
-            return
-            p.second.getUser().bare() == user.bare() and
-            p.second.getDeviceId() == deviceId;
-        };
+        std::string node {mRegs.eraseDevice(user, deviceId)};
 
+        if(node.empty())
         {
-            std::lock_guard<std::mutex> lk {mRegsMutex};
-
-            auto result = std::find_if(mRegs.begin(), mRegs.end(), pred);
-
-            if(result == mRegs.end())
-            {
-                sendCommandError(user,
-                                 stanzaId,
-                                 "execute",
-                                 "modify",
-                                 "bad-request",
-                                 "bad-payload");
-                return;
-            }
-
-            deletePubsubNode(makeRandomString(), result->first);
-            mRegs.erase(result);
+            sendCommandError(user,
+                             stanzaId,
+                             "execute",
+                             "modify",
+                             "bad-request",
+                             "bad-payload");
+            return;
         }
+
+        deletePubsubNode(makeRandomString(), node);
     }
 
     sendCommandCompleted(user, stanzaId, "unregister-push", xdata);
 }
 
-template <typename UnaryPredicate>
-bool AppServer::deleteRegistration(const std::string& node, UnaryPredicate pred)
+bool AppServer::deleteRegistration(const std::string& node,
+                                   const RegistrationStore::PredicateT& pred)
 {
-    std::lock_guard<std::mutex> lk {mRegsMutex};
-
-    auto result = mRegs.find(node);
-
-    if(result != mRegs.end() and pred(result->second))
+    if(mRegs.eraseIf(node, pred))
     {
         deletePubsubNode(makeRandomString(), node);
-        mRegs.erase(result);
 
         return true;
     }
@@ -584,196 +653,1053 @@ void AppServer::deleteRegCb(const std::string& node, std::time_t timestamp)
 {
     deleteRegistration(
         node,
-        [timestamp](const Registration& r) {return r.getTimestamp() == timestamp;}
+        [timestamp](const RegistrationTable& regs, RegistrationTable::IdT id)
+        {return regs.getTimestamp(id) == timestamp;}
     );
 }
 
-std::unordered_map<Backend::IdT, std::unique_ptr<Backend>>
-AppServer::makeBackends()
+void AppServer::adminCommandReceived(const Jid& from,
+                                     const std::string& id,
+                                     const std::string& node,
+                                     const XData& payload)
 {
-    Config config {getConfig()};
-
-    Jid host {makeJid(config.value("host"))};
-
-    std::unordered_map<Backend::IdT, std::unique_ptr<Backend>> ret;
-    const Config::NodeT backends {config.getNode("backends")};
-
-    for(Config::IteratorT it {backends.begin()}; it != backends.end(); ++it)
+    if(not isAdmin(from))
     {
-        const Config backendConfig {*it};
-        
-        Backend::Type type {Backend::makeType(backendConfig.value("type"))};
-        std::string appName {backendConfig.value("app_name", std::string {"any"})};
-        std::string certFile {backendConfig.value("certfile")};
-        std::string authKey {backendConfig.value("auth_key", std::string {})};
-    
-        ret.emplace(
-            Backend::makeBackendId(type, host),
-            makeBackendPtr(type,
-                           host,
-                           appName,
-                           certFile,
-                           authKey)
-        );
+        sendCommandError(from, id, node, "execute", "auth", "forbidden");
+        return;
     }
 
-    return ret;
-}
+    std::unique_lock<std::mutex> pendingLk {mPendingMutex};
 
-std::unique_ptr<Backend> AppServer::makeBackendPtr(Backend::Type type,
-                                                   const Jid& host,
-                                                   const std::string& appName,
-                                                   const std::string& certFile,
-                                                   const std::string& authKey)
-{
-    std::unique_ptr<Backend> ret;
-    switch(type)
+    if(node != "push-registrations-job")
     {
-        case Backend::Type::Apns:
+        std::string name {payload.getField("path").singleValue()};
+        std::string path {makeTransferPath(name)};
+
+        if(path.empty())
         {
-            ret =
-            std::unique_ptr<Backend>
-            (
-                new ApnsBackend {host, appName,  certFile}
-            );
-            break;
+            pendingLk.unlock();
+            sendCommandError(from, id, node, "execute", "modify", "bad-request", "bad-payload");
+            return;
         }
 
-        case Backend::Type::Gcm:
+        if(mJob.running)
         {
-            ret =
-            std::unique_ptr<Backend>
-            (
-                new GcmBackend {host, appName, certFile, authKey}
-            );
-            break;
+            pendingLk.unlock();
+            sendCommandError(from, id, node, "execute", "wait", "resource-constraint");
+            return;
         }
 
-        case Backend::Type::Ubuntu:
+        // done with the last job, see runImport()
+        if(mJobThread.joinable())
         {
-            ret = std::unique_ptr<Backend>
-            (
-                new UbuntuBackend {host, appName, certFile}
-            );
-            break;
+            mJobThread.join();
         }
 
-        default:
+        mJob = AdminJob {};
+        mJob.path = name;
+        mJob.running = true;
+        mJob.reading = true;
+
+        if(node == "import-push-registrations")
         {
-            break;
+            std::string provision {payload.getField("provision", "boolean").singleValue()};
+
+            mJob.name = "import";
+            mJobThread =
+            std::thread {&AppServer::runImport,
+                         this,
+                         path,
+                         provision != "0" and provision != "false"};
         }
-    }
 
-    return ret;
-}
+        else
+        {
+            mJob.name = "export";
+            mJobThread = std::thread {&AppServer::runExport, this, path};
+        }
 
-Backend::Type AppServer::getRegType(const Registration& reg)
-{
-    Backend::IdT backendId {reg.getBackendId()};
+        LOG_INFO(AppServer, mJob.name << " of " << path << " started by " << from.bare());
+    }
 
-    auto result = mBackends.find(backendId);
+    XData status {makeJobStatus()};
 
-    if(result != mBackends.cend())
-    {
-        return result->second->type;
-    }
+    pendingLk.unlock();
 
-    return Backend::Type::Invalid;
+    sendCommandCompleted(from, id, node, status);
 }
 
-std::size_t AppServer::makeDeviceHash(const Jid& user, const std::string& deviceId)
+bool AppServer::isAdmin(const Jid& jid) const
 {
-    std::string concat {user.bare() + deviceId};
-
-    return std::hash<std::string> {} (concat);
+    return std::find(mAdmins.begin(), mAdmins.end(), jid.bare()) != mAdmins.end();
 }
 
-std::unordered_map<AppServer::NodeIdT, Registration> AppServer::readRegs() const
+std::string AppServer::makeTransferPath(const std::string& name) const
 {
-    std::unordered_map<NodeIdT, Registration> ret; 
-
-    std::ifstream iFile
+    if(name.empty() or name.front() == '/')
     {
-        STORAGE_DIR + getJid().full(),
-        std::ifstream::in
-    };
+        return {};
+    }
 
-    iFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    std::size_t start {0};
 
-    if(not iFile.is_open())
+    while(start <= name.size())
     {
-        // TODO: log info
-        std::cout << "INFO: no input file, skipping reading registrations from disk"
-                  << std::endl;
-    }
+        std::size_t end {name.find('/', start)};
 
-    else
+        if(end == std::string::npos)
+        {
+            end = name.size();
+        }
+
+        if(name.compare(start, end - start, "..") == 0)
+        {
+            return {};
+        }
+
+        start = end + 1;
+    }
+
+    return mTransferDir + name;
+}
+
+void AppServer::runImport(const std::string& path, bool provision)
+{
+    std::ifstream in {path};
+
+    if(not in)
     {
-        while(not iFile.eof())
+        LOG_ERROR(AppServer, "could not open " << path << " for importing");
+
+        std::lock_guard<std::mutex> pendingLk {mPendingMutex};
+        mJob.ok = false;
+        mJob.reading = false;
+        finishJob();
+        return;
+    }
+
+    std::string line;
+    RegistrationDump::Entry entry;
+
+    while(std::getline(in, line))
+    {
+        if(line.empty())
         {
-            NodeIdT node;
-            Registration reg;
+            continue;
+        }
 
-            try
+        bool valid {RegistrationDump::parse(line, entry)};
+
+        std::unique_lock<std::mutex> pendingLk {mPendingMutex};
+
+        if(provision and valid)
+        {
+            // takes free slots only, queued registrations of clients go first
+            mImportCv.wait(
+                pendingLk,
+                [this]()
+                {
+                    return
+                    mStopDeadlines or
+                    (mQueuedNodes.empty() and
+                     mProvisioningCount < mProvisioning.maxProvisioning);
+                }
+            );
+        }
+
+        if(mStopDeadlines)
+        {
+            mJob.ok = false;
+            break;
+        }
+
+        ++mJob.stats.processed;
+
+        if(not valid)
+        {
+            ++mJob.stats.failed;
+        }
+
+        // a second registration would hide the first one from the device
+        // index, which then is never unregistered
+        else if(mRegs.hasDevice(entry.user, entry.deviceId) or
+                mPendingDeviceNodes.count(makeDeviceKey(entry.user, entry.deviceId)) != 0)
+        {
+            ++mJob.stats.failed;
+        }
+
+        else if(not provision)
+        {
+            if(mRegs.insert(entry.node, RegistrationDump::makeRegistration(entry, getJid())))
             {
-                std::getline(iFile, node);
-                iFile >> reg;
-
-                // DEBUG:
-                std::cout << "DEBUG: read registration from storage:" << std::endl
-                          << "user: " << reg.getUser().full() << std::endl
-                          << "deviceId: " << reg.getDeviceId() << std::endl
-                          << "deviceName" << reg.getDeviceName() << std::endl
-                          << "token: " << reg.getToken() << std::endl
-                          << "appId: " << reg.getAppId() << std::endl
-                          << "backendId: " << reg.getBackendId() << std::endl
-                          << "timestmap: " << reg.getTimestamp() << std::endl;
-    
-                ret.emplace(node, reg);
+                ++mJob.stats.transferred;
             }
 
-            catch(const std::ios_base::failure&)
+            else
             {
-                if(not iFile.eof())
+                ++mJob.stats.failed;
+            }
+        }
+
+        else if(mPendingRegs.count(entry.node) != 0 or
+                mRegs.read(entry.node, [](const RegistrationTable&, RegistrationTable::IdT) { }))
+        {
+            ++mJob.stats.failed;
+        }
+
+        else
+        {
+            insertPendingReg(
+                entry.node,
+                PendingReg
                 {
-                    // TODO: log error
-                    std::cout << "ERROR: could not read storage file, "
-                                 "aborting reading registrations." << std::endl;
+                    entry.secret,
+                    "",
+                    RegistrationDump::makeRegistration(entry, getJid()),
+                    true
+                }
+            );
+
+            mQueuedNodes.push_back(entry.node);
+            ++mJob.provisioning;
+
+            startQueuedRegs();
+        }
+
+        if(mJob.stats.processed % Parameters::JobProgressInterval == 0)
+        {
+            LOG_INFO(AppServer, "import of " << path << ": "
+                                << mJob.stats.processed << " processed, "
+                                << mJob.stats.transferred << " imported, "
+                                << mJob.stats.failed << " failed, "
+                                << mJob.provisioning << " being provisioned");
+        }
+    }
+
+    std::lock_guard<std::mutex> pendingLk {mPendingMutex};
+
+    if(in.bad())
+    {
+        LOG_ERROR(AppServer, "could not read " << path);
+        mJob.ok = false;
+    }
+
+    mJob.reading = false;
+
+    // otherwise the last imported registration to be provisioned finishes
+    if(mJob.provisioning == 0)
+    {
+        finishJob();
+    }
+}
+
+void AppServer::runExport(const std::string& path)
+{
+    // an export never replaces a file
+    int fd {open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600)};
+    bool ok {fd != -1};
+
+    if(not ok)
+    {
+        LOG_ERROR(AppServer, "could not create " << path << ": " << std::strerror(errno));
+    }
+
+    else
+    {
+        mRegs.forEachShard(
+            [this, fd, &ok](const RegistrationTable& regs)
+            {
+                std::ostringstream out;
+                std::size_t written {RegistrationDump::write(out, regs, getJid())};
+
+                ok = ok and writeAll(fd, out.str());
+
+                std::lock_guard<std::mutex> pendingLk {mPendingMutex};
+
+                mJob.stats.processed += regs.size();
+                mJob.stats.transferred += written;
+                mJob.stats.failed += regs.size() - written;
+            }
+        );
+
+        if(close(fd) != 0)
+        {
+            ok = false;
+        }
+
+        if(not ok)
+        {
+            LOG_ERROR(AppServer, "could not write " << path);
+        }
+    }
+
+    std::lock_guard<std::mutex> pendingLk {mPendingMutex};
+
+    if(not ok)
+    {
+        mJob.ok = false;
+    }
+
+    mJob.reading = false;
+    finishJob();
+}
+
+XData AppServer::makeJobStatus() const
+{
+    XData xdata {"result"};
+
+    if(mJob.name.empty())
+    {
+        return xdata;
+    }
+
+    std::string state {mJob.running ? "running" : mJob.ok ? "done" : "failed"};
+
+    xdata.addField({"", "job", {mJob.name}});
+    xdata.addField({"", "path", {mJob.path}});
+    xdata.addField({"", "state", {state}});
+    xdata.addField({"", "processed", {std::to_string(mJob.stats.processed)}});
+    xdata.addField({"", "transferred", {std::to_string(mJob.stats.transferred)}});
+    xdata.addField({"", "failed", {std::to_string(mJob.stats.failed)}});
+    xdata.addField({"", "provisioning", {std::to_string(mJob.provisioning)}});
+
+    return xdata;
+}
+
+void AppServer::finishJob()
+{
+    mJob.running = false;
+
+    LOG_INFO(AppServer, mJob.name << " of " << mJob.path
+                        << (mJob.ok ? " done: " : " failed: ")
+                        << mJob.stats.processed << " processed, "
+                        << mJob.stats.transferred << " transferred, "
+                        << mJob.stats.failed << " failed");
+}
+
+void AppServer::registrationInserted(const NodeIdT& node, const Registration& reg)
+{
+    {
+        std::lock_guard<std::mutex> lk {mRegCountsMutex};
+        ++mRegCounts[reg.getBackendId()];
+    }
+
+    if(mJournal)
+    {
+        mJournal->logAdd(node, reg);
+    }
+}
+
+void AppServer::registrationErased(const RegistrationTable& regs,
+                                   RegistrationTable::IdT id)
+{
+    {
+        std::lock_guard<std::mutex> lk {mRegCountsMutex};
+
+        auto countResult = mRegCounts.find(regs.getBackendId(id));
+
+        if(countResult != mRegCounts.end() and --countResult->second == 0)
+        {
+            mRegCounts.erase(countResult);
+        }
+    }
+
+    if(mJournal)
+    {
+        mJournal->logDelete(regs.getNode(id).str());
+    }
+}
+
+void AppServer::insertPendingReg(const NodeIdT& node, const PendingReg& pending)
+{
+    if(mPendingRegs.emplace(node, pending).second)
+    {
+        const Registration& reg = pending.getRegistration();
+
+        mPendingDeviceNodes[makeDeviceKey(reg.getUser(), reg.getDeviceId())] = node;
+    }
+}
 
-                    return ret;
+void AppServer::erasePendingReg(PendingRegMapT::iterator it)
+{
+    const Registration& reg = it->second.getRegistration();
+
+    if(it->second.isStarted())
+    {
+        --mProvisioningCount;
+        mImportCv.notify_one();
+    }
+
+    if(it->second.isImported() and --mJob.provisioning == 0 and not mJob.reading)
+    {
+        finishJob();
+    }
+
+    auto deviceResult =
+    mPendingDeviceNodes.find(makeDeviceKey(reg.getUser(), reg.getDeviceId()));
+
+    if(deviceResult != mPendingDeviceNodes.end() and deviceResult->second == it->first)
+    {
+        mPendingDeviceNodes.erase(deviceResult);
+    }
+
+    mPendingRegs.erase(it);
+}
+
+AppServer::PendingRegMapT::iterator
+AppServer::findPendingReg(const Jid& user, const std::string& deviceId)
+{
+    auto result = mPendingDeviceNodes.find(makeDeviceKey(user, deviceId));
+
+    return
+    result == mPendingDeviceNodes.end() ?
+    mPendingRegs.end() :
+    mPendingRegs.find(result->second);
+}
+
+void AppServer::startQueuedRegs()
+{
+    using Action = typename PendingReg::Action;
+
+    while(mProvisioningCount < mProvisioning.maxProvisioning and
+          not mQueuedNodes.empty())
+    {
+        NodeIdT node {std::move(mQueuedNodes.front())};
+        mQueuedNodes.pop_front();
+
+        auto pendingIt = mPendingRegs.find(node);
+
+        // registered again while queued
+        if(pendingIt == mPendingRegs.end())
+        {
+            continue;
+        }
+
+        pendingIt->second.start();
+        ++mProvisioningCount;
+
+        sendAction(node, Action::CreateNode, 0);
+
+        if(mProvisioning.pipelined)
+        {
+            sendAction(node, Action::SetAffiliation, 0);
+            sendAction(node, Action::Subscribe, 0);
+        }
+    }
+
+    mImportCv.notify_one();
+}
+
+void AppServer::sendAction(const NodeIdT& node,
+                           PendingReg::Action action,
+                           unsigned int attempt)
+{
+    using Action = typename PendingReg::Action;
+    using Clock = TimerWheel<ActionDeadline>::Clock;
+
+    const PendingReg& pending = mPendingRegs.at(node);
+
+    StanzaIdT id {makeRandomString()};
+
+    mPendingActions.insert({id, PendingAction {action, node, attempt}});
+
+    bool wasEmpty {mDeadlines.empty()};
+
+    std::list<ActionDeadline> deadline {{id, Clock::now() + mProvisioning.iqTimeout}};
+    mDeadlines.schedule(deadline, deadline.begin());
+
+    // all deadlines are equally far off, only the first one can be earlier
+    // than what the deadline thread waits for
+    if(wasEmpty)
+    {
+        mDeadlinesCv.notify_one();
+    }
+
+    switch(action)
+    {
+        case Action::CreateNode:
+        {
+            XData nodeConfig
+            {
+                "submit",
+                {
+                    {"hidden", "FORM_TYPE", {"http://jabber.org/protocol/pubsub#node_config"}}
                 }
+            };
+
+            // imports may not know the secret
+            if(not pending.getSecret().empty())
+            {
+                nodeConfig.addField({"", "pubsub#secret", {pending.getSecret()}});
             }
 
+            createPubsubNode(id, node, nodeConfig);
+            break;
+        }
+
+        case Action::SetAffiliation:
+        {
+            setPubsubAffiliation(
+                id,
+                node,
+                Jid::removeResource(pending.getRegistration().getUser()),
+                "publish-only"
+            );
+            break;
         }
 
-        iFile.close();
+        case Action::Subscribe:
+        {
+            pubsubSubscribe(id, node);
+            break;
+        }
     }
+}
 
-    return ret;
+void AppServer::actionCompleted(PendingRegMapT::iterator it, PendingReg::Action action)
+{
+    using Action = typename PendingReg::Action;
+
+    const NodeIdT& node = it->first;
+    PendingReg& pending = it->second;
+
+    int completedActions {pending.completeAction(action)};
+
+    if(completedActions == Action::CreateNode and not mProvisioning.pipelined)
+    {
+        sendAction(node, Action::SetAffiliation, 0);
+        sendAction(node, Action::Subscribe, 0);
+    }
+
+    else if(completedActions ==
+       (Action::CreateNode | Action::SetAffiliation | Action::Subscribe))
+    {
+        if(pending.isImported())
+        {
+            if(mRegs.insert(node, pending.getRegistration()))
+            {
+                ++mJob.stats.transferred;
+            }
+
+            else
+            {
+                ++mJob.stats.failed;
+            }
+
+            erasePendingReg(it);
+            return;
+        }
+
+        XData xdata
+        {
+            "result",
+            {
+                {"", "jid", {getPubsubJid().full()}},
+                {"", "node", {node}},
+                {"", "secret", {pending.getSecret()}}
+            }
+        };
+        
+        std::string command
+        {
+            "register-push-" +
+            Backend::getTypeStr(getRegType(pending.getRegistration()))
+        };
+
+        sendCommandCompleted(pending.getRegistration().getUser(),
+                             pending.getRegisterId(),
+                             command,
+                             xdata);
+        
+        mRegs.insert(node, pending.getRegistration());
+
+        erasePendingReg(it);
+    }
 }
 
-void AppServer::writeRegs() const
+void AppServer::actionTimedOut(const StanzaIdT& id)
 {
-    std::ofstream oFile
+    auto result = mPendingActions.find(id);
+
+    // answered in time
+    if(result == mPendingActions.end())
     {
-        STORAGE_DIR + getJid().full(),
-        std::ofstream::out | std::ofstream::trunc
+        return;
+    }
+
+    PendingAction pendingAction {std::move(result->second)};
+    mPendingActions.erase(result);
+
+    auto pendingIt = mPendingRegs.find(pendingAction.node);
+
+    if(pendingIt == mPendingRegs.end())
+    {
+        return;
+    }
+
+    mTimeoutCounter->increment();
+
+    if(pendingAction.attempt < mProvisioning.iqRetries)
+    {
+        LOG_WARNING(AppServer, "pubsub request timed out, retrying");
+
+        sendAction(pendingAction.node, pendingAction.action, pendingAction.attempt + 1);
+        return;
+    }
+
+    LOG_WARNING(AppServer, "pubsub request timed out, giving up registration");
+
+    // whether the node got created is unknown
+    failPendingReg(pendingIt, "wait", "remote-server-timeout", true);
+}
+
+void AppServer::failPendingReg(PendingRegMapT::iterator it,
+                               const std::string& errorType,
+                               const std::string& condition,
+                               bool deleteNode)
+{
+    const PendingReg& pending = it->second;
+
+    if(pending.isImported())
+    {
+        // the node may have been there before the import, it's left alone
+        ++mJob.stats.failed;
+        erasePendingReg(it);
+        return;
+    }
+
+    std::string command
+    {
+        "register-push-" +
+        Backend::getTypeStr(getRegType(pending.getRegistration()))
     };
 
-    if(not oFile.is_open())
+    sendCommandError(pending.getRegistration().getUser(),
+                     pending.getRegisterId(),
+                     command,
+                     "execute",
+                     errorType,
+                     condition);
+
+    if(deleteNode)
     {
-        // TODO: log error
-        std::cout << "ERROR: could not open file for serialization" << std::endl;
+        deletePubsubNode(makeRandomString(), it->first);
     }
-    
-    else
+
+    erasePendingReg(it);
+}
+
+void AppServer::runDeadlines()
+{
+    using Clock = TimerWheel<ActionDeadline>::Clock;
+
+    std::unique_lock<std::mutex> lk {mPendingMutex};
+
+    while(not mStopDeadlines)
     {
-        for(const auto& r : mRegs)
+        if(mDeadlines.empty())
+        {
+            mDeadlinesCv.wait(lk);
+        }
+
+        else
+        {
+            mDeadlinesCv.wait_until(lk, mDeadlines.nextExpiry());
+        }
+
+        std::list<ActionDeadline> expired;
+        mDeadlines.expire(Clock::now(), expired);
+
+        for(const ActionDeadline& deadline : expired)
+        {
+            actionTimedOut(deadline.id);
+        }
+
+        if(not expired.empty())
+        {
+            startQueuedRegs();
+        }
+    }
+}
+
+AppServer::ProvisioningOptions AppServer::makeProvisioningOptions() const
+{
+    const Config& config = getConfig();
+
+    ProvisioningOptions options;
+
+    options.maxProvisioning =
+    std::max(1u, config.value<unsigned int>("max_provisioning",
+                                            Parameters::DefaultMaxProvisioning));
+    options.maxQueuedRegs =
+    config.value<unsigned int>("max_queued_registrations",
+                               Parameters::DefaultMaxQueuedRegs);
+    options.iqTimeout =
+    std::chrono::milliseconds
+    (
+        std::max(1u, config.value<unsigned int>("pubsub_timeout",
+                                                Parameters::DefaultIqTimeout))
+    );
+    options.iqRetries =
+    config.value<unsigned int>("pubsub_retries", Parameters::DefaultIqRetries);
+    options.pipelined = config.value<bool>("pipeline_provisioning", false);
+
+    return options;
+}
+
+AppServer::DeviceKeyT AppServer::makeDeviceKey(const Jid& user,
+                                               const std::string& deviceId)
+{
+    return user.bare() + '/' + deviceId;
+}
+
+std::unordered_map<Backend::IdT, std::unique_ptr<Backend>>
+AppServer::makeBackends()
+{
+    Config config {getConfig()};
+
+    Jid host {makeJid(config.value("host"))};
+
+    std::unordered_map<Backend::IdT, std::unique_ptr<Backend>> ret;
+    const Config::NodeT backends {config.getNode("backends")};
+
+    for(Config::IteratorT it {backends.begin()}; it != backends.end(); ++it)
+    {
+        const Config backendConfig {*it};
+
+        // before the backend is made, a second one would share the first's
+        // spool
+        Backend::Type type {Backend::makeType(backendConfig.value("type"))};
+
+        if(type != Backend::Type::Invalid and
+           ret.count(Backend::makeBackendId(type, host)) != 0)
         {
-            oFile << r.first << '\n'
-                  << r.second;
+            throw Config::InvalidConfig
+            {
+                "Invalid config: more than one " + Backend::getTypeStr(type) +
+                " backend, apns and apns2 are mutually exclusive"
+            };
         }
 
-        oFile.close();
+        Backend::Options options;
+        options.maxBatchSize =
+        std::max(1u, backendConfig.value<unsigned int>("max_batch_size",
+                                                       options.maxBatchSize));
+        options.linger = backendConfig.value<unsigned int>("linger", options.linger);
+        options.concurrentRequests =
+        std::max(1u, backendConfig.value<unsigned int>("concurrent_requests",
+                                                       options.concurrentRequests));
+        options.workers =
+        std::max(1u, backendConfig.value<unsigned int>("workers", options.workers));
+        options.url = backendConfig.value("url", std::string {});
+        options.makeUnregisterCb =
+        [this](const std::string& unregisterKey)
+        {
+            std::string node;
+            std::time_t timestamp;
+
+            if(not parseUnregisterKey(unregisterKey, node, timestamp))
+            {
+                return std::function<void()> {[]() { }};
+            }
+
+            return std::function<void()>
+            {[this, node, timestamp]() {deleteRegCb(node, timestamp);}};
+        };
+
+        std::unique_ptr<Backend> backend {makeBackendPtr(backendConfig, host, options)};
+
+        if(backend)
+        {
+            Backend::IdT backendId {backend->getId()};
+            ret.emplace(backendId, std::move(backend));
+        }
     }
+
+    return ret;
+}
+
+std::unique_ptr<Backend> AppServer::makeBackendPtr(const Config& backendConfig,
+                                                   const Jid& host,
+                                                   const Backend::Options& commonOptions)
+{
+    std::string typeStr {backendConfig.value("type")};
+    Backend::Type type {Backend::makeType(typeStr)};
+    std::string appName {backendConfig.value("app_name", std::string {"any"})};
+
+    Backend::Options options {commonOptions};
+
+    if(backendConfig.value<bool>("spool", true))
+    {
+        options.spoolPath =
+        getStoragePath() + '.' + Backend::getTypeStr(type) + ".spool";
+    }
+
+    std::unique_ptr<Backend> ret;
+    switch(type)
+    {
+        case Backend::Type::Apns:
+        {
+            if(typeStr == "apns2")
+            {
+                Apns2Backend::Credentials credentials;
+                credentials.keyFile = backendConfig.value("key_file");
+                credentials.keyId = backendConfig.value("key_id");
+                credentials.teamId = backendConfig.value("team_id");
+                credentials.topic = backendConfig.value("topic", appName);
+                credentials.sandbox = backendConfig.value<bool>("sandbox", false);
+
+                ret =
+                std::unique_ptr<Backend>
+                (
+                    new Apns2Backend {host, appName, credentials, options}
+                );
+                break;
+            }
+
+            std::string certFile {backendConfig.value("certfile")};
+
+            ret =
+            std::unique_ptr<Backend>
+            (
+                new ApnsBackend {host, appName, certFile, options}
+            );
+            break;
+        }
+
+        case Backend::Type::Gcm:
+        {
+            std::string certFile {backendConfig.value("certfile")};
+            std::string authKey {backendConfig.value("auth_key", std::string {})};
+
+            ret =
+            std::unique_ptr<Backend>
+            (
+                new GcmBackend {host, appName, certFile, authKey, options}
+            );
+            break;
+        }
+
+        case Backend::Type::Ubuntu:
+        {
+            std::string certFile {backendConfig.value("certfile")};
+
+            ret = std::unique_ptr<Backend>
+            (
+                new UbuntuBackend {host, appName, certFile, options}
+            );
+            break;
+        }
+
+        default:
+        {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+Backend::Type AppServer::getRegType(const Registration& reg)
+{
+    Backend::IdT backendId {reg.getBackendId()};
+
+    auto result = mBackends.find(backendId);
+
+    if(result != mBackends.cend())
+    {
+        return result->second->type;
+    }
+
+    return Backend::Type::Invalid;
+}
+
+bool AppServer::importRegs(const Config& config, std::istream& in, TransferStats& stats)
+{
+    Jid host {"", config.value("host"), ""};
+    std::string storagePath {makeStoragePath(config, host)};
+
+    RegistrationTable regs;
+
+    for(const RegistrationTable& snapshot : readRegs(storagePath))
+    {
+        regs.merge(snapshot);
+    }
+
+    RegistrationJournal::replay(makeJournalPath(storagePath), regs);
+
+    std::string line;
+    RegistrationDump::Entry entry;
+
+    while(std::getline(in, line))
+    {
+        if(line.empty())
+        {
+            continue;
+        }
+
+        ++stats.processed;
+
+        // devices already registered are skipped, see runImport()
+        if(RegistrationDump::parse(line, entry) and
+           regs.findDevice(entry.user, entry.deviceId) == RegistrationTable::InvalidId and
+           regs.insert(entry.node, RegistrationDump::makeRegistration(entry, host)))
+        {
+            ++stats.transferred;
+        }
+
+        else
+        {
+            ++stats.failed;
+        }
+
+        if(stats.processed % Parameters::JobProgressInterval == 0)
+        {
+            LOG_INFO(AppServer, "import: " << stats.processed << " processed, "
+                                << stats.transferred << " imported, "
+                                << stats.failed << " failed");
+        }
+    }
+
+    if(in.bad() or not writeRegs(storagePath, regs))
+    {
+        return false;
+    }
+
+    // the snapshot covers the journal now
+    RegistrationJournal::remove(makeJournalPath(storagePath));
+
+    return true;
+}
+
+bool AppServer::exportRegs(const Config& config, std::ostream& out, TransferStats& stats)
+{
+    Jid host {"", config.value("host"), ""};
+    std::string storagePath {makeStoragePath(config, host)};
+
+    RegistrationTable regs;
+
+    for(const RegistrationTable& snapshot : readRegs(storagePath))
+    {
+        regs.merge(snapshot);
+    }
+
+    RegistrationJournal::replay(makeJournalPath(storagePath), regs);
+
+    stats.processed = regs.size();
+    stats.transferred = RegistrationDump::write(out, regs, host);
+    stats.failed = stats.processed - stats.transferred;
+
+    out.flush();
+
+    return static_cast<bool>(out);
+}
+
+std::vector<RegistrationTable> AppServer::readRegs(const std::string& storagePath)
+{
+    using Result = RegistrationSnapshot::Result;
+
+    std::vector<RegistrationTable> ret;
+
+    Result result {RegistrationSnapshot::read(storagePath, ret)};
+
+    if(result == Result::Legacy)
+    {
+        LOG_INFO(AppServer, "converting registrations to the binary snapshot format");
+
+        ret.emplace_back();
+        result = RegistrationSnapshot::readLegacy(storagePath, ret.back());
+
+        if(result == Result::Ok and not writeRegs(storagePath, ret.back()))
+        {
+            LOG_ERROR(AppServer, "could not convert registration storage file");
+        }
+    }
+
+    if(result == Result::NotFound)
+    {
+        LOG_INFO(AppServer, "no input file, skipping reading registrations from disk");
+    }
+
+    else if(result == Result::Invalid)
+    {
+        LOG_ERROR(AppServer, "could not read storage file, "
+                             "aborting reading registrations.");
+    }
+
+    return ret;
+}
+
+bool AppServer::writeRegs(const std::string& storagePath, const RegistrationTable& regs)
+{
+    return RegistrationSnapshot::write(storagePath, regs);
+}
+
+void AppServer::compactRegs()
+{
+    // the journal is rotated with no change in between, the snapshot covers
+    // exactly the rotated records
+    std::vector<RegistrationTable> shards {mRegs.copy([this]() {mJournal->rotate();})};
+
+    if(RegistrationSnapshot::write(getStoragePath(), shards))
+    {
+        mJournal->removeRotated();
+    }
+
+    else
+    {
+        LOG_ERROR(AppServer, "could not write registration snapshot, "
+                             "keeping the rotated journal");
+    }
+}
+
+std::string AppServer::getStoragePath() const
+{
+    return makeStoragePath(getConfig(), getJid());
+}
+
+std::string AppServer::makeUnregisterKey(const NodeIdT& node, std::time_t timestamp)
+{
+    return std::to_string(timestamp) + ' ' + node;
+}
+
+bool AppServer::parseUnregisterKey(const std::string& unregisterKey,
+                                   NodeIdT& node,
+                                   std::time_t& timestamp)
+{
+    std::size_t separator {unregisterKey.find(' ')};
+
+    if(separator == std::string::npos)
+    {
+        return false;
+    }
+
+    try
+    {
+        timestamp = std::stoll(unregisterKey.substr(0, separator));
+    }
+
+    catch(const std::logic_error&)
+    {
+        return false;
+    }
+
+    node = unregisterKey.substr(separator + 1);
+
+    return true;
+}
+
+std::string AppServer::getJournalPath() const
+{
+    return makeJournalPath(getStoragePath());
+}
+
+std::string AppServer::makeStoragePath(const Config& config, const Jid& host)
+{
+    return config.value("storage_dir", std::string {STORAGE_DIR}) + host.full();
+}
+
+std::string AppServer::makeJournalPath(const std::string& storagePath)
+{
+    return storagePath + ".journal";
 }
@@ -17,44 +17,198 @@
  */
 
 #include <Backend.hpp>
+#include "Logger.hpp"
+#include "NotificationSpool.hpp"
 
 #include <sstream>
 #include <type_traits>
 #include <chrono>
+#include <iterator>
+#include <algorithm>
+#include <unordered_set>
 
-// DEBUG
-#include <iostream>
 
 using namespace Oshiya;
 
+const unsigned int Backend::Parameters::NotificationExpireTime;
+const unsigned int Backend::Parameters::HttpTimeout;
+const unsigned int Backend::Parameters::ConnectTimeout;
+const unsigned int Backend::Parameters::MinRetryDelay;
+const unsigned int Backend::Parameters::MaxRetryDelay;
+const unsigned int Backend::Parameters::MaxAttempts;
+const unsigned int Backend::Parameters::RetryTick;
+const std::size_t Backend::Parameters::RetrySlots;
+const unsigned int Backend::Parameters::MaxFailurePercent;
+const unsigned int Backend::Parameters::MaxSendTime;
+const unsigned int Backend::Parameters::KeepAliveInterval;
+const std::size_t Backend::Parameters::DefaultMaxBatchSize;
+const std::size_t Backend::Parameters::DefaultConcurrentRequests;
+
 Backend::Backend(Type _type,
                  const Jid& _host,
                  const std::string& _appName,
-                 const std::string& _certFile)
+                 const std::string& _certFile,
+                 const Options& _options)
     :
         type {_type},
         host {_host},
         appName {_appName},
-        certFile {_certFile}
+        certFile {_certFile},
+        options {_options},
+        mShutdown {false},
+        mRetryWheel
+        {
+            std::chrono::milliseconds(Parameters::RetryTick),
+            Parameters::RetrySlots,
+            [](const PushNotification& n) {return n.retryTime;}
+        },
+        mLimiter {options.maxBatchSize * options.workers},
+        mNextSpoolId {1}
 {
+    Metrics& metrics = Metrics::getRegistry();
+    Metrics::LabelsT labels {{"component", host.full()}, {"backend", getTypeStr(type)}};
+
+    mSentCounter =
+    &metrics.getCounter("oshiya_backend_sent_total",
+                        "Notifications the push service accepted or rejected for good.",
+                        labels);
+    mRetryCounter =
+    &metrics.getCounter("oshiya_backend_retries_total",
+                        "Failed notifications scheduled for another attempt.",
+                        labels);
+    mDropCounter =
+    &metrics.getCounter("oshiya_backend_dropped_total",
+                        "Notifications given up on after too many attempts or expired.",
+                        labels);
+    mUnregisterCounter =
+    &metrics.getCounter("oshiya_backend_unregistrations_total",
+                        "Devices unregistered because the push service rejected them.",
+                        labels);
+    mSendDuration =
+    &metrics.getHistogram("oshiya_backend_send_duration_seconds",
+                          "Time taken to send a batch of notifications.",
+                          labels);
+
+    Metrics::LabelsT dispatchLabels {labels};
+    dispatchLabels.emplace_back("queue", "dispatch");
+
+    metrics.addGauge("oshiya_backend_queue_length",
+                     "Notifications waiting to be sent.",
+                     dispatchLabels,
+                     [this]()
+                     {
+                         std::lock_guard<std::mutex> lk {mDispatchMutex};
+                         return mDispatchQueue.size();
+                     },
+                     this);
+
+    Metrics::LabelsT retryLabels {labels};
+    retryLabels.emplace_back("queue", "retry");
+
+    metrics.addGauge("oshiya_backend_queue_length",
+                     "Notifications waiting to be sent.",
+                     retryLabels,
+                     [this]()
+                     {
+                         std::lock_guard<std::mutex> lk {mDispatchMutex};
+                         return mRetryQueue.size() + mRetryWheel.size();
+                     },
+                     this);
+
+    metrics.addGauge("oshiya_backend_concurrency_limit",
+                     "Notifications the backend may have in flight at once.",
+                     labels,
+                     [this]()
+                     {
+                         std::lock_guard<std::mutex> lk {mDispatchMutex};
+                         return mLimiter.getLimit();
+                     },
+                     this);
+
+    metrics.addGauge("oshiya_backend_circuit_state",
+                     "Circuit breaker state: 0 closed, 1 open, 2 half-open.",
+                     labels,
+                     [this]()
+                     {
+                         using TypeT = std::underlying_type<CircuitBreaker::State>::type;
+
+                         std::lock_guard<std::mutex> lk {mDispatchMutex};
+                         return static_cast<TypeT>(mBreaker.getState());
+                     },
+                     this);
+
+    if(options.spoolPath.empty())
+    {
+        return;
+    }
+
+    mSpool.reset(new NotificationSpool {options.spoolPath});
 
+    std::vector<NotificationSpool::Entry> entries {mSpool->replay()};
+
+    LOG_INFO(Backend, entries.size() << " notifications in spool " << options.spoolPath);
+
+    std::lock_guard<std::mutex> lk {mDispatchMutex};
+
+    std::time_t now {std::time(nullptr)};
+
+    for(const NotificationSpool::Entry& e : entries)
+    {
+        mNextSpoolId = e.id + 1;
+
+        if(static_cast<std::time_t>(e.createdAt) + Parameters::NotificationExpireTime < now)
+        {
+            mSpool->remove(e.id);
+            continue;
+        }
+
+        enqueue(
+            PushNotification
+            {
+                e.id,
+                static_cast<std::time_t>(e.createdAt),
+                static_cast<std::size_t>(e.deviceHash),
+                e.payload,
+                e.token,
+                e.appId,
+                e.unregisterKey,
+                makeUnregisterCb(e.unregisterKey)
+            }
+        );
+    }
 }
 
 Backend::~Backend()
 {
-    mShutdown = true;
+    Metrics::getRegistry().removeGauges(this);
 
-    mSendCv.notify_one();
+    stopWorkers();
+}
 
-    if(mWorkerThread.get_id() != std::thread::id {})
+void Backend::startWorkers()
+{
+    for(std::size_t i {0}; i < options.workers; ++i)
     {
-        mWorkerThread.join();
+        mWorkerThreads.emplace_back(&Backend::doWork, this, i);
     }
 }
 
-void Backend::startWorker()
+void Backend::stopWorkers()
 {
-    mWorkerThread = std::thread {&Backend::doWork, this};
+    {
+        std::lock_guard<std::mutex> lk {mDispatchMutex};
+        mShutdown = true;
+    }
+
+    mSendCv.notify_all();
+
+    for(std::thread& t : mWorkerThreads)
+    {
+        if(t.joinable())
+        {
+            t.join();
+        }
+    }
 }
 
 Backend::IdT Backend::getId()
@@ -76,6 +230,8 @@ Backend::IdT Backend::makeBackendId(Type type,
 Backend::Type Backend::makeType(const std::string& typeStr)
 {
     if(typeStr == "apns") {return Type::Apns;}
+    // same devices and registrations, only the provider API differs
+    if(typeStr == "apns2") {return Type::Apns;}
     if(typeStr == "gcm") {return Type::Gcm;}
     if(typeStr == "mozilla") {return Type::Mozilla;}
     if(typeStr == "ubuntu") {return Type::Ubuntu;}
@@ -95,86 +251,374 @@ std::string Backend::getTypeStr(Type type)
 
 void Backend::dispatch(std::size_t deviceHash,
                        const PayloadT& payload,
-                       const std::string& token,
-                       const std::string& appId,
-                       std::function<void()> unregisterCb)
+                       std::string token,
+                       std::string appId,
+                       std::string unregisterKey)
 {
+    std::function<void()> unregisterCb {makeUnregisterCb(unregisterKey)};
+
     {
         std::lock_guard<std::mutex> lk {mDispatchMutex};
 
-        mDispatchQueue.remove_if(
-            [&deviceHash](const PushNotification& n)
-            {return n.deviceHash == deviceHash;}
-        );
+        PushNotification n
+        {
+            mNextSpoolId++,
+            std::time(nullptr),
+            deviceHash,
+            payload,
+            std::move(token),
+            std::move(appId),
+            std::move(unregisterKey),
+            std::move(unregisterCb)
+        };
+
+        if(mSpool)
+        {
+            mSpool->add(n);
+        }
 
-        mDispatchQueue.emplace(mDispatchQueue.end(),
-                               deviceHash,
-                               payload,
-                               token,
-                               appId,
-                               unregisterCb);
+        enqueue(std::move(n));
     }
 
-    // DEBUG:
-    std::cout << "Backend::dispatch: notifying worker" << std::endl;
+    LOG_DEBUG(Backend, "Backend::dispatch: notifying worker");
 
-    mSendCv.notify_one(); 
+    mSendCv.notify_one();
 }
 
-void Backend::doWork()
+std::function<void()> Backend::makeUnregisterCb(const std::string& unregisterKey) const
 {
-    NotificationQueueT sendQueue;
-    NotificationQueueT retryQueue;
+    Metrics::Counter* counter {mUnregisterCounter};
 
-    // TODO:
-    // read sendQueue from disk
-
-    while(not mShutdown)
+    if(options.makeUnregisterCb)
     {
-        retryQueue = send(sendQueue);
+        std::function<void()> unregisterCb {options.makeUnregisterCb(unregisterKey)};
 
-        sendQueue.clear();
+        return
+        [counter, unregisterCb]()
+        {
+            counter->increment();
+            unregisterCb();
+        };
+    }
 
-        bool dispatchQueueEmpty;
+    return [counter]() {counter->increment();};
+}
 
-        {
-            std::lock_guard<std::mutex> lk {mDispatchMutex};
+void Backend::enqueue(PushNotification&& n)
+{
+    std::size_t deviceHash {n.deviceHash};
 
-            dispatchQueueEmpty = mDispatchQueue.empty();
+    auto it = mDispatchQueue.insert(mDispatchQueue.end(), std::move(n));
+
+    // the newest notification replaces one still queued for the device
+    auto result = mDispatchIndex.emplace(deviceHash, it);
+
+    if(not result.second)
+    {
+        if(mSpool)
+        {
+            mSpool->remove(result.first->second->spoolId);
         }
 
-        if(dispatchQueueEmpty)
+        mDispatchQueue.erase(result.first->second);
+        result.first->second = it;
+    }
+}
+
+void Backend::doWork(std::size_t worker)
+{
+    using Clock = std::chrono::steady_clock;
+
+    while(true)
+    {
+        NotificationQueueT sendQueue;
+        bool probe {false};
+
         {
-            std::unique_lock<std::mutex> lk {mSendMutex};
+            std::unique_lock<std::mutex> lk {mDispatchMutex};
 
-            if(not retryQueue.empty())
+            auto readyPred =
+            [this]()
+            {
+                if(not mRetryWheel.empty())
+                {
+                    mRetryWheel.expire(Clock::now(), mRetryQueue);
+                }
+
+                return
+                mShutdown or
+                ((not mDispatchQueue.empty() or not mRetryQueue.empty()) and
+                 mBreaker.isSendAllowed(Clock::now()) and
+                 mLimiter.getAvailable() > 0);
+            };
+
+            bool timed {false};
+            Clock::time_point wakeTime;
+
+            if(not mRetryWheel.empty())
+            {
+                wakeTime = mRetryWheel.nextExpiry();
+                timed = true;
+            }
+
+            if(mBreaker.getState() == CircuitBreaker::State::Open)
+            {
+                wakeTime = timed ? std::min(wakeTime, mBreaker.getProbeTime())
+                                 : mBreaker.getProbeTime();
+                timed = true;
+            }
+
+            if(not timed)
+            {
+                mSendCv.wait(lk, readyPred);
+            }
+
+            else if(not mSendCv.wait_until(lk, wakeTime, readyPred))
+            {
+                // woken for a retry or probe that can't be sent after all
+                continue;
+            }
+
+            // give a burst the chance to fill the batch up
+            if(options.linger > 0 and
+               not mDispatchQueue.empty() and
+               mDispatchQueue.size() < options.maxBatchSize)
             {
                 mSendCv.wait_for(
                     lk,
-                    std::chrono::milliseconds(Parameters::RetryPeriod),
-                    [this]() {return mShutdown;}
+                    std::chrono::milliseconds(options.linger),
+                    [this]()
+                    {return mShutdown or mDispatchQueue.size() >= options.maxBatchSize;}
                 );
+            }
+
+            if(mShutdown)
+            {
+                break;
+            }
+
+            if(not mBreaker.isSendAllowed(Clock::now()))
+            {
+                // another worker took the probe
+                continue;
+            }
+
+            std::size_t batchSize
+            {
+                std::min({options.maxBatchSize,
+                          mLimiter.getAvailable(),
+                          mBreaker.getBatchLimit()})
+            };
+
+            spliceFront(sendQueue, mDispatchQueue, batchSize);
+
+            for(const PushNotification& n : sendQueue)
+            {
+                mDispatchIndex.erase(n.deviceHash);
+            }
+
+            // fresh notifications first, retries fill the batch up
+            spliceFront(sendQueue,
+                        mRetryQueue,
+                        batchSize - sendQueue.size());
+
+            // notifications parked while the circuit was open may have expired
+            std::time_t now {std::time(nullptr)};
+
+            for(auto it = sendQueue.begin(); it != sendQueue.end();)
+            {
+                if(it->createdAt + Parameters::NotificationExpireTime < now)
+                {
+                    if(mSpool)
+                    {
+                        mSpool->remove(it->spoolId);
+                    }
+
+                    mDropCounter->increment();
+                    it = sendQueue.erase(it);
+                }
+
+                else
+                {
+                    ++it;
+                }
+            }
+
+            if(not sendQueue.empty())
+            {
+                mLimiter.acquire(sendQueue.size());
+                probe = mBreaker.startSend(Clock::now());
+            }
+
+            // another worker can start on what's left while this one sends
+            if(not mDispatchQueue.empty() or not mRetryQueue.empty())
+            {
+                mSendCv.notify_one();
+            }
+        }
+
+        if(sendQueue.empty())
+        {
+            // another worker was faster
+            continue;
+        }
+
+        LOG_DEBUG(Backend, "worker " << worker << " sending " << sendQueue.size()
+                           << " notifications");
+
+        if(mSpool)
+        {
+            // one sync for all notifications spooled since the last batch
+            mSpool->commit();
+        }
 
-                sendQueue.splice(sendQueue.end(), retryQueue);
+        Clock::time_point startTime {Clock::now()};
+
+        NotificationQueueT failed {send(sendQueue, worker)};
+
+        mSendDuration->observe(
+            std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - startTime)
+        );
+        mSentCounter->increment(sendQueue.size() - std::min(failed.size(), sendQueue.size()));
+
+        // mostly failed or slow batches mean the push service is struggling
+        bool healthy
+        {
+            failed.size() * 100 < sendQueue.size() * Parameters::MaxFailurePercent and
+            Clock::now() - startTime <= std::chrono::milliseconds(Parameters::MaxSendTime)
+        };
+
+        if(mSpool)
+        {
+            // everything but the failed notifications is done with
+            std::unordered_set<uint64_t> failedIds;
+
+            for(const PushNotification& n : failed)
+            {
+                failedIds.insert(n.spoolId);
             }
 
-            else
+            for(const PushNotification& n : sendQueue)
             {
-                mSendCv.wait(lk);
+                if(failedIds.count(n.spoolId) == 0)
+                {
+                    mSpool->remove(n.spoolId);
+                }
             }
         }
 
-        // DEBUG:
-        std::cout << "DEBUG: worker woke up!" << std::endl;
+        bool pending;
 
         {
             std::lock_guard<std::mutex> lk {mDispatchMutex};
 
-            sendQueue.splice(sendQueue.end(), mDispatchQueue);
+            CircuitBreaker::State state {mBreaker.getState()};
+
+            mLimiter.release(sendQueue.size(), healthy, startTime);
+            mBreaker.record(healthy, probe, Clock::now());
+
+            if(mBreaker.getState() != state)
+            {
+                if(mBreaker.getState() == CircuitBreaker::State::Open)
+                {
+                    LOG_WARNING(Backend, getTypeStr(type) << " backend " << host.full()
+                                         << ": circuit opened, concurrency limit "
+                                         << mLimiter.getLimit());
+                }
+
+                else if(mBreaker.getState() == CircuitBreaker::State::Closed)
+                {
+                    LOG_INFO(Backend, getTypeStr(type) << " backend " << host.full()
+                                      << ": circuit closed");
+                }
+            }
+
+            while(not failed.empty())
+            {
+                scheduleRetry(failed, failed.begin());
+            }
+
+            pending = not mDispatchQueue.empty() or not mRetryQueue.empty();
+        }
+
+        // workers may have waited for room under the limit or for the probe
+        if(pending)
+        {
+            mSendCv.notify_all();
         }
     }
+}
+
+void Backend::scheduleRetry(NotificationQueueT& failed, NotificationQueueT::iterator it)
+{
+    using Clock = std::chrono::steady_clock;
+
+    PushNotification& n = *it;
+    ++n.attempts;
+
+    std::chrono::milliseconds delay;
+
+    if(n.retryAfter > 0)
+    {
+        delay = std::chrono::seconds(n.retryAfter);
+        n.retryAfter = 0;
+    }
+
+    else
+    {
+        // exponential backoff, the jitter keeps notifications that failed
+        // together from being retried together
+        unsigned int maxDelay {Parameters::MaxRetryDelay};
+
+        if(n.attempts - 1 < 32 and
+           (Parameters::MaxRetryDelay >> (n.attempts - 1)) >= Parameters::MinRetryDelay)
+        {
+            maxDelay = Parameters::MinRetryDelay << (n.attempts - 1);
+        }
 
-    // TODO:
-    // save sendQueue to disk
+        delay =
+        std::chrono::milliseconds(mRNG.getRandomNumber(maxDelay / 2, maxDelay));
+    }
+
+    std::time_t expireTime {n.createdAt + Parameters::NotificationExpireTime};
+    std::time_t retryTime
+    {
+        std::time(nullptr) +
+        std::chrono::duration_cast<std::chrono::seconds>(delay).count()
+    };
+
+    if(n.attempts >= Parameters::MaxAttempts or retryTime > expireTime)
+    {
+        LOG_INFO(Backend, "dropping notification after " << n.attempts << " attempts");
+
+        if(mSpool)
+        {
+            mSpool->remove(n.spoolId);
+        }
+
+        mDropCounter->increment();
+        failed.erase(it);
+        return;
+    }
+
+    mRetryCounter->increment();
+
+    n.retryTime = Clock::now() + delay;
+    mRetryWheel.schedule(failed, it);
 }
 
+void Backend::spliceFront(NotificationQueueT& to,
+                          NotificationQueueT& from,
+                          std::size_t count)
+{
+    if(count >= from.size())
+    {
+        to.splice(to.end(), from);
+        return;
+    }
+
+    auto last = from.begin();
+    std::advance(last, count);
+
+    to.splice(to.end(), from, from.begin(), last);
+}
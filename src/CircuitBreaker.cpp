@@ -0,0 +1,126 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CircuitBreaker.hpp"
+
+#include <limits>
+#include <algorithm>
+
+using namespace Oshiya;
+
+const unsigned int CircuitBreaker::Parameters::FailureThreshold;
+const unsigned int CircuitBreaker::Parameters::MinOpenTime;
+const unsigned int CircuitBreaker::Parameters::MaxOpenTime;
+const std::size_t CircuitBreaker::Parameters::ProbeBatchSize;
+
+CircuitBreaker::CircuitBreaker()
+    :
+        mState {State::Closed},
+        mFailures {0},
+        mOpenTime {Parameters::MinOpenTime},
+        mProbing {false}
+{
+
+}
+
+bool CircuitBreaker::isSendAllowed(Clock::time_point now) const
+{
+    switch(mState)
+    {
+        case State::Closed:
+            return true;
+
+        case State::Open:
+            return now >= mProbeTime;
+
+        case State::HalfOpen:
+            // one probe at a time
+            return not mProbing;
+    }
+
+    return false;
+}
+
+std::size_t CircuitBreaker::getBatchLimit() const
+{
+    if(mState == State::Closed)
+    {
+        return std::numeric_limits<std::size_t>::max();
+    }
+
+    return Parameters::ProbeBatchSize;
+}
+
+bool CircuitBreaker::startSend(Clock::time_point now)
+{
+    if(mState == State::Open and now >= mProbeTime)
+    {
+        mState = State::HalfOpen;
+    }
+
+    if(mState == State::HalfOpen)
+    {
+        mProbing = true;
+        return true;
+    }
+
+    return false;
+}
+
+void CircuitBreaker::record(bool healthy, bool probe, Clock::time_point now)
+{
+    if(mState == State::Closed)
+    {
+        if(healthy)
+        {
+            mFailures = 0;
+        }
+
+        else if(++mFailures >= Parameters::FailureThreshold)
+        {
+            open(now);
+        }
+    }
+
+    // batches started before the circuit opened don't decide anything
+    else if(mState == State::HalfOpen and probe)
+    {
+        mProbing = false;
+
+        if(healthy)
+        {
+            mState = State::Closed;
+            mFailures = 0;
+            mOpenTime = std::chrono::milliseconds(Parameters::MinOpenTime);
+        }
+
+        else
+        {
+            mOpenTime =
+            std::min(2 * mOpenTime, std::chrono::milliseconds(Parameters::MaxOpenTime));
+
+            open(now);
+        }
+    }
+}
+
+void CircuitBreaker::open(Clock::time_point now)
+{
+    mState = State::Open;
+    mProbeTime = now + mOpenTime;
+}
@@ -17,11 +17,18 @@
  */
 
 #include <Component.hpp>
+#include "Logger.hpp"
 
 #include <functional>
+#include <system_error>
+#include <cerrno>
+#include <iterator>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
-// DEBUG:
-#include <iostream>
 #include <algorithm>
 #include <cstring>
 
@@ -30,24 +37,43 @@ using namespace Oshiya;
 Component::Component(const Config& config)
     :
         mConfig {config},
-        mLogger {xmpp_get_default_logger(XMPP_LEVEL_DEBUG)},
-        mContext {xmpp_ctx_new(nullptr, mLogger)},
+        mLogger {logHandler, nullptr},
+        mContext {xmpp_ctx_new(nullptr, &mLogger)},
         mConnection {xmpp_conn_new(mContext)},
-        mJid {makeJid(mConfig.value("host"))},
-        mServerJid {makeJid(mConfig.value("server_host"))},
+        mJid {Jid::intern(makeJid(mConfig.value("host")))},
+        mServerJid {Jid::intern(makeJid(mConfig.value("server_host")))},
         mPort {mConfig.value<unsigned short>("port")},
-        mPubsubJid {makeJid(mConfig.value("pubsub_host"))},
-        mStanzaDispatcher { },
-        mShutdown {false}
+        mPubsubJid {Jid::intern(makeJid(mConfig.value("pubsub_host")))},
+        mStanzaDispatcher {mJid.full(), mConfig.value<unsigned int>("dispatch_threads", 0)},
+        mShutdown {false},
+        mWakeupFd {eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
+        mEpollFd {epoll_create1(EPOLL_CLOEXEC)},
+        mPolledSock {-1},
+        mPolledEvents {0},
+        mOutPackets {Parameters::OutPacketQueueCapacity}
 {
+    if(mWakeupFd == -1 or mEpollFd == -1)
+    {
+        throw std::system_error {errno, std::generic_category(),
+                                 "could not set up the XMPP event loop"};
+    }
+
+    epoll_event wakeupEvent {};
+    wakeupEvent.events = EPOLLIN;
+    wakeupEvent.data.fd = mWakeupFd;
+
+    if(epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeupFd, &wakeupEvent) == -1)
+    {
+        throw std::system_error {errno, std::generic_category(),
+                                 "could not set up the XMPP event loop"};
+    }
+
     xmpp_initialize();
 
     const char* jid {mJid.full().c_str()};
     const char* password {config.value("password").c_str()};
 
-    // DEBUG:
-    std::cout << "setting component jid: " << jid << std::endl;
-    std::cout << "setting component password: " << password << std::endl;
+    LOG_DEBUG(Component, "setting component jid: " << jid);
 
     xmpp_conn_set_jid(mConnection, jid);
     xmpp_conn_set_pass(mConnection, password);
@@ -70,12 +96,28 @@ Component::Component(const Config& config)
     mStanzaDispatcher.addStanzaHandler<Type::Invalid>(
         std::bind(&Component::invalidStanzaReceived, this, _1)
     );
+
+    Metrics& metrics = Metrics::getRegistry();
+    Metrics::LabelsT labels {{"component", mJid.full()}};
+
+    metrics.addGauge("oshiya_out_queue_depth",
+                     "Stanzas waiting for the XMPP thread to send them.",
+                     labels,
+                     [this]() {return getOutQueueDepth();},
+                     this);
+
+    metrics.addGauge("oshiya_out_queue_high_watermark",
+                     "Most stanzas ever waiting to be sent at once.",
+                     labels,
+                     [this]() {return getOutQueueHighWatermark();},
+                     this);
 }
 
 Component::~Component()
 {
-    // DEBUG:
-    std::cout << "in Component dtor" << std::endl;
+    LOG_DEBUG(Component, "in Component dtor");
+
+    Metrics::getRegistry().removeGauges(this);
 
     if(mXmppThread.get_id() != std::thread::id {})
     {
@@ -87,24 +129,35 @@ Component::~Component()
     xmpp_ctx_free(mContext);
 
     xmpp_shutdown();
+
+    close(mEpollFd);
+    close(mWakeupFd);
 }
 
 void Component::connect()
 {
-    // DEBUG:
-    std::cout << "connnecting, host: " << mServerJid.full() << ", port: " << mPort << std::endl;
+    LOG_DEBUG(Component, "connnecting, host: " << mServerJid.full() << ", port: " << mPort);
 
     mXmppThread = std::thread {&Component::run, this}; 
 }
 
 void Component::sendPacket(std::unique_ptr<OutPacket>&& packet)
 {
-    std::lock_guard<std::mutex> lock {mOutPacketsMutex};
-    mOutPackets.emplace(std::forward<std::unique_ptr<OutPacket>>(packet));
+    // the queue is bounded, a full queue makes producers wait for the XMPP
+    // thread instead of dropping stanzas
+    while(not mOutPackets.tryPush(std::move(packet)))
+    {
+        notifyEventLoop();
+        std::this_thread::yield();
+    }
+
+    notifyEventLoop();
 }
 
 std::string Component::makeRandomString(std::size_t length)
 {
+    std::lock_guard<std::mutex> lk {mRNGMutex};
+
     return mRNG.getRandomText(length);
 }
 
@@ -116,6 +169,16 @@ Jid Component::makeJid(const std::string& str)
 void Component::shutdown()
 {
     mShutdown = true;
+
+    notifyEventLoop();
+
+    // no handler may run once the derived class starts tearing down
+    if(mXmppThread.joinable() and mXmppThread.get_id() != std::this_thread::get_id())
+    {
+        mXmppThread.join();
+    }
+
+    mStanzaDispatcher.stopWorkers();
 }
 
 void Component::run()
@@ -130,8 +193,7 @@ void Component::run()
 
         if(mContext->loop_status != XMPP_LOOP_NOTSTARTED)
         {
-            // DEBUG:
-            std::cout << "returning from Component::run" << std::endl;
+            LOG_DEBUG(Component, "returning from Component::run");
             return;
         }
 
@@ -139,18 +201,7 @@ void Component::run()
 
         while(mContext->loop_status == XMPP_LOOP_RUNNING)
         {
-            {
-                std::lock_guard<std::mutex> lock {mOutPacketsMutex};
-
-                while(not mOutPackets.empty())
-                {
-                    XmlElement stanza
-                    {mOutPackets.front().get()->makeXmlElement(mContext)};
-
-                    mOutPackets.pop();
-                    xmpp_send(mConnection, stanza.getStanzaPtr());
-                }
-            }
+            sendOutPackets();
 
             if(mShutdown)
             {
@@ -158,17 +209,140 @@ void Component::run()
                 return;
             }
 
-            xmpp_run_once(mContext, Parameters::StropheLoopTimeout);
+            // a zero timeout only flushes strophe's send queue and processes
+            // what is already readable, the actual waiting happens below
+            xmpp_run_once(mContext, 0);
+
+            if(mContext->loop_status == XMPP_LOOP_RUNNING)
+            {
+                waitForEvents();
+            }
         }
 
         mContext->loop_status = XMPP_LOOP_NOTSTARTED;
 
+        // the socket is gone, the next connection gets registered anew
+        mPolledSock = -1;
+        mPolledEvents = 0;
+
         std::this_thread::sleep_for(
             std::chrono::milliseconds(Parameters::ReconnectInterval)
         );
     }
 }
 
+void Component::sendOutPackets()
+{
+    std::vector<std::unique_ptr<OutPacket>> batch;
+    batch.reserve(Parameters::OutPacketBatchSize);
+
+    mOutPackets.popBatch(std::back_inserter(batch), Parameters::OutPacketBatchSize);
+
+    for(const auto& packet : batch)
+    {
+        XmlElement stanza {packet->makeXmlElement(mContext)};
+
+        xmpp_send(mConnection, stanza.getStanzaPtr());
+    }
+
+    // don't let a long queue starve incoming stanzas, the rest goes out in
+    // the next loop iteration
+    if(mOutPackets.size() > 0)
+    {
+        notifyEventLoop();
+    }
+}
+
+void Component::waitForEvents()
+{
+    sock_t sock {mConnection->sock};
+
+    if(sock >= 0)
+    {
+        uint32_t events {EPOLLIN};
+
+        // wait for writability while connecting or while strophe could not
+        // flush everything in one go
+        if(mConnection->state == XMPP_STATE_CONNECTING or
+           mConnection->send_queue_len > 0)
+        {
+            events |= EPOLLOUT;
+        }
+
+        if(sock != mPolledSock or events != mPolledEvents)
+        {
+            epoll_event sockEvent {};
+            sockEvent.events = events;
+            sockEvent.data.fd = sock;
+
+            int result {epoll_ctl(mEpollFd, EPOLL_CTL_ADD, sock, &sockEvent)};
+
+            if(result == -1 and errno == EEXIST)
+            {
+                result = epoll_ctl(mEpollFd, EPOLL_CTL_MOD, sock, &sockEvent);
+            }
+
+            if(result == -1)
+            {
+                LOG_ERROR(Component, "could not poll strophe socket");
+            }
+
+            else
+            {
+                mPolledSock = sock;
+                mPolledEvents = events;
+            }
+        }
+    }
+
+    epoll_event ready[2];
+
+    int readyCount
+    {epoll_wait(mEpollFd, ready, 2, Parameters::MaxEventWait)};
+
+    for(int i {0}; i < readyCount; ++i)
+    {
+        if(ready[i].data.fd == mWakeupFd)
+        {
+            uint64_t counter;
+
+            if(read(mWakeupFd, &counter, sizeof counter) == -1 and errno != EAGAIN)
+            {
+                LOG_ERROR(Component, "could not read wakeup descriptor");
+            }
+        }
+    }
+}
+
+void Component::notifyEventLoop()
+{
+    uint64_t one {1};
+
+    if(write(mWakeupFd, &one, sizeof one) == -1 and errno != EAGAIN)
+    {
+        LOG_ERROR(Component, "could not signal XMPP thread");
+    }
+}
+
+void Component::logHandler(void* const,
+                           const xmpp_log_level_t level,
+                           const char* const area,
+                           const char* const msg)
+{
+    Logger::Level logLevel {Logger::Level::Debug};
+
+    if(level == XMPP_LEVEL_INFO) {logLevel = Logger::Level::Info;}
+    if(level == XMPP_LEVEL_WARN) {logLevel = Logger::Level::Warning;}
+    if(level == XMPP_LEVEL_ERROR) {logLevel = Logger::Level::Error;}
+
+    Logger& logger = Logger::getInstance();
+
+    if(logger.isEnabled(Logger::Module::Xmpp, logLevel))
+    {
+        logger.log(Logger::Module::Xmpp, logLevel, std::string {area} + ": " + msg);
+    }
+}
+
 void Component::connHandler(xmpp_conn_t* const conn,
                             const xmpp_conn_event_t status,
                             const int error,
@@ -179,8 +353,7 @@ void Component::connHandler(xmpp_conn_t* const conn,
 
     if(status == XMPP_CONN_CONNECT)
     {
-        // DEBUG:
-        std::cout << "Component::connHandler: component connected!" << std::endl;
+        LOG_DEBUG(Component, "Component::connHandler: component connected!");
 
         xmpp_handler_add(conn,
                          handleIq,
@@ -198,8 +371,7 @@ void Component::connHandler(xmpp_conn_t* const conn,
     }
     else
     {
-        // DEBUG:
-        std::cout << "Component::connHandler: component disconnected!" << std::endl;
+        LOG_DEBUG(Component, "Component::connHandler: component disconnected!");
         conn->error = 0; // in order to reconnect we need to reset the error flag
         xmpp_stop(comp->mContext);
     }
@@ -0,0 +1,62 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ConcurrencyLimiter.hpp"
+
+#include <algorithm>
+
+using namespace Oshiya;
+
+const std::size_t ConcurrencyLimiter::Parameters::MinLimit;
+
+ConcurrencyLimiter::ConcurrencyLimiter(std::size_t maxLimit)
+    :
+        mMaxLimit {std::max(maxLimit, Parameters::MinLimit)},
+        mLimit {mMaxLimit},
+        mInFlight {0}
+{
+
+}
+
+std::size_t ConcurrencyLimiter::getAvailable() const
+{
+    return mInFlight < mLimit ? mLimit - mInFlight : 0;
+}
+
+void ConcurrencyLimiter::acquire(std::size_t count)
+{
+    mInFlight += count;
+}
+
+void ConcurrencyLimiter::release(std::size_t count,
+                                 bool healthy,
+                                 Clock::time_point startTime)
+{
+    mInFlight -= std::min(count, mInFlight);
+
+    if(healthy)
+    {
+        mLimit = std::min(mLimit + 1, mMaxLimit);
+    }
+
+    else if(startTime >= mDecreaseTime)
+    {
+        mLimit = std::max(mLimit / 2, Parameters::MinLimit);
+        mDecreaseTime = Clock::now();
+    }
+}
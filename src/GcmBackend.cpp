@@ -17,168 +17,173 @@
  */
 
 #include "GcmBackend.hpp"
+#include "Logger.hpp"
 
 #include "SmartPointerUtil.hpp"
-#include "curl_header.h"
+
 #include <cstring>
+#include <algorithm>
+#include <iterator>
 
 using namespace Oshiya;
 
+const unsigned int GcmBackend::GcmParameters::MaxPayloadSize;
+const std::size_t GcmBackend::GcmParameters::MaxMulticastSize;
+
 GcmBackend::GcmBackend(const Jid& host,
                    const std::string& appName,
                    const std::string& certFile,
-                   const std::string& authKey)
+                   const std::string& authKey,
+                   const Options& options)
     :
         Backend(Backend::Type::Gcm,
                 host,
                 appName,
-                certFile),
-        mAuthKey {authKey}
+                certFile,
+                options),
+        mAuthKey {authKey},
+        mHeaders {nullptr}
 {
-    startWorker();
+    mHeaders = curl_slist_append(mHeaders, "Content-Type:application/json");
+    mHeaders = curl_slist_append(mHeaders, ("Authorization:key=" + mAuthKey).c_str());
+
+    for(std::size_t i {0}; i < options.workers; ++i)
+    {
+        mClients.push_back(
+            make_unique<HttpClient>(certFile, options.concurrentRequests)
+        );
+    }
+
+    startWorkers();
 }
 
 GcmBackend::~GcmBackend()
 {
+    stopWorkers();
 
+    curl_slist_free_all(mHeaders);
 }
 
-Backend::NotificationQueueT GcmBackend::send(const NotificationQueueT& notifications)
+Backend::NotificationQueueT GcmBackend::send(const NotificationQueueT& notifications,
+                                             std::size_t worker)
 {
-    // DEBUG:
-    std::cout << "DEBUG: in GcmBackend::send" << std::endl;
+    LOG_DEBUG(Backend, "in GcmBackend::send");
 
     NotificationQueueT retryQueue;
 
-    for(auto it = notifications.cbegin(); it != notifications.cend(); ++it)
+    // notifications with equal payloads are sent as one multicast request
+    std::map<PayloadT, RecipientsT> groups;
+
+    for(const PushNotification& n : notifications)
     {
-        const PushNotification& n {*it};
+        groups[n.payload].push_back(&n);
+    }
 
-        std::string payload {makePayload(n.token, n.payload)};
+    // requests are multiplexed over the connection the client keeps open
+    std::vector<RecipientsT> recipientLists;
+    std::vector<HttpClient::Request> requests;
 
-        if(payload.size() > GcmParameters::MaxPayloadSize)
+    for(const auto& g : groups)
+    {
+        const RecipientsT& group = g.second;
+
+        for(std::size_t first {0}; first < group.size();
+            first += GcmParameters::MaxMulticastSize)
         {
-            payload = makePayload(n.token, {});
+            recipientLists.emplace_back
+            (
+                group.begin() + first,
+                group.begin() +
+                std::min(first + GcmParameters::MaxMulticastSize, group.size())
+            );
+
+            requests.emplace_back(options.url.empty() ?
+                                  "https://gcm-http.googleapis.com/gcm/send" :
+                                  options.url,
+                                  mHeaders,
+                                  makePayload(recipientLists.back(), g.first),
+                                  recipientLists.size() - 1);
         }
+    }
 
-        std::string responseBody;
-    
-        curl_header header;
-        header.add("Content-Type:application/json");
-        header.add("Authorization:key=" + mAuthKey);
-
-        mCurl.add(
-            curl_pair<CURLoption, curl_header>
-            {CURLOPT_HTTPHEADER, header}
-        );
-
-        mCurl.add(
-            curl_pair<CURLoption, std::string>
-            {CURLOPT_URL, "https://gcm-http.googleapis.com/gcm/send"}
-        );
-
-        mCurl.add(
-            curl_pair<CURLoption, std::string>
-            {CURLOPT_SSLCERT, certFile}
-        );
-
-        mCurl.add(
-            curl_pair<CURLoption, std::string>
-            {CURLOPT_SSLKEY, certFile}
-        );
-
-        mCurl.add(
-            curl_pair<CURLoption, bool>
-            {CURLOPT_SSL_VERIFYPEER, true}
-        );
-
-        mCurl.add(
-            curl_pair<CURLoption, std::string>
-            {CURLOPT_POSTFIELDS, payload}
-        );
+    mClients[worker]->perform(
+        requests,
+        [this, &recipientLists, &retryQueue](HttpClient::Request& request)
+        {completeRequest(request, recipientLists[request.tag], retryQueue);}
+    );
 
-        mCurl.add(
-            curl_pair<CURLoption, void*>
-            {CURLOPT_WRITEDATA, &responseBody}
-        );
+    return retryQueue;
+}
 
-        mCurl.add(
-            curl_pair<CURLoption, decltype(&GcmBackend::bodyWriteCb)>
-            {CURLOPT_WRITEFUNCTION, bodyWriteCb}
-        );
+void GcmBackend::completeRequest(const HttpClient::Request& request,
+                                 const RecipientsT& recipients,
+                                 NotificationQueueT& retryQueue)
+{
+    // the notifications to retry because of this request follow this one
+    auto last = retryQueue.empty() ? retryQueue.end() : std::prev(retryQueue.end());
 
-        try
+    if(request.result != CURLE_OK)
+    {
+        // connection error
+        for(const PushNotification* n : recipients)
         {
-            mCurl.perform();
-            
-            std::unique_ptr<long> responseCode
-            {mCurl.get_info<long>(CURLINFO_RESPONSE_CODE)};
-
-            if(responseCode.get() == nullptr)
-            {
-                // connection error
-                retryQueue.insert(retryQueue.end(), it, notifications.cend());
-            }
-
-            else if(*responseCode == 200)
-            {
-                bool retry {processSuccessResponse(responseBody, n)};
-
-                if(retry)
-                {
-                    retryQueue.push_back(n);
-                }
-            }
+            retryQueue.push_back(*n);
+        }
+    }
 
-            else if(*responseCode >= 500 and *responseCode < 600)
-            {
-                // recoverable error
-                retryQueue.push_back(n);
-            }
+    else if(request.responseCode == 200)
+    {
+        processSuccessResponse(request.responseBody, recipients, retryQueue);
+    }
 
-            else
-            {
-                // non-recoverable error
-                n.unregisterCb();
-            }
+    else if((request.responseCode >= 500 and request.responseCode < 600) or
+            request.responseCode == 401)
+    {
+        // recoverable error, or a rejected auth_key the retries give time to
+        // fix. Either way the devices are not at fault.
+        if(request.responseCode == 401)
+        {
+            LOG_ERROR(Backend, "GCM rejected the auth_key");
         }
 
-        catch(curl_easy_exception error)
+        for(const PushNotification* n : recipients)
         {
-            // DEBUG:
-            std::cout << "DEBUG: curl exception!" << std::endl;
-            error.print_traceback(); 
-
-            // connection error
-            retryQueue.insert(retryQueue.end(), it, notifications.cend());
+            retryQueue.push_back(*n);
         }
+    }
 
-        mCurl.reset();
+    else
+    {
+        // the request is at fault rather than the devices, dropped
+        LOG_ERROR(Backend, "GCM rejected request with status "
+                           << request.responseCode << ", dropping "
+                           << recipients.size() << " notifications");
     }
 
-    return retryQueue;
+    // GCM may ask for a delay on 5xx as well as on 200 with Unavailable
+    if(request.result == CURLE_OK and request.retryAfter > 0)
+    {
+        for(auto it = last == retryQueue.end() ? retryQueue.begin() : std::next(last);
+            it != retryQueue.end();
+            ++it)
+        {
+            it->retryAfter = request.retryAfter;
+        }
+    }
 }
 
-std::size_t GcmBackend::bodyWriteCb(char* ptr,
-                                    std::size_t size,
-                                    std::size_t nmemb,
-                                    void* userdata)
+void GcmBackend::processSuccessResponse(const std::string& responseBody,
+                                        const RecipientsT& recipients,
+                                        NotificationQueueT& retryQueue)
 {
-    std::string& bodyStr = *static_cast<std::string*>(userdata);
-
-    std::size_t newDataLength {size * nmemb};
-    std::size_t existingLength {bodyStr.size()};
-
-    bodyStr.resize(existingLength + newDataLength);
-
-    memcpy(&bodyStr[existingLength], ptr, newDataLength);
-
-    return bodyStr.size();
-}
+    // GCM accepted the request, retrying might deliver twice
+    auto dropAll =
+    [&recipients]()
+    {
+        LOG_ERROR(Backend, "invalid GCM response, dropping "
+                           << recipients.size() << " notifications");
+    };
 
-bool GcmBackend::processSuccessResponse(const std::string& responseBody,
-                                   const PushNotification& notification)
-{
     Json::Value root;
     Json::Reader reader;
 
@@ -186,9 +191,8 @@ bool GcmBackend::processSuccessResponse(const std::string& responseBody,
 
     if(not success)
     {
-        // invalid response, treating as non-recoverable error
-        notification.unregisterCb();
-        return false;
+        dropAll();
+        return;
     }
 
     int failure {root.get("failure", -1).asInt()};
@@ -196,41 +200,61 @@ bool GcmBackend::processSuccessResponse(const std::string& responseBody,
     if(failure == 0)
     {
         // success
-        return false;
+        return;
     }
 
     if(failure < 0)
     {
-        // invalid response, treating as non-recoverable error
-        notification.unregisterCb();
-        return false;
+        dropAll();
+        return;
     }
 
     Json::Value results {root["results"]};
 
-    if(not results.isArray())
+    if(not results.isArray() or results.size() != recipients.size())
     {
-        // invalid response, treating as non-recoverable error
-        notification.unregisterCb();
-        return false;
+        dropAll();
+        return;
     }
 
-    std::string error {results.get("error", "").asString()};
-
-    if(error == "Unavailable" or error == "InternalServerError")
+    // results are in the order of the request's registration ids
+    for(Json::ArrayIndex i {0}; i < results.size(); ++i)
     {
-        // recoverable error, retry
-        return true;
-    }
+        const PushNotification& n = *recipients[i];
+
+        std::string error {results[i].get("error", "").asString()};
+
+        if(error.empty())
+        {
+            // success
+            continue;
+        }
+
+        if(error == "Unavailable" or error == "InternalServerError")
+        {
+            // recoverable error, retry
+            retryQueue.push_back(n);
+        }
+
+        else if(error == "NotRegistered" or error == "InvalidRegistration")
+        {
+            // the registration id is no longer valid
+            n.unregisterCb();
+        }
 
-    // non-recoverable error
-    notification.unregisterCb();
-    return false;
+        else
+        {
+            // e.g. MismatchSenderId or MessageTooBig, not the device's fault
+            LOG_WARNING(Backend, "GCM rejected notification: " << error);
+        }
+    }
 }
 
-std::string GcmBackend::makePayload(const std::string& token,
+std::string GcmBackend::makePayload(const RecipientsT& recipients,
                                     const PayloadT& payload)
 {
+    // writers keep state, so every call (and worker) gets its own
+    Json::StyledWriter writer;
     Json::Value jsonPayload {Json::objectValue};
     Json::Value data {Json::objectValue};
 
@@ -258,9 +282,31 @@ std::string GcmBackend::makePayload(const std::string& token,
         }
     }
 
-    jsonPayload["to"] = token;
+    // the limit applies to the data, not to the list of recipients
+    if(writer.write(data).size() > GcmParameters::MaxPayloadSize)
+    {
+        data = Json::Value {Json::objectValue};
+    }
+
+    if(recipients.size() == 1)
+    {
+        jsonPayload["to"] = recipients.front()->token;
+    }
+
+    else
+    {
+        Json::Value registrationIds {Json::arrayValue};
+
+        for(const PushNotification* n : recipients)
+        {
+            registrationIds.append(n->token);
+        }
+
+        jsonPayload["registration_ids"] = registrationIds;
+    }
+
     jsonPayload["expiry_time"] = Parameters::NotificationExpireTime;
     jsonPayload["data"] = data;
 
-    return mWriter.write(jsonPayload); 
+    return writer.write(jsonPayload); 
 }
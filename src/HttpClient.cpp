@@ -0,0 +1,212 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ *
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "HttpClient.hpp"
+#include "Logger.hpp"
+#include "Backend.hpp"
+
+
+using namespace Oshiya;
+
+HttpClient::HttpClient(const std::string& certFile, std::size_t maxConcurrentRequests)
+    :
+        mCertFile {certFile},
+        mMaxConcurrentRequests {maxConcurrentRequests > 0 ? maxConcurrentRequests : 1},
+        mMulti {curl_multi_init()}
+{
+    curl_multi_setopt(mMulti, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+}
+
+HttpClient::~HttpClient()
+{
+    for(CURL* handle : mIdleHandles)
+    {
+        curl_easy_cleanup(handle);
+    }
+
+    curl_multi_cleanup(mMulti);
+}
+
+void HttpClient::perform(std::vector<Request>& requests,
+                         const CompletionCbT& completionCb)
+{
+    std::vector<Request>::iterator next {requests.begin()};
+    std::size_t inFlight {0};
+
+    while(next != requests.end() or inFlight > 0)
+    {
+        while(next != requests.end() and inFlight < mMaxConcurrentRequests)
+        {
+            if(start(*next))
+            {
+                ++inFlight;
+            }
+
+            else
+            {
+                next->result = CURLE_FAILED_INIT;
+                completionCb(*next);
+            }
+
+            ++next;
+        }
+
+        int running;
+        curl_multi_perform(mMulti, &running);
+
+        CURLMsg* msg;
+        int queued;
+
+        while((msg = curl_multi_info_read(mMulti, &queued)) != nullptr)
+        {
+            if(msg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+
+            char* privateData;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &privateData);
+            Request& request = *reinterpret_cast<Request*>(privateData);
+
+            request.result = msg->data.result;
+            curl_easy_getinfo(request.mHandle,
+                              CURLINFO_RESPONSE_CODE,
+                              &request.responseCode);
+
+            curl_off_t retryAfter {0};
+            curl_easy_getinfo(request.mHandle, CURLINFO_RETRY_AFTER, &retryAfter);
+            request.retryAfter = static_cast<long>(retryAfter);
+
+            releaseHandle(request.mHandle);
+            request.mHandle = nullptr;
+            --inFlight;
+
+            if(request.result != CURLE_OK)
+            {
+                LOG_DEBUG(Http, "curl error: "
+                                << curl_easy_strerror(request.result));
+            }
+
+            completionCb(request);
+        }
+
+        // don't block if completed requests made room for new ones
+        if(inFlight > 0 and
+           (next == requests.end() or inFlight >= mMaxConcurrentRequests))
+        {
+            curl_multi_wait(mMulti,
+                            nullptr,
+                            0,
+                            Backend::Parameters::HttpTimeout,
+                            nullptr);
+        }
+    }
+}
+
+bool HttpClient::start(Request& request)
+{
+    request.mHandle = acquireHandle();
+
+    if(request.mHandle == nullptr)
+    {
+        return false;
+    }
+
+    curl_easy_setopt(request.mHandle, CURLOPT_URL, request.url.c_str());
+    curl_easy_setopt(request.mHandle, CURLOPT_HTTPHEADER, request.headers);
+    curl_easy_setopt(request.mHandle, CURLOPT_POSTFIELDSIZE,
+                     static_cast<long>(request.body.size()));
+    curl_easy_setopt(request.mHandle, CURLOPT_POSTFIELDS, request.body.c_str());
+    curl_easy_setopt(request.mHandle, CURLOPT_WRITEDATA, &request.responseBody);
+    curl_easy_setopt(request.mHandle, CURLOPT_PRIVATE, &request);
+
+    if(curl_multi_add_handle(mMulti, request.mHandle) != CURLM_OK)
+    {
+        mIdleHandles.push_back(request.mHandle);
+        request.mHandle = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+CURL* HttpClient::acquireHandle()
+{
+    if(not mIdleHandles.empty())
+    {
+        CURL* handle {mIdleHandles.back()};
+        mIdleHandles.pop_back();
+        return handle;
+    }
+
+    CURL* handle {curl_easy_init()};
+
+    if(handle == nullptr)
+    {
+        LOG_ERROR(Http, "could not create curl handle");
+        return nullptr;
+    }
+
+    // options shared by all requests, start() sets the rest
+    if(not mCertFile.empty())
+    {
+        curl_easy_setopt(handle, CURLOPT_SSLCERT, mCertFile.c_str());
+        curl_easy_setopt(handle, CURLOPT_SSLKEY, mCertFile.c_str());
+    }
+
+    curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    // wait for the connection to be multiplexable rather than opening another
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    // the kernel probes idle connections, nothing has to call into curl
+    // between batches for that
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE,
+                     static_cast<long>(Backend::Parameters::KeepAliveInterval / 1000));
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL,
+                     static_cast<long>(Backend::Parameters::KeepAliveInterval / 1000));
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS,
+                     static_cast<long>(Backend::Parameters::HttpTimeout));
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS,
+                     static_cast<long>(Backend::Parameters::ConnectTimeout));
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, bodyWriteCb);
+
+    return handle;
+}
+
+void HttpClient::releaseHandle(CURL* handle)
+{
+    curl_multi_remove_handle(mMulti, handle);
+    mIdleHandles.push_back(handle);
+}
+
+std::size_t HttpClient::bodyWriteCb(char* ptr,
+                                    std::size_t size,
+                                    std::size_t nmemb,
+                                    void* userdata)
+{
+    std::string& bodyStr = *static_cast<std::string*>(userdata);
+
+    std::size_t newDataLength {size * nmemb};
+
+    bodyStr.append(ptr, newDataLength);
+
+    // curl treats anything but the number of bytes passed as an error
+    return newDataLength;
+}
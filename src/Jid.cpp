@@ -0,0 +1,138 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Jid.hpp"
+
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+
+using namespace Oshiya;
+
+namespace
+{
+    /**
+     * the interned representations by hash. Entries expire with the last Jid
+     * referring to them and are swept out once the pool has doubled.
+     */
+    template <typename DataT>
+    struct InternPool
+    {
+        static const std::size_t MinSweepSize {1024};
+
+        std::mutex mutex;
+        std::unordered_multimap<std::size_t, std::weak_ptr<const DataT>> entries;
+        std::size_t sweepSize {MinSweepSize};
+
+        void sweep()
+        {
+            for(auto it = entries.begin(); it != entries.end(); )
+            {
+                it = it->second.expired() ? entries.erase(it) : std::next(it);
+            }
+
+            sweepSize = 2 * entries.size();
+
+            if(sweepSize < MinSweepSize)
+            {
+                sweepSize = MinSweepSize;
+            }
+        }
+    };
+}
+
+Jid::Jid()
+{
+    static const std::shared_ptr<const Data> empty
+    {std::make_shared<Data>(Data {"", "", 0, 0, false, std::hash<std::string> {} (""),
+                                  std::hash<std::string> {} (""), false})};
+
+    mData = empty;
+}
+
+Jid::Jid(const std::string& user,
+         const std::string& server,
+         const std::string& resource)
+{
+    std::shared_ptr<Data> data {std::make_shared<Data>()};
+
+    data->full.reserve(user.size() + server.size() + resource.size() + 2);
+
+    if(not user.empty())
+    {
+        data->full.append(user);
+        data->full.push_back('@');
+    }
+
+    data->userLength = user.size();
+    data->serverOffset = data->full.size();
+    data->full.append(server);
+    data->hasResource = not resource.empty();
+
+    if(data->hasResource)
+    {
+        data->bare = data->full;
+        data->full.push_back('/');
+        data->full.append(resource);
+    }
+
+    std::hash<std::string> hash;
+
+    data->hash = hash(data->full);
+    data->bareHash = data->hasResource ? hash(data->bare) : data->hash;
+    data->interned = false;
+
+    mData = std::move(data);
+}
+
+Jid Jid::intern(const Jid& jid)
+{
+    static InternPool<Data> pool;
+
+    if(jid.isInterned())
+    {
+        return jid;
+    }
+
+    std::lock_guard<std::mutex> lk {pool.mutex};
+
+    auto range = pool.entries.equal_range(jid.hash());
+
+    for(auto it = range.first; it != range.second; ++it)
+    {
+        std::shared_ptr<const Data> data {it->second.lock()};
+
+        if(data and data->full == jid.full())
+        {
+            return Jid {std::move(data)};
+        }
+    }
+
+    std::shared_ptr<Data> data {std::make_shared<Data>(*jid.mData)};
+    data->interned = true;
+
+    pool.entries.emplace(data->hash, data);
+
+    if(pool.entries.size() >= pool.sweepSize)
+    {
+        pool.sweep();
+    }
+
+    return Jid {std::move(data)};
+}
@@ -0,0 +1,261 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Logger.hpp"
+
+#include <cstdio>
+#include <ctime>
+
+using namespace Oshiya;
+
+const std::size_t Logger::Parameters::QueueCapacity;
+const unsigned int Logger::Parameters::FlushInterval;
+const Logger::Level Logger::Parameters::DefaultLevel;
+
+namespace
+{
+    const char* const ModuleNames[]
+    {
+        "main",
+        "component",
+        "stanza",
+        "app_server",
+        "storage",
+        "backend",
+        "http",
+        "metrics",
+        "xmpp"
+    };
+
+    const char* const LevelNames[]
+    {
+        "debug",
+        "info",
+        "warning",
+        "error",
+        "off"
+    };
+}
+
+Logger& Logger::getInstance()
+{
+    static Logger logger;
+
+    return logger;
+}
+
+Logger::Logger()
+    :
+        mRecords {Parameters::QueueCapacity},
+        mDropped {0},
+        mShutdown {false},
+        mWaiting {false}
+{
+    for(auto& level : mLevels)
+    {
+        level.store(Parameters::DefaultLevel, std::memory_order_relaxed);
+    }
+
+    mThread = std::thread {&Logger::run, this};
+}
+
+Logger::~Logger()
+{
+    {
+        std::lock_guard<std::mutex> lk {mMutex};
+        mShutdown = true;
+    }
+
+    mCv.notify_one();
+
+    if(mThread.joinable())
+    {
+        mThread.join();
+    }
+}
+
+void Logger::setLevel(Level level)
+{
+    for(auto& l : mLevels)
+    {
+        l.store(level, std::memory_order_relaxed);
+    }
+}
+
+void Logger::setLevel(Module module, Level level)
+{
+    mLevels[static_cast<std::size_t>(module)].store(level, std::memory_order_relaxed);
+}
+
+void Logger::log(Module module, Level level, std::string&& message)
+{
+    Record record {std::chrono::system_clock::now(), module, level, std::move(message)};
+
+    if(not mRecords.tryPush(std::move(record)))
+    {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // the writer wakes up by itself after FlushInterval, errors shouldn't wait
+    if(level >= Level::Error or mWaiting.load(std::memory_order_relaxed))
+    {
+        mCv.notify_one();
+    }
+}
+
+bool Logger::parseLevel(const std::string& str, Level& level)
+{
+    for(unsigned int i {0}; i <= static_cast<unsigned int>(Level::Off); ++i)
+    {
+        if(str == LevelNames[i])
+        {
+            level = static_cast<Level>(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool Logger::parseModule(const std::string& str, Module& module)
+{
+    for(std::size_t i {0}; i < static_cast<std::size_t>(Module::Count); ++i)
+    {
+        if(str == ModuleNames[i])
+        {
+            module = static_cast<Module>(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char* Logger::getLevelStr(Level level)
+{
+    return LevelNames[static_cast<unsigned int>(level)];
+}
+
+const char* Logger::getModuleStr(Module module)
+{
+    return ModuleNames[static_cast<std::size_t>(module)];
+}
+
+void Logger::run()
+{
+    std::string out;
+    Record record;
+
+    while(true)
+    {
+        bool shutdown;
+
+        {
+            std::unique_lock<std::mutex> lk {mMutex};
+
+            mWaiting.store(true, std::memory_order_relaxed);
+
+            mCv.wait_for(
+                lk,
+                std::chrono::milliseconds(Parameters::FlushInterval),
+                [this]() {return mShutdown or mRecords.size() > 0;}
+            );
+
+            mWaiting.store(false, std::memory_order_relaxed);
+            shutdown = mShutdown;
+        }
+
+        while(mRecords.tryPop(record))
+        {
+            write(record, out);
+        }
+
+        uint64_t dropped {mDropped.exchange(0, std::memory_order_relaxed)};
+
+        if(dropped > 0)
+        {
+            write(Record {std::chrono::system_clock::now(),
+                          Module::Main,
+                          Level::Warning,
+                          "dropped " + std::to_string(dropped) + " log records"},
+                  out);
+        }
+
+        if(not out.empty())
+        {
+            std::fwrite(out.data(), 1, out.size(), stdout);
+            std::fflush(stdout);
+            out.clear();
+        }
+
+        if(shutdown)
+        {
+            return;
+        }
+    }
+}
+
+void Logger::write(const Record& record, std::string& out)
+{
+    using namespace std::chrono;
+
+    std::time_t seconds {system_clock::to_time_t(record.time)};
+    long millis
+    {
+        static_cast<long>(
+            duration_cast<milliseconds>(record.time.time_since_epoch()).count() % 1000
+        )
+    };
+
+    std::tm tm;
+    gmtime_r(&seconds, &tm);
+
+    char time[32];
+    std::size_t length {std::strftime(time, sizeof time, "%Y-%m-%dT%H:%M:%S", &tm)};
+    std::snprintf(time + length, sizeof time - length, ".%03ldZ", millis);
+
+    out += "time=";
+    out += time;
+    out += " level=";
+    out += getLevelStr(record.level);
+    out += " module=";
+    out += getModuleStr(record.module);
+    out += " msg=\"";
+
+    for(char c : record.message)
+    {
+        if(c == '"' or c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+
+        else if(c == '\n')
+        {
+            out += "\\n";
+        }
+
+        else
+        {
+            out += c;
+        }
+    }
+
+    out += "\"\n";
+}
@@ -0,0 +1,333 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Metrics.hpp"
+
+#include <limits>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+
+using namespace Oshiya;
+
+const unsigned int Metrics::Histogram::SubBucketBits;
+const std::size_t Metrics::Histogram::SubBucketCount;
+const std::size_t Metrics::Histogram::BucketCount;
+
+namespace
+{
+    // upper bounds (s) exposed as the histograms' "le" buckets
+    const double HistogramBounds[]
+    {
+        0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5,
+        1, 2.5, 5, 10, 30, 60
+    };
+}
+
+Metrics::Histogram::Histogram()
+    :
+        mCount {0},
+        mSum {0}
+{
+    for(auto& bucket : mBuckets)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Metrics::Histogram::observe(std::chrono::microseconds duration)
+{
+    uint64_t value {duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0};
+
+    mBuckets[getBucket(value)].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t Metrics::Histogram::getCount(uint64_t upperBound) const
+{
+    uint64_t count {0};
+
+    for(std::size_t i {0}; i < BucketCount and getBucketEnd(i) - 1 <= upperBound; ++i)
+    {
+        count += mBuckets[i].load(std::memory_order_relaxed);
+    }
+
+    return count;
+}
+
+std::size_t Metrics::Histogram::getBucket(uint64_t value)
+{
+    // values below 2 * SubBucketCount get a bucket of their own
+    if(value < 2 * SubBucketCount)
+    {
+        return value;
+    }
+
+    unsigned int msb {63u - static_cast<unsigned int>(__builtin_clzll(value))};
+    unsigned int shift {msb - SubBucketBits};
+
+    // the mantissa is in [SubBucketCount, 2 * SubBucketCount)
+    return shift * SubBucketCount + (value >> shift);
+}
+
+uint64_t Metrics::Histogram::getBucketEnd(std::size_t index)
+{
+    if(index < 2 * SubBucketCount)
+    {
+        return index + 1;
+    }
+
+    unsigned int shift {static_cast<unsigned int>(index / SubBucketCount - 1)};
+    uint64_t mantissa {index % SubBucketCount + SubBucketCount};
+
+    if(mantissa + 1 > (std::numeric_limits<uint64_t>::max() >> shift))
+    {
+        return std::numeric_limits<uint64_t>::max();
+    }
+
+    return (mantissa + 1) << shift;
+}
+
+Metrics& Metrics::getRegistry()
+{
+    static Metrics registry;
+
+    return registry;
+}
+
+Metrics::Counter& Metrics::getCounter(const std::string& name,
+                                      const std::string& help,
+                                      const LabelsT& labels)
+{
+    std::lock_guard<std::mutex> lk {mMutex};
+
+    std::unique_ptr<Counter>& counter = getFamily(name, help, Kind::Counter).counters[labels];
+
+    if(not counter)
+    {
+        counter.reset(new Counter);
+    }
+
+    return *counter;
+}
+
+Metrics::Histogram& Metrics::getHistogram(const std::string& name,
+                                          const std::string& help,
+                                          const LabelsT& labels)
+{
+    std::lock_guard<std::mutex> lk {mMutex};
+
+    std::unique_ptr<Histogram>& histogram =
+    getFamily(name, help, Kind::Histogram).histograms[labels];
+
+    if(not histogram)
+    {
+        histogram.reset(new Histogram);
+    }
+
+    return *histogram;
+}
+
+void Metrics::addGauge(const std::string& name,
+                       const std::string& help,
+                       const LabelsT& labels,
+                       const GaugeFnT& fn,
+                       const void* owner)
+{
+    std::lock_guard<std::mutex> lk {mMutex};
+
+    getFamily(name, help, Kind::Gauge).gauges[labels] = Gauge {fn, owner};
+}
+
+void Metrics::removeGauges(const void* owner)
+{
+    std::lock_guard<std::mutex> lk {mMutex};
+
+    for(auto& f : mFamilies)
+    {
+        auto& gauges = f.second.gauges;
+
+        for(auto it = gauges.begin(); it != gauges.end();)
+        {
+            if(it->second.owner == owner)
+            {
+                it = gauges.erase(it);
+            }
+
+            else
+            {
+                ++it;
+            }
+        }
+    }
+}
+
+std::string Metrics::render()
+{
+    std::lock_guard<std::mutex> lk {mMutex};
+
+    std::ostringstream out;
+
+    for(const auto& f : mFamilies)
+    {
+        const std::string& name = f.first;
+        const Family& family = f.second;
+
+        if(family.counters.empty() and
+           family.gauges.empty() and
+           family.histograms.empty())
+        {
+            continue;
+        }
+
+        out << "# HELP " << name << ' ' << family.help << '\n';
+
+        if(family.kind == Kind::Counter)
+        {
+            out << "# TYPE " << name << " counter\n";
+
+            for(const auto& c : family.counters)
+            {
+                out << name << formatLabels(c.first) << ' ' << c.second->get() << '\n';
+            }
+        }
+
+        else if(family.kind == Kind::Gauge)
+        {
+            out << "# TYPE " << name << " gauge\n";
+
+            for(const auto& g : family.gauges)
+            {
+                out << name << formatLabels(g.first) << ' '
+                    << formatValue(g.second.fn()) << '\n';
+            }
+        }
+
+        else
+        {
+            out << "# TYPE " << name << " histogram\n";
+
+            for(const auto& h : family.histograms)
+            {
+                const Histogram& histogram = *h.second;
+
+                // the total count first, the buckets must not exceed it
+                uint64_t count {histogram.getCount()};
+                uint64_t sum {histogram.getSum()};
+
+                for(double bound : HistogramBounds)
+                {
+                    LabelsT labels {h.first};
+                    labels.emplace_back("le", formatValue(bound));
+
+                    uint64_t boundCount
+                    {histogram.getCount(static_cast<uint64_t>(bound * 1e6))};
+
+                    out << name << "_bucket" << formatLabels(labels) << ' '
+                        << std::min(boundCount, count) << '\n';
+                }
+
+                LabelsT labels {h.first};
+                labels.emplace_back("le", "+Inf");
+
+                out << name << "_bucket" << formatLabels(labels) << ' ' << count << '\n'
+                    << name << "_sum" << formatLabels(h.first) << ' '
+                    << formatValue(sum / 1e6) << '\n'
+                    << name << "_count" << formatLabels(h.first) << ' ' << count << '\n';
+            }
+        }
+    }
+
+    return out.str();
+}
+
+Metrics::Family& Metrics::getFamily(const std::string& name,
+                                    const std::string& help,
+                                    Kind kind)
+{
+    auto result = mFamilies.find(name);
+
+    if(result == mFamilies.end())
+    {
+        Family family;
+        family.kind = kind;
+        family.help = help;
+
+        result = mFamilies.emplace(name, std::move(family)).first;
+    }
+
+    return result->second;
+}
+
+std::string Metrics::formatLabels(const LabelsT& labels)
+{
+    if(labels.empty())
+    {
+        return "";
+    }
+
+    std::string ret {"{"};
+
+    for(const auto& l : labels)
+    {
+        if(ret.size() > 1)
+        {
+            ret += ',';
+        }
+
+        ret += l.first + "=\"";
+
+        for(char c : l.second)
+        {
+            if(c == '\\' or c == '"')
+            {
+                ret += '\\';
+                ret += c;
+            }
+
+            else if(c == '\n')
+            {
+                ret += "\\n";
+            }
+
+            else
+            {
+                ret += c;
+            }
+        }
+
+        ret += '"';
+    }
+
+    ret += '}';
+
+    return ret;
+}
+
+std::string Metrics::formatValue(double value)
+{
+    if(std::isnan(value))
+    {
+        return "NaN";
+    }
+
+    std::ostringstream s;
+    s << std::setprecision(std::numeric_limits<double>::digits10 + 1) << value;
+    return s.str();
+}
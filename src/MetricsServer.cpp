@@ -0,0 +1,267 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MetricsServer.hpp"
+#include "Logger.hpp"
+
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+
+using namespace Oshiya;
+
+const unsigned int MetricsServer::Parameters::ConnectionTimeout;
+const std::size_t MetricsServer::Parameters::MaxRequestSize;
+
+namespace
+{
+    const std::string UnixPrefix {"unix:"};
+}
+
+MetricsServer::MetricsServer(const std::string& address)
+    :
+        mAddress {address},
+        mListenFd {-1},
+        mWakeupFd {eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)}
+{
+    if(mWakeupFd == -1)
+    {
+        throw std::system_error {errno, std::generic_category(),
+                                 "could not set up the metrics server"};
+    }
+
+    int result {-1};
+
+    if(mAddress.compare(0, UnixPrefix.size(), UnixPrefix) == 0)
+    {
+        std::string path {mAddress.substr(UnixPrefix.size())};
+
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+
+        if(path.size() < sizeof addr.sun_path)
+        {
+            std::strcpy(addr.sun_path, path.c_str());
+
+            // a socket left over from an earlier run
+            unlink(path.c_str());
+
+            mListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+            if(mListenFd != -1)
+            {
+                result = bind(mListenFd, reinterpret_cast<sockaddr*>(&addr), sizeof addr);
+            }
+        }
+
+        else
+        {
+            errno = ENAMETOOLONG;
+        }
+    }
+
+    else
+    {
+        std::string::size_type colon {mAddress.rfind(':')};
+
+        sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+
+        std::string portStr {colon == std::string::npos ? "" : mAddress.substr(colon + 1)};
+        char* portEnd;
+        unsigned long port {std::strtoul(portStr.c_str(), &portEnd, 10)};
+
+        if(not portStr.empty() and *portEnd == '\0' and port > 0 and port <= 0xffff and
+           inet_pton(AF_INET, mAddress.substr(0, colon).c_str(), &addr.sin_addr) == 1)
+        {
+            addr.sin_port = htons(static_cast<uint16_t>(port));
+
+            mListenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+            if(mListenFd != -1)
+            {
+                int one {1};
+                setsockopt(mListenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+                result = bind(mListenFd, reinterpret_cast<sockaddr*>(&addr), sizeof addr);
+            }
+        }
+
+        else
+        {
+            errno = EINVAL;
+        }
+    }
+
+    if(result == -1 or listen(mListenFd, SOMAXCONN) == -1)
+    {
+        int error {errno};
+
+        if(mListenFd != -1)
+        {
+            close(mListenFd);
+        }
+
+        close(mWakeupFd);
+
+        throw std::system_error {error, std::generic_category(),
+                                 "could not listen for metrics scrapes on " + mAddress};
+    }
+
+    mThread = std::thread {&MetricsServer::run, this};
+}
+
+MetricsServer::~MetricsServer()
+{
+    uint64_t one {1};
+
+    if(write(mWakeupFd, &one, sizeof one) == -1)
+    {
+        LOG_ERROR(Metrics, "could not stop metrics server");
+    }
+
+    if(mThread.joinable())
+    {
+        mThread.join();
+    }
+
+    close(mListenFd);
+    close(mWakeupFd);
+
+    if(mAddress.compare(0, UnixPrefix.size(), UnixPrefix) == 0)
+    {
+        unlink(mAddress.substr(UnixPrefix.size()).c_str());
+    }
+}
+
+void MetricsServer::run()
+{
+    while(true)
+    {
+        pollfd fds[2] {};
+        fds[0].fd = mListenFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = mWakeupFd;
+        fds[1].events = POLLIN;
+
+        if(poll(fds, 2, -1) == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            LOG_ERROR(Metrics, "metrics server: " << std::strerror(errno));
+            return;
+        }
+
+        if(fds[1].revents != 0)
+        {
+            return;
+        }
+
+        int fd {accept4(mListenFd, nullptr, nullptr, SOCK_CLOEXEC)};
+
+        if(fd == -1)
+        {
+            continue;
+        }
+
+        // a stuck client must not block the next scrape for long
+        timeval timeout {};
+        timeout.tv_sec = Parameters::ConnectionTimeout / 1000;
+        timeout.tv_usec = Parameters::ConnectionTimeout % 1000 * 1000;
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+        handleConnection(fd);
+
+        close(fd);
+    }
+}
+
+void MetricsServer::handleConnection(int fd)
+{
+    std::string request;
+    char buffer[1024];
+
+    // the request line and headers are all there is to read
+    while(request.find("\r\n\r\n") == std::string::npos and
+          request.size() < Parameters::MaxRequestSize)
+    {
+        ssize_t count {read(fd, buffer, sizeof buffer)};
+
+        if(count <= 0)
+        {
+            return;
+        }
+
+        request.append(buffer, count);
+    }
+
+    std::string status;
+    std::string body;
+
+    if(request.compare(0, 13, "GET /metrics ") == 0 or
+       request.compare(0, 6, "GET / ") == 0)
+    {
+        status = "200 OK";
+        body = Metrics::getRegistry().render();
+    }
+
+    else
+    {
+        status = "404 Not Found";
+    }
+
+    std::string response
+    {
+        "HTTP/1.0 " + status + "\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n"
+        "\r\n" +
+        body
+    };
+
+    std::size_t written {0};
+
+    while(written < response.size())
+    {
+        ssize_t count
+        {send(fd, response.data() + written, response.size() - written, MSG_NOSIGNAL)};
+
+        if(count <= 0)
+        {
+            return;
+        }
+
+        written += count;
+    }
+}
@@ -0,0 +1,499 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ *
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "NotificationSpool.hpp"
+#include "Logger.hpp"
+#include "Registration.hpp"
+
+#include <algorithm>
+#include <map>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+using namespace Oshiya;
+
+const std::size_t NotificationSpool::Parameters::SegmentSize;
+const std::size_t NotificationSpool::Parameters::MaxSegments;
+const std::size_t NotificationSpool::HeaderSize;
+
+NotificationSpool::NotificationSpool(const std::string& dirPath)
+    :
+        mDirPath {dirPath}
+{
+    if(mkdir(mDirPath.c_str(), 0700) != 0 and errno != EEXIST)
+    {
+        LOG_ERROR(Storage, "could not create notification spool " << mDirPath
+                           << ": " << std::strerror(errno));
+    }
+}
+
+NotificationSpool::~NotificationSpool()
+{
+    commit();
+
+    for(Segment& segment : mSegments)
+    {
+        closeSegment(segment, false);
+    }
+
+    // left over if the commit failed
+    for(Segment& segment : mRetired)
+    {
+        closeSegment(segment, false);
+    }
+}
+
+std::vector<NotificationSpool::Entry> NotificationSpool::replay()
+{
+    std::lock_guard<std::mutex> lk {mMutex};
+
+    std::vector<uint64_t> seqs;
+
+    if(DIR* dir = opendir(mDirPath.c_str()))
+    {
+        while(dirent* file = readdir(dir))
+        {
+            std::string name {file->d_name};
+
+            auto isDigit =
+            [](char c) {return std::isdigit(static_cast<unsigned char>(c)) != 0;};
+
+            if(not name.empty() and std::all_of(name.begin(), name.end(), isDigit))
+            {
+                seqs.push_back(std::stoull(name));
+            }
+        }
+
+        closedir(dir);
+    }
+
+    std::sort(seqs.begin(), seqs.end());
+
+    // ordered by id, i.e. in the order the notifications were added
+    std::map<IdT, Entry> entries;
+
+    for(uint64_t seq : seqs)
+    {
+        if(not openSegment(seq, false))
+        {
+            continue;
+        }
+
+        Segment& segment = mSegments.back();
+        std::size_t pos {0};
+
+        while(pos + HeaderSize <= Parameters::SegmentSize)
+        {
+            uint32_t length, sum;
+
+            std::memcpy(&length, segment.data + pos, sizeof length);
+            std::memcpy(&sum, segment.data + pos + sizeof length, sizeof sum);
+
+            // zero length marks the end of the data
+            if(length == 0 or pos + HeaderSize + length > Parameters::SegmentSize)
+            {
+                break;
+            }
+
+            const char* payload {segment.data + pos + HeaderSize};
+
+            if(Util::checksum(payload, length) != sum)
+            {
+                // torn write
+                break;
+            }
+
+            const char* payloadPos {payload};
+            const char* payloadEnd {payload + length};
+
+            uint8_t type;
+            IdT id;
+
+            if(not Util::readInt(payloadPos, payloadEnd, type) or
+               not Util::readInt(payloadPos, payloadEnd, id))
+            {
+                break;
+            }
+
+            if(type == static_cast<uint8_t>(RecordType::Add))
+            {
+                Entry entry;
+                uint32_t payloadSize;
+
+                bool ok
+                {
+                    Util::readInt(payloadPos, payloadEnd, entry.createdAt) and
+                    Util::readInt(payloadPos, payloadEnd, entry.deviceHash) and
+                    Util::readString(payloadPos, payloadEnd, entry.token) and
+                    Util::readString(payloadPos, payloadEnd, entry.appId) and
+                    Util::readString(payloadPos, payloadEnd, entry.unregisterKey) and
+                    Util::readInt(payloadPos, payloadEnd, payloadSize)
+                };
+
+                for(uint32_t i {0}; ok and i < payloadSize; ++i)
+                {
+                    std::string key, value;
+
+                    ok =
+                    Util::readString(payloadPos, payloadEnd, key) and
+                    Util::readString(payloadPos, payloadEnd, value);
+
+                    entry.payload.emplace(std::move(key), std::move(value));
+                }
+
+                if(not ok)
+                {
+                    break;
+                }
+
+                entry.id = id;
+
+                // a copied notification supersedes the original record
+                auto liveResult = mLive.find(id);
+
+                if(liveResult != mLive.end())
+                {
+                    --getSegment(liveResult->second.seq).live;
+                }
+
+                mLive[id] = Location {seq, pos};
+                ++segment.live;
+                entries[id] = std::move(entry);
+            }
+
+            else if(type == static_cast<uint8_t>(RecordType::Remove))
+            {
+                auto liveResult = mLive.find(id);
+
+                if(liveResult != mLive.end())
+                {
+                    --getSegment(liveResult->second.seq).live;
+                    mLive.erase(liveResult);
+                }
+
+                entries.erase(id);
+            }
+
+            pos += HeaderSize + length;
+        }
+
+        // whatever follows a torn record must not be mistaken for data once
+        // new records are appended
+        std::memset(segment.data + pos, 0, Parameters::SegmentSize - pos);
+        segment.used = segment.committed = pos;
+    }
+
+    if(mSegments.empty())
+    {
+        openSegment(0, true);
+    }
+
+    collectGarbage();
+
+    std::vector<Entry> ret;
+    ret.reserve(entries.size());
+
+    for(auto& e : entries)
+    {
+        ret.push_back(std::move(e.second));
+    }
+
+    return ret;
+}
+
+void NotificationSpool::add(const Backend::PushNotification& n)
+{
+    std::string payload;
+
+    Util::appendInt<uint8_t>(payload, static_cast<uint8_t>(RecordType::Add));
+    Util::appendInt<IdT>(payload, n.spoolId);
+    Util::appendInt<uint64_t>(payload, n.createdAt);
+    Util::appendInt<uint64_t>(payload, n.deviceHash);
+    Util::appendString(payload, n.token);
+    Util::appendString(payload, n.appId);
+    Util::appendString(payload, n.unregisterKey);
+    Util::appendInt<uint32_t>(payload, n.payload.size());
+
+    for(const auto& p : n.payload)
+    {
+        Util::appendString(payload, p.first);
+        Util::appendString(payload, p.second);
+    }
+
+    std::lock_guard<std::mutex> lk {mMutex};
+
+    Location location;
+
+    if(append(payload, location))
+    {
+        mLive[n.spoolId] = location;
+        ++getSegment(location.seq).live;
+    }
+}
+
+void NotificationSpool::remove(IdT id)
+{
+    std::lock_guard<std::mutex> lk {mMutex};
+
+    auto result = mLive.find(id);
+
+    if(result == mLive.end())
+    {
+        return;
+    }
+
+    std::string payload;
+
+    Util::appendInt<uint8_t>(payload, static_cast<uint8_t>(RecordType::Remove));
+    Util::appendInt<IdT>(payload, id);
+
+    Location location;
+    append(payload, location);
+
+    --getSegment(result->second.seq).live;
+    mLive.erase(result);
+
+    collectGarbage();
+}
+
+void NotificationSpool::commit()
+{
+    // one commit at a time, retired segments stay mapped until then
+    std::lock_guard<std::mutex> commitLk {mCommitMutex};
+
+    static const std::size_t pageSize {static_cast<std::size_t>(sysconf(_SC_PAGESIZE))};
+
+    struct DirtyRange
+    {
+        uint64_t seq;
+        char* data;
+        std::size_t first;
+        std::size_t used;
+    };
+
+    std::vector<DirtyRange> ranges;
+    std::vector<Segment> retired;
+
+    {
+        std::lock_guard<std::mutex> lk {mMutex};
+
+        for(const Segment& segment : mSegments)
+        {
+            if(segment.committed != segment.used)
+            {
+                ranges.push_back(DirtyRange {segment.seq,
+                                             segment.data,
+                                             segment.committed / pageSize * pageSize,
+                                             segment.used});
+            }
+        }
+
+        // the copies moved out of these are among the ranges
+        retired.swap(mRetired);
+    }
+
+    // adding and removing notifications goes on while the disk catches up
+    bool ok {true};
+
+    for(const DirtyRange& range : ranges)
+    {
+        if(msync(range.data + range.first, range.used - range.first, MS_SYNC) != 0)
+        {
+            LOG_ERROR(Storage, "could not sync spool segment "
+                               << makeSegmentPath(range.seq) << ": "
+                               << std::strerror(errno));
+            ok = false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lk {mMutex};
+
+    if(not ok)
+    {
+        // the next commit syncs everything again before deleting anything
+        mRetired.insert(mRetired.end(), retired.begin(), retired.end());
+        return;
+    }
+
+    for(const DirtyRange& range : ranges)
+    {
+        for(Segment& segment : mSegments)
+        {
+            if(segment.seq == range.seq)
+            {
+                segment.committed = std::max(segment.committed, range.used);
+            }
+        }
+    }
+
+    for(Segment& segment : retired)
+    {
+        closeSegment(segment, true);
+    }
+}
+
+std::string NotificationSpool::makeSegmentPath(uint64_t seq) const
+{
+    return mDirPath + '/' + std::to_string(seq);
+}
+
+bool NotificationSpool::openSegment(uint64_t seq, bool create)
+{
+    std::string path {makeSegmentPath(seq)};
+
+    int flags {O_RDWR | O_CLOEXEC};
+
+    if(create)
+    {
+        flags |= O_CREAT | O_EXCL;
+    }
+
+    int fd {open(path.c_str(), flags, 0600)};
+
+    if(fd == -1)
+    {
+        LOG_ERROR(Storage, "could not open spool segment " << path << ": "
+                           << std::strerror(errno));
+        return false;
+    }
+
+    // a new segment is all zeros, i.e. empty
+    if(ftruncate(fd, Parameters::SegmentSize) != 0)
+    {
+        LOG_ERROR(Storage, "could not size spool segment " << path << ": "
+                           << std::strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    void* data
+    {mmap(nullptr, Parameters::SegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)};
+
+    if(data == MAP_FAILED)
+    {
+        LOG_ERROR(Storage, "could not map spool segment " << path << ": "
+                           << std::strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    mSegments.push_back(Segment {seq, fd, static_cast<char*>(data), 0, 0, 0});
+
+    return true;
+}
+
+void NotificationSpool::closeSegment(Segment& segment, bool unlinkFile)
+{
+    munmap(segment.data, Parameters::SegmentSize);
+    close(segment.fd);
+
+    if(unlinkFile)
+    {
+        unlink(makeSegmentPath(segment.seq).c_str());
+    }
+}
+
+NotificationSpool::Segment& NotificationSpool::getSegment(uint64_t seq)
+{
+    // usually consecutive, but a segment may have failed to open on replay
+    return
+    *std::lower_bound(mSegments.begin(),
+                      mSegments.end(),
+                      seq,
+                      [](const Segment& s, uint64_t value) {return s.seq < value;});
+}
+
+bool NotificationSpool::append(const std::string& payload, Location& location)
+{
+    if(mSegments.empty() or HeaderSize + payload.size() > Parameters::SegmentSize)
+    {
+        LOG_ERROR(Storage, "could not spool notification");
+        return false;
+    }
+
+    if(mSegments.back().used + HeaderSize + payload.size() > Parameters::SegmentSize and
+       not openSegment(mSegments.back().seq + 1, true))
+    {
+        return false;
+    }
+
+    Segment& segment = mSegments.back();
+
+    uint32_t length {static_cast<uint32_t>(payload.size())};
+    uint32_t sum {Util::checksum(payload.data(), payload.size())};
+
+    char* pos {segment.data + segment.used};
+
+    // the header goes last, a record is complete once its length is set
+    std::memcpy(pos + HeaderSize, payload.data(), payload.size());
+    std::memcpy(pos + sizeof length, &sum, sizeof sum);
+    std::memcpy(pos, &length, sizeof length);
+
+    location = Location {segment.seq, segment.used};
+    segment.used += HeaderSize + payload.size();
+
+    return true;
+}
+
+void NotificationSpool::collectGarbage()
+{
+    if(mSegments.size() > Parameters::MaxSegments)
+    {
+        // copy what still lives in the oldest segment to the current one
+        uint64_t oldest {mSegments.front().seq};
+
+        for(auto& l : mLive)
+        {
+            if(l.second.seq != oldest)
+            {
+                continue;
+            }
+
+            const char* record {mSegments.front().data + l.second.offset};
+            uint32_t length;
+            std::memcpy(&length, record, sizeof length);
+
+            Location location;
+
+            if(append(std::string(record + HeaderSize, length), location))
+            {
+                --mSegments.front().live;
+                ++getSegment(location.seq).live;
+                l.second = location;
+            }
+        }
+    }
+
+    // oldest first, a segment may hold removals of notifications added to
+    // older ones
+    while(mSegments.size() > 1 and mSegments.front().live == 0)
+    {
+        // deleted by the next commit, once the copies are durable
+        mRetired.push_back(mSegments.front());
+        mSegments.pop_front();
+    }
+}
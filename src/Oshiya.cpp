@@ -17,39 +17,169 @@
  */
 
 #include "AppServer.hpp"
+#include "Logger.hpp"
+#include "MetricsServer.hpp"
 #include "config.h"
 
-#include <iostream>
 #include <csignal>
-#include <mutex>
-#include <condition_variable>
+#include <cerrno>
+#include <system_error>
+#include <map>
+#include <fstream>
+#include <iostream>
+
+#include <unistd.h>
 
 namespace
 {
-      std::mutex m;
-      std::condition_variable cv;
+      // the signal handler writes the signal number to it, main waits on it
+      int signalPipe[2] {-1, -1};
+}
+
+/**
+ * oshiya --import|--export HOST FILE, moves the registrations of the component
+ * HOST (which must not be running) from or to FILE
+ */
+int transferRegistrations(const Oshiya::Config& config,
+                          const std::string& mode,
+                          const std::string& host,
+                          const std::string& path)
+{
+    using namespace Oshiya;
+
+    Config::NodeT components {config.getNode("components")};
+
+    for(Config::IteratorT it {components.begin()}; it != components.end(); ++it)
+    {
+        Config component {*it};
+
+        if(component.value("host") != host)
+        {
+            continue;
+        }
+
+        AppServer::TransferStats stats;
+        bool ok;
+
+        if(mode == "--import")
+        {
+            std::ifstream in {path};
+            ok = in and AppServer::importRegs(component, in, stats);
+        }
+
+        else
+        {
+            std::ofstream out {path};
+            ok = out and AppServer::exportRegs(component, out, stats);
+        }
+
+        LOG_INFO(Main, mode.substr(2) << (ok ? " done: " : " failed: ")
+                       << stats.processed << " processed, "
+                       << stats.transferred << " transferred, "
+                       << stats.failed << " failed");
+
+        return ok ? 0 : -1;
+    }
+
+    LOG_ERROR(Main, "no component " << host << " configured");
+    return -1;
 }
 
 void signalHandler(int signal)
 {
-    if(signal == SIGINT or signal == SIGTERM)
+    // async-signal-safe calls only, main does the logging
+    int savedErrno {errno};
+    unsigned char number {static_cast<unsigned char>(signal)};
+
+    if(write(signalPipe[1], &number, 1) == -1)
     {
-        std::cout << "Oshiya terminating with signal " << signal << std::endl;
-        cv.notify_one();
+        // nothing to be done about it here
     }
+
+    errno = savedErrno;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
     using namespace Oshiya;
 
-    std::cout << "Oshiya" << std::endl;
-    std::cout << "config file: " << CONFIG_FILE << std::endl;
+    std::vector<std::string> args {argv + 1, argv + argc};
+
+    if(not args.empty() and
+       (args.size() != 3 or (args[0] != "--import" and args[0] != "--export")))
+    {
+        std::cerr << "usage: " << argv[0] << " [--import|--export HOST FILE]" << std::endl;
+        return -1;
+    }
+
+    LOG_INFO(Main, "Oshiya, config file: " << CONFIG_FILE);
+
+    if(pipe(signalPipe) != 0)
+    {
+        LOG_ERROR(Main, "could not create signal pipe");
+        return -1;
+    }
 
     std::signal(SIGINT, signalHandler);
     std::signal(SIGTERM, signalHandler);
 
     Config config {CONFIG_FILE};
+
+    Logger& logger = Logger::getInstance();
+    Logger::Level level;
+
+    if(Logger::parseLevel(config.value<std::string>("log_level", "info"), level))
+    {
+        logger.setLevel(level);
+    }
+
+    // per-module overrides, e.g. "xmpp: debug"
+    for(const auto& l : config.value<std::map<std::string, std::string>>("log_levels", {}))
+    {
+        Logger::Module module;
+
+        if(Logger::parseModule(l.first, module) and Logger::parseLevel(l.second, level))
+        {
+            logger.setLevel(module, level);
+        }
+
+        else
+        {
+            LOG_WARNING(Main, "invalid log level " << l.second << " for module " << l.first);
+        }
+    }
+
+    if(not args.empty())
+    {
+        try
+        {
+            return transferRegistrations(config, args[0], args[1], args[2]);
+        }
+
+        catch(const Config::InvalidConfig& e)
+        {
+            LOG_ERROR(Main, e.what());
+            return -1;
+        }
+    }
+
+    // before the components, so it outlives them
+    std::unique_ptr<MetricsServer> metricsServer;
+    std::string metricsAddress {config.value<std::string>("metrics", "")};
+
+    if(not metricsAddress.empty())
+    {
+        try
+        {
+            metricsServer = make_unique<MetricsServer>(metricsAddress);
+        }
+
+        catch(const std::system_error& e)
+        {
+            LOG_ERROR(Main, e.what());
+            return -1;
+        }
+    }
     
     std::vector<std::unique_ptr<AppServer>> appServers;
     
@@ -65,12 +195,28 @@ int main()
 
     catch(const Config::InvalidConfig& e)
     {
-        std::cout << "ERROR: " << e.what() << std::endl;
+        LOG_ERROR(Main, e.what());
         return -1;
     }
 
-    std::unique_lock<std::mutex> lk(m);
-    cv.wait(lk);
+    unsigned char signal;
+    ssize_t result;
+
+    do
+    {
+        result = read(signalPipe[0], &signal, 1);
+    }
+    while(result == -1 and errno == EINTR);
+
+    if(result == 1)
+    {
+        LOG_INFO(Main, "Oshiya terminating with signal " << static_cast<int>(signal));
+    }
+
+    else
+    {
+        LOG_ERROR(Main, "could not wait for a signal, Oshiya terminating");
+    }
 
     return 0;
 }
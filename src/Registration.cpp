@@ -28,7 +28,7 @@ Registration::Registration(const Jid& user,
                            Backend::IdT backendId,
                            std::time_t timestamp)
     :
-        mUser {user},
+        mUser {Jid::intern(user)},
         mDeviceId {deviceId},
         mDeviceName {deviceName},
         mToken {token},
@@ -38,3 +38,102 @@ Registration::Registration(const Jid& user,
 {
 
 }
+
+void Util::appendString(std::string& out, StringView str)
+{
+    appendInt<uint32_t>(out, str.size());
+    out.append(str.data(), str.size());
+}
+
+uint32_t Util::checksum(const char* data, std::size_t length)
+{
+    uint32_t hash {2166136261u};
+
+    for(std::size_t i {0}; i < length; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+bool Util::readString(const char*& pos, const char* end, std::string& str)
+{
+    uint32_t size;
+
+    if(not readInt(pos, end, size) or static_cast<std::size_t>(end - pos) < size)
+    {
+        return false;
+    }
+
+    str.assign(pos, size);
+    pos += size;
+
+    return true;
+}
+
+void Util::appendRegistration(std::string& out, const Registration& reg)
+{
+    appendRegistration(out,
+                       reg.getUser(),
+                       reg.getDeviceId(),
+                       reg.getDeviceName(),
+                       reg.getToken(),
+                       reg.getAppId(),
+                       reg.getBackendId(),
+                       reg.getTimestamp());
+}
+
+void Util::appendRegistration(std::string& out,
+                              const Jid& user,
+                              StringView deviceId,
+                              StringView deviceName,
+                              StringView token,
+                              StringView appId,
+                              Backend::IdT backendId,
+                              std::time_t timestamp)
+{
+    appendString(out, user.getUser());
+    appendString(out, user.getServer());
+    appendString(out, user.getResource());
+    appendString(out, deviceId);
+    appendString(out, deviceName);
+    appendString(out, token);
+    appendString(out, appId);
+    appendInt<uint64_t>(out, backendId);
+    appendInt<int64_t>(out, timestamp);
+}
+
+bool Util::readRegistration(const char*& pos, const char* end, Registration& reg)
+{
+    std::string user, server, resource, deviceId, deviceName, token, appId;
+    uint64_t backendId;
+    int64_t timestamp;
+
+    bool ok
+    {
+        readString(pos, end, user) and
+        readString(pos, end, server) and
+        readString(pos, end, resource) and
+        readString(pos, end, deviceId) and
+        readString(pos, end, deviceName) and
+        readString(pos, end, token) and
+        readString(pos, end, appId) and
+        readInt(pos, end, backendId) and
+        readInt(pos, end, timestamp)
+    };
+
+    if(ok)
+    {
+        reg.setUser({user, server, resource});
+        reg.setDeviceId(deviceId);
+        reg.setDeviceName(deviceName);
+        reg.setToken(token);
+        reg.setAppId(appId);
+        reg.setBackendId(static_cast<Backend::IdT>(backendId));
+        reg.setTimestamp(static_cast<std::time_t>(timestamp));
+    }
+
+    return ok;
+}
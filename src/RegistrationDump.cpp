@@ -0,0 +1,182 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "RegistrationDump.hpp"
+#include "json/json.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+
+using namespace Oshiya;
+
+namespace
+{
+    const Backend::Type BackendTypes[]
+    {
+        Backend::Type::Apns,
+        Backend::Type::Gcm,
+        Backend::Type::Mozilla,
+        Backend::Type::Ubuntu,
+        Backend::Type::Wns
+    };
+
+    /**
+     * user@server/resource, what strophe's jid functions do without a context
+     */
+    Jid parseJid(const std::string& str)
+    {
+        std::size_t slash {str.find('/')};
+        std::string bare {str.substr(0, slash)};
+        std::string resource {slash == std::string::npos ? "" : str.substr(slash + 1)};
+
+        std::size_t at {bare.find('@')};
+
+        if(at == std::string::npos)
+        {
+            return Jid {"", bare, resource};
+        }
+
+        return Jid {bare.substr(0, at), bare.substr(at + 1), resource};
+    }
+}
+
+bool RegistrationDump::parse(const std::string& line, Entry& entry)
+{
+    Json::Value root;
+    Json::Reader reader;
+
+    if(not reader.parse(line, root, false) or not root.isObject())
+    {
+        return false;
+    }
+
+    for(const char* key : {"node", "jid", "device_id", "token", "backend"})
+    {
+        if(not root[key].isString() or root[key].asString().empty())
+        {
+            return false;
+        }
+    }
+
+    entry.backendType = Backend::makeType(root["backend"].asString());
+
+    if(entry.backendType == Backend::Type::Invalid)
+    {
+        return false;
+    }
+
+    entry.user = parseJid(root["jid"].asString());
+
+    if(entry.user.getServer().empty())
+    {
+        return false;
+    }
+
+    entry.node = root["node"].asString();
+    entry.deviceId = root["device_id"].asString();
+    entry.deviceName = root.get("device_name", "").asString();
+    entry.token = root["token"].asString();
+    entry.appId = root.get("app_id", "").asString();
+    entry.secret = root.get("secret", "").asString();
+    entry.timestamp =
+    root["timestamp"].isIntegral() ?
+    static_cast<std::time_t>(root["timestamp"].asInt64()) :
+    std::time(nullptr);
+
+    return true;
+}
+
+Registration RegistrationDump::makeRegistration(const Entry& entry, const Jid& host)
+{
+    return Registration
+    {
+        entry.user,
+        entry.deviceId,
+        entry.deviceName,
+        entry.token,
+        entry.appId,
+        Backend::makeBackendId(entry.backendType, host),
+        entry.timestamp
+    };
+}
+
+std::size_t RegistrationDump::write(std::ostream& out,
+                                    const RegistrationTable& regs,
+                                    const Jid& host)
+{
+    Json::FastWriter writer;
+    std::size_t count {0};
+
+    // the ids are hashed from strings, not worth doing per registration
+    std::vector<std::pair<Backend::IdT, Backend::Type>> backendIds;
+
+    for(Backend::Type type : BackendTypes)
+    {
+        backendIds.emplace_back(Backend::makeBackendId(type, host), type);
+    }
+
+    regs.forEach(
+        [&](RegistrationTable::IdT id)
+        {
+            auto backend =
+            std::find_if(backendIds.begin(),
+                         backendIds.end(),
+                         [&regs, id](const std::pair<Backend::IdT, Backend::Type>& b)
+                         {return b.first == regs.getBackendId(id);});
+
+            if(backend == backendIds.end())
+            {
+                return;
+            }
+
+            Backend::Type type {backend->second};
+
+            Json::Value root {Json::objectValue};
+            root["node"] = regs.getNode(id).str();
+            root["jid"] = regs.getUser(id).full();
+            root["device_id"] = regs.getDeviceId(id).str();
+            root["device_name"] = regs.getDeviceName(id).str();
+            root["token"] = regs.getToken(id).str();
+            root["app_id"] = regs.getAppId(id).str();
+            root["backend"] = Backend::getTypeStr(type);
+            root["timestamp"] = static_cast<Json::Int64>(regs.getTimestamp(id));
+
+            // FastWriter ends the document with a newline
+            out << writer.write(root);
+            ++count;
+        }
+    );
+
+    return count;
+}
+
+Backend::Type RegistrationDump::findBackendType(Backend::IdT backendId, const Jid& host)
+{
+    for(Backend::Type type : BackendTypes)
+    {
+        if(Backend::makeBackendId(type, host) == backendId)
+        {
+            return type;
+        }
+    }
+
+    return Backend::Type::Invalid;
+}
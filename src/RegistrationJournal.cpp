@@ -0,0 +1,403 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ *
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "RegistrationJournal.hpp"
+#include "Logger.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+using namespace Oshiya;
+
+const unsigned int RegistrationJournal::Parameters::GroupCommitInterval;
+const std::size_t RegistrationJournal::Parameters::GroupCommitBytes;
+const std::size_t RegistrationJournal::Parameters::CompactionThreshold;
+
+RegistrationJournal::RegistrationJournal(const std::string& path,
+                                         std::function<void()> compactionCb)
+    :
+        mPath {path},
+        mCompactionCb {compactionCb},
+        mRecordsSinceCompaction {0},
+        mCompacting {false},
+        mShutdown {false},
+        mFd {-1}
+{
+    openFile();
+
+    mFlusherThread = std::thread {&RegistrationJournal::runFlusher, this};
+    mCompactionThread = std::thread {&RegistrationJournal::runCompaction, this};
+}
+
+RegistrationJournal::~RegistrationJournal()
+{
+    {
+        std::lock_guard<std::mutex> lk {mMutex};
+        mShutdown = true;
+    }
+
+    mFlushCv.notify_one();
+    mCompactionCv.notify_one();
+
+    if(mCompactionThread.joinable())
+    {
+        mCompactionThread.join();
+    }
+
+    if(mFlusherThread.joinable())
+    {
+        mFlusherThread.join();
+    }
+
+    if(mFd != -1)
+    {
+        close(mFd);
+    }
+}
+
+void RegistrationJournal::logAdd(const std::string& node, const Registration& reg)
+{
+    std::string payload;
+
+    Util::appendInt<uint8_t>(payload, static_cast<uint8_t>(RecordType::Add));
+    Util::appendString(payload, node);
+    Util::appendRegistration(payload, reg);
+
+    appendRecord(payload);
+}
+
+void RegistrationJournal::logDelete(const std::string& node)
+{
+    std::string payload;
+
+    Util::appendInt<uint8_t>(payload, static_cast<uint8_t>(RecordType::Delete));
+    Util::appendString(payload, node);
+
+    appendRecord(payload);
+}
+
+bool RegistrationJournal::rotate()
+{
+    std::lock_guard<std::mutex> fileLk {mFileMutex};
+
+    std::string pending;
+
+    {
+        std::lock_guard<std::mutex> lk {mMutex};
+        pending.swap(mBuffer);
+        mRecordsSinceCompaction = 0;
+    }
+
+    writeAndSync(pending);
+
+    // left by a snapshot that failed, it holds records no snapshot covers
+    if(access(rotatedPath(mPath).c_str(), F_OK) == 0)
+    {
+        LOG_WARNING(Storage, "not rotating registration journal, "
+                             << rotatedPath(mPath) << " still exists");
+        return false;
+    }
+
+    close(mFd);
+    mFd = -1;
+
+    bool ok {true};
+
+    if(std::rename(mPath.c_str(), rotatedPath(mPath).c_str()) != 0)
+    {
+        LOG_ERROR(Storage, "could not rotate registration journal: "
+                           << std::strerror(errno));
+        ok = false;
+    }
+
+    openFile();
+
+    return ok;
+}
+
+void RegistrationJournal::removeRotated()
+{
+    std::remove(rotatedPath(mPath).c_str());
+}
+
+void RegistrationJournal::remove(const std::string& path)
+{
+    std::remove(rotatedPath(path).c_str());
+    std::remove(path.c_str());
+}
+
+void RegistrationJournal::replay(const std::string& path, RegistrationTable& regs)
+{
+    replay(
+        path,
+        [&regs](const std::string& node, const Registration& reg) {regs.set(node, reg);},
+        [&regs](const std::string& node) {regs.erase(node);}
+    );
+}
+
+void RegistrationJournal::replay(const std::string& path,
+                                 const SetCbT& set,
+                                 const EraseCbT& erase)
+{
+    replayFile(rotatedPath(path), set, erase);
+
+    std::size_t validLength {replayFile(path, set, erase)};
+
+    std::ifstream::pos_type fileLength;
+
+    {
+        std::ifstream iFile {path, std::ifstream::binary | std::ifstream::ate};
+        fileLength = iFile.tellg();
+    }
+
+    if(fileLength != std::ifstream::pos_type(-1) and
+       static_cast<std::size_t>(fileLength) > validLength)
+    {
+        LOG_WARNING(Storage, "discarding incomplete record at end of "
+                             << path);
+
+        if(truncate(path.c_str(), validLength) != 0)
+        {
+            LOG_ERROR(Storage, "could not truncate " << path);
+        }
+    }
+}
+
+std::string RegistrationJournal::rotatedPath(const std::string& path)
+{
+    return path + ".1";
+}
+
+std::size_t RegistrationJournal::replayFile(const std::string& path,
+                                            const SetCbT& set,
+                                            const EraseCbT& erase)
+{
+    std::ifstream iFile {path, std::ifstream::binary};
+
+    if(not iFile.is_open())
+    {
+        return 0;
+    }
+
+    std::string content
+    {
+        std::istreambuf_iterator<char> {iFile},
+        std::istreambuf_iterator<char> { }
+    };
+
+    const std::size_t headerSize {2 * sizeof(uint32_t)};
+    std::size_t pos {0};
+
+    while(pos + headerSize <= content.size())
+    {
+        uint32_t length, sum;
+
+        std::memcpy(&length, &content[pos], sizeof length);
+        std::memcpy(&sum, &content[pos + sizeof length], sizeof sum);
+
+        if(pos + headerSize + length > content.size())
+        {
+            break;
+        }
+
+        const char* payload {&content[pos + headerSize]};
+
+        if(Util::checksum(payload, length) != sum)
+        {
+            break;
+        }
+
+        const char* payloadPos {payload};
+        const char* payloadEnd {payload + length};
+
+        uint8_t type;
+        std::string node;
+
+        if(not Util::readInt(payloadPos, payloadEnd, type) or
+           not Util::readString(payloadPos, payloadEnd, node))
+        {
+            break;
+        }
+
+        if(type == static_cast<uint8_t>(RecordType::Add))
+        {
+            Registration reg;
+
+            if(not Util::readRegistration(payloadPos, payloadEnd, reg))
+            {
+                break;
+            }
+
+            set(node, reg);
+        }
+
+        else if(type == static_cast<uint8_t>(RecordType::Delete))
+        {
+            erase(node);
+        }
+
+        pos += headerSize + length;
+    }
+
+    return pos;
+}
+
+void RegistrationJournal::appendRecord(const std::string& payload)
+{
+    bool flushNow;
+
+    {
+        std::lock_guard<std::mutex> lk {mMutex};
+
+        Util::appendInt<uint32_t>(mBuffer, payload.size());
+        Util::appendInt<uint32_t>(mBuffer,
+                                  Util::checksum(payload.data(), payload.size()));
+        mBuffer.append(payload);
+
+        ++mRecordsSinceCompaction;
+
+        flushNow = mBuffer.size() >= Parameters::GroupCommitBytes;
+    }
+
+    if(flushNow)
+    {
+        mFlushCv.notify_one();
+    }
+}
+
+void RegistrationJournal::openFile()
+{
+    mFd = open(mPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+
+    if(mFd == -1)
+    {
+        LOG_ERROR(Storage, "could not open registration journal " << mPath
+                           << ": " << std::strerror(errno));
+    }
+}
+
+void RegistrationJournal::writeAndSync(const std::string& data)
+{
+    if(mFd == -1 or data.empty())
+    {
+        return;
+    }
+
+    std::size_t written {0};
+
+    while(written < data.size())
+    {
+        ssize_t result {write(mFd, data.data() + written, data.size() - written)};
+
+        if(result == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            LOG_ERROR(Storage, "could not write registration journal: "
+                               << std::strerror(errno));
+            return;
+        }
+
+        written += result;
+    }
+
+    fdatasync(mFd);
+}
+
+void RegistrationJournal::runFlusher()
+{
+    while(true)
+    {
+        bool shutdown;
+        bool compact {false};
+
+        {
+            std::unique_lock<std::mutex> lk {mMutex};
+
+            mFlushCv.wait_for(
+                lk,
+                std::chrono::milliseconds(Parameters::GroupCommitInterval),
+                [this]()
+                {return mShutdown or mBuffer.size() >= Parameters::GroupCommitBytes;}
+            );
+
+            shutdown = mShutdown;
+
+            if(not shutdown and not mCompacting and
+               mRecordsSinceCompaction >= Parameters::CompactionThreshold)
+            {
+                compact = mCompacting = true;
+            }
+        }
+
+        if(compact)
+        {
+            mCompactionCv.notify_one();
+        }
+
+        {
+            std::lock_guard<std::mutex> fileLk {mFileMutex};
+            std::string pending;
+
+            {
+                std::lock_guard<std::mutex> lk {mMutex};
+                pending.swap(mBuffer);
+            }
+
+            // one write and one fsync for all records of this interval
+            writeAndSync(pending);
+        }
+
+        if(shutdown)
+        {
+            return;
+        }
+    }
+}
+
+void RegistrationJournal::runCompaction()
+{
+    std::unique_lock<std::mutex> lk {mMutex};
+
+    while(true)
+    {
+        mCompactionCv.wait(lk, [this]() {return mShutdown or mCompacting;});
+
+        if(mShutdown)
+        {
+            return;
+        }
+
+        // group commits go on while the snapshot is written
+        lk.unlock();
+        mCompactionCb();
+        lk.lock();
+
+        mCompacting = false;
+    }
+}
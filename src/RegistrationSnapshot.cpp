@@ -0,0 +1,450 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "RegistrationSnapshot.hpp"
+
+#include <fstream>
+#include <limits>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace Oshiya;
+
+namespace
+{
+    const char Magic[8] {'O', 'S', 'H', 'I', 'Y', 'A', 'R', 'S'};
+    const std::size_t HeaderSize {sizeof Magic + 2 * sizeof(uint32_t) + sizeof(uint64_t)};
+    const std::size_t WriteBufferSize {1 << 20};
+
+    /**
+     * read-only mapping of a whole file
+     */
+    struct MappedFile
+    {
+        MappedFile(const std::string& path)
+            : data {nullptr}, size {0}
+        {
+            int fd {open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+
+            if(fd == -1)
+            {
+                return;
+            }
+
+            struct stat st;
+
+            if(fstat(fd, &st) == 0 and st.st_size > 0)
+            {
+                void* addr {mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+
+                if(addr != MAP_FAILED)
+                {
+                    data = static_cast<const char*>(addr);
+                    size = st.st_size;
+
+                    madvise(addr, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+                }
+            }
+
+            close(fd);
+        }
+
+        ~MappedFile()
+        {
+            if(data)
+            {
+                munmap(const_cast<char*>(data), size);
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* data;
+        std::size_t size;
+    };
+
+    /**
+     * the nodes of a snapshot are unique, a record can't replace another
+     */
+    bool decodeChunk(const char* pos, const char* end, std::size_t count,
+                     RegistrationTable& out)
+    {
+        out.reserve(count);
+
+        while(pos < end)
+        {
+            uint32_t length;
+
+            if(not Util::readInt(pos, end, length) or
+               static_cast<std::size_t>(end - pos) < length)
+            {
+                return false;
+            }
+
+            const char* recordEnd {pos + length};
+
+            std::string node;
+            Registration reg;
+
+            if(not Util::readString(pos, recordEnd, node) or
+               not Util::readRegistration(pos, recordEnd, reg) or
+               not out.insert(node, reg))
+            {
+                return false;
+            }
+
+            pos = recordEnd;
+        }
+
+        return true;
+    }
+
+    bool writeAll(int fd, const std::string& data)
+    {
+        std::size_t written {0};
+
+        while(written < data.size())
+        {
+            ssize_t result {::write(fd, data.data() + written, data.size() - written)};
+
+            if(result == -1)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+
+                return false;
+            }
+
+            written += result;
+        }
+
+        return true;
+    }
+}
+
+RegistrationSnapshot::Result
+RegistrationSnapshot::read(const std::string& path, std::vector<RegistrationTable>& tables)
+{
+    MappedFile file {path};
+
+    if(not file.data)
+    {
+        return Result::NotFound;
+    }
+
+    if(file.size < sizeof Magic or std::memcmp(file.data, Magic, sizeof Magic) != 0)
+    {
+        return Result::Legacy;
+    }
+
+    const char* pos {file.data + sizeof Magic};
+    const char* end {file.data + file.size};
+
+    uint32_t version, reserved;
+    uint64_t count;
+
+    if(not Util::readInt(pos, end, version) or
+       not Util::readInt(pos, end, reserved) or
+       not Util::readInt(pos, end, count) or
+       version != Version)
+    {
+        return Result::Invalid;
+    }
+
+    // only the length prefixes are read to find the chunk boundaries
+    std::size_t threadCount
+    {
+        std::max<std::size_t>(
+            1,
+            std::min<std::size_t>(std::thread::hardware_concurrency(),
+                                  count / MinRecordsPerThread)
+        )
+    };
+
+    uint64_t recordsPerChunk {count / threadCount + 1};
+    std::vector<const char*> boundaries {pos};
+    uint64_t recordIndex {0};
+
+    for(const char* p {pos}; p < end; ++recordIndex)
+    {
+        uint32_t length;
+
+        if(not Util::readInt(p, end, length) or
+           static_cast<std::size_t>(end - p) < length)
+        {
+            return Result::Invalid;
+        }
+
+        p += length;
+
+        if((recordIndex + 1) % recordsPerChunk == 0 and p < end)
+        {
+            boundaries.push_back(p);
+        }
+    }
+
+    if(recordIndex != count)
+    {
+        return Result::Invalid;
+    }
+
+    boundaries.push_back(end);
+
+    std::size_t chunkCount {boundaries.size() - 1};
+    std::vector<RegistrationTable> chunks (chunkCount);
+    std::vector<char> chunkOk (chunkCount, 0);
+    std::vector<std::thread> threads;
+
+    for(std::size_t i {1}; i < chunkCount; ++i)
+    {
+        threads.emplace_back(
+            [&boundaries, &chunks, &chunkOk, recordsPerChunk, i]()
+            {
+                chunkOk[i] = decodeChunk(boundaries[i], boundaries[i + 1],
+                                         recordsPerChunk, chunks[i]);
+            }
+        );
+    }
+
+    chunkOk[0] = decodeChunk(boundaries[0], boundaries[1], recordsPerChunk, chunks[0]);
+
+    for(std::thread& t : threads)
+    {
+        t.join();
+    }
+
+    if(std::find(chunkOk.begin(), chunkOk.end(), 0) != chunkOk.end())
+    {
+        return Result::Invalid;
+    }
+
+    for(RegistrationTable& chunk : chunks)
+    {
+        tables.push_back(std::move(chunk));
+    }
+
+    return Result::Ok;
+}
+
+RegistrationSnapshot::Result
+RegistrationSnapshot::read(const std::string& path, RegistrationTable& regs)
+{
+    std::vector<RegistrationTable> tables;
+
+    Result result {read(path, tables)};
+
+    for(RegistrationTable& table : tables)
+    {
+        if(regs.empty())
+        {
+            regs = std::move(table);
+        }
+
+        else
+        {
+            regs.merge(table);
+        }
+    }
+
+    return result;
+}
+
+namespace
+{
+    // one snapshot of all tables, in order
+    bool writeTables(const std::string& path,
+                         const std::vector<const RegistrationTable*>& tables)
+    {
+        std::string tmpPath {path + ".tmp"};
+
+        int fd {open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)};
+
+        if(fd == -1)
+        {
+            return false;
+        }
+
+        std::string buffer;
+        buffer.reserve(WriteBufferSize + 4096);
+
+        buffer.append(Magic, sizeof Magic);
+        Util::appendInt<uint32_t>(buffer, RegistrationSnapshot::Version);
+        Util::appendInt<uint32_t>(buffer, 0);
+
+        uint64_t count {0};
+
+        for(const RegistrationTable* regs : tables)
+        {
+            count += regs->size();
+        }
+
+        Util::appendInt<uint64_t>(buffer, count);
+
+        bool ok {true};
+        std::string payload;
+
+        for(const RegistrationTable* regs : tables)
+        {
+            regs->forEach(
+                [&](RegistrationTable::IdT id)
+                {
+                    payload.clear();
+                    Util::appendString(payload, regs->getNode(id));
+                    Util::appendRegistration(payload,
+                                             regs->getUser(id),
+                                             regs->getDeviceId(id),
+                                             regs->getDeviceName(id),
+                                             regs->getToken(id),
+                                             regs->getAppId(id),
+                                             regs->getBackendId(id),
+                                             regs->getTimestamp(id));
+
+                    Util::appendInt<uint32_t>(buffer, payload.size());
+                    buffer.append(payload);
+
+                    if(buffer.size() >= WriteBufferSize)
+                    {
+                        ok = ok and writeAll(fd, buffer);
+                        buffer.clear();
+                    }
+                }
+            );
+        }
+
+        ok = ok and writeAll(fd, buffer) and fsync(fd) == 0;
+
+        close(fd);
+
+        if(not ok)
+        {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+
+        return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+    }
+}
+
+bool RegistrationSnapshot::write(const std::string& path, const RegistrationTable& regs)
+{
+    return writeTables(path, std::vector<const RegistrationTable*> {&regs});
+}
+
+bool RegistrationSnapshot::write(const std::string& path,
+                                 const std::vector<RegistrationTable>& shards)
+{
+    std::vector<const RegistrationTable*> tables;
+
+    for(const auto& regs : shards)
+    {
+        tables.push_back(&regs);
+    }
+
+    return writeTables(path, tables);
+}
+
+namespace Oshiya
+{
+    namespace
+    {
+        /**
+         * a registration in the legacy text format, one field per line
+         */
+        std::istream& operator>>(std::istream& is, Registration& reg)
+        {
+            std::string user, server, resource, deviceId, deviceName, token, appId;
+            Backend::IdT backendId;
+            std::time_t timestamp;
+
+            std::getline(is, user);
+            std::getline(is, server);
+            std::getline(is, resource);
+            std::getline(is, deviceId);
+            std::getline(is, deviceName);
+            std::getline(is, token);
+            std::getline(is, appId);
+            is >> backendId;
+            is.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            is >> timestamp;
+            is.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+            reg.setUser({user, server, resource});
+            reg.setDeviceId(deviceId);
+            reg.setDeviceName(deviceName);
+            reg.setToken(token);
+            reg.setAppId(appId);
+            reg.setBackendId(backendId);
+            reg.setTimestamp(timestamp);
+
+            return is;
+        }
+    }
+}
+
+RegistrationSnapshot::Result
+RegistrationSnapshot::readLegacy(const std::string& path, RegistrationTable& regs)
+{
+    std::ifstream iFile
+    {
+        path,
+        std::ifstream::in
+    };
+
+    if(not iFile.is_open())
+    {
+        return Result::NotFound;
+    }
+
+    iFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+
+    while(not iFile.eof())
+    {
+        std::string node;
+        Registration reg;
+
+        try
+        {
+            std::getline(iFile, node);
+            iFile >> reg;
+
+            regs.insert(node, reg);
+        }
+
+        catch(const std::ios_base::failure&)
+        {
+            if(not iFile.eof())
+            {
+                return Result::Invalid;
+            }
+        }
+    }
+
+    return Result::Ok;
+}
@@ -0,0 +1,284 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "RegistrationStore.hpp"
+
+#include <mutex>
+#include <thread>
+#include <algorithm>
+
+
+using namespace Oshiya;
+
+const std::size_t RegistrationStore::Parameters::ShardCount;
+
+RegistrationStore::RegistrationStore(InsertedCbT insertedCb, ErasedCbT erasedCb)
+    :
+        mInsertedCb {std::move(insertedCb)},
+        mErasedCb {std::move(erasedCb)},
+        mShards {new Shard[Parameters::ShardCount]}
+{ }
+
+void RegistrationStore::load(const RegistrationTable& regs)
+{
+    loadTables(std::vector<const RegistrationTable*> {&regs});
+}
+
+void RegistrationStore::load(const std::vector<RegistrationTable>& tables)
+{
+    std::vector<const RegistrationTable*> ptrs;
+
+    for(const auto& regs : tables)
+    {
+        ptrs.push_back(&regs);
+    }
+
+    loadTables(ptrs);
+}
+
+void RegistrationStore::load(const std::string& node, const Registration& reg)
+{
+    Shard& shard = getShard(node);
+    std::lock_guard<RWLock> lk {shard.lock};
+
+    shard.regs.set(node, reg);
+}
+
+void RegistrationStore::unload(StringView node)
+{
+    Shard& shard = getShard(node);
+    std::lock_guard<RWLock> lk {shard.lock};
+
+    shard.regs.erase(node);
+}
+
+bool RegistrationStore::insert(const std::string& node, const Registration& reg)
+{
+    Shard& shard = getShard(node);
+    std::lock_guard<RWLock> lk {shard.lock};
+
+    if(not shard.regs.insert(node, reg))
+    {
+        return false;
+    }
+
+    mInsertedCb(node, reg);
+    return true;
+}
+
+bool RegistrationStore::eraseIf(StringView node, const PredicateT& pred)
+{
+    Shard& shard = getShard(node);
+    std::lock_guard<RWLock> lk {shard.lock};
+
+    IdT id {shard.regs.find(node)};
+
+    if(id == RegistrationTable::InvalidId or not pred(shard.regs, id))
+    {
+        return false;
+    }
+
+    mErasedCb(shard.regs, id);
+    shard.regs.erase(id);
+    return true;
+}
+
+std::string RegistrationStore::eraseDevice(const Jid& user, StringView deviceId)
+{
+    // a device's registrations may be in any shard, the newest is looked for
+    // with read locks only
+    std::string node;
+    std::time_t newest {0};
+
+    for(std::size_t i {0}; i < Parameters::ShardCount; ++i)
+    {
+        const Shard& shard = mShards[i];
+        ReadLock lk {shard.lock};
+
+        IdT id {shard.regs.findDevice(user, deviceId)};
+
+        if(id != RegistrationTable::InvalidId and
+           (node.empty() or shard.regs.getTimestamp(id) >= newest))
+        {
+            node = shard.regs.getNode(id).str();
+            newest = shard.regs.getTimestamp(id);
+        }
+    }
+
+    if(node.empty())
+    {
+        return node;
+    }
+
+    // the registration may have been replaced in the meantime
+    bool erased
+    {
+        eraseIf(
+            node,
+            [&user, deviceId](const RegistrationTable& regs, IdT id)
+            {
+                return regs.getUser(id).equalsBare(user) and regs.getDeviceId(id) == deviceId;
+            }
+        )
+    };
+
+    return erased ? node : std::string {};
+}
+
+bool RegistrationStore::hasDevice(const Jid& user, StringView deviceId) const
+{
+    for(std::size_t i {0}; i < Parameters::ShardCount; ++i)
+    {
+        const Shard& shard = mShards[i];
+        ReadLock lk {shard.lock};
+
+        if(shard.regs.findDevice(user, deviceId) != RegistrationTable::InvalidId)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::vector<RegistrationTable>
+RegistrationStore::copy(const std::function<void()>& whileLocked) const
+{
+    std::vector<RegistrationTable> ret;
+    ret.reserve(Parameters::ShardCount);
+
+    std::size_t locked {0};
+
+    try
+    {
+        // always in shard order, writers only ever hold one shard
+        for(; locked < Parameters::ShardCount; ++locked)
+        {
+            mShards[locked].lock.lockShared();
+            ret.push_back(mShards[locked].regs);
+        }
+
+        whileLocked();
+    }
+
+    catch(...)
+    {
+        unlockShared(locked + (locked < Parameters::ShardCount ? 1 : 0));
+        throw;
+    }
+
+    unlockShared(locked);
+
+    return ret;
+}
+
+void RegistrationStore::unlockShared(std::size_t count) const
+{
+    for(std::size_t i {0}; i < count; ++i)
+    {
+        mShards[i].lock.unlockShared();
+    }
+}
+
+void RegistrationStore::loadTables(const std::vector<const RegistrationTable*>& tables)
+{
+    std::size_t count {0};
+
+    for(const RegistrationTable* regs : tables)
+    {
+        count += regs->size();
+    }
+
+    std::size_t threadCount
+    {
+        std::max<std::size_t>(
+            1,
+            std::min<std::size_t>({std::thread::hardware_concurrency(),
+                                   Parameters::ShardCount,
+                                   count / Parameters::MinLoadPerThread})
+        )
+    };
+
+    // every thread fills its own shards, each takes all tables through
+    auto loadShards =
+    [this, &tables, count, threadCount](std::size_t first)
+    {
+        for(std::size_t i {first}; i < Parameters::ShardCount; i += threadCount)
+        {
+            std::lock_guard<RWLock> lk {mShards[i].lock};
+            mShards[i].regs.reserve(mShards[i].regs.size() + count / Parameters::ShardCount);
+        }
+
+        for(const RegistrationTable* regs : tables)
+        {
+            regs->forEach(
+                [this, regs, threadCount, first](IdT id)
+                {
+                    StringView node {regs->getNode(id)};
+                    std::size_t index {getShardIndex(node)};
+
+                    if(index % threadCount != first)
+                    {
+                        return;
+                    }
+
+                    std::string nodeStr {node.str()};
+                    Registration reg {regs->getRegistration(id)};
+
+                    Shard& shard = mShards[index];
+                    std::lock_guard<RWLock> lk {shard.lock};
+
+                    if(not shard.regs.insert(nodeStr, reg))
+                    {
+                        shard.regs.set(nodeStr, reg);
+                    }
+                }
+            );
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for(std::size_t i {1}; i < threadCount; ++i)
+    {
+        threads.emplace_back(loadShards, i);
+    }
+
+    loadShards(0);
+
+    for(std::thread& t : threads)
+    {
+        t.join();
+    }
+}
+
+std::size_t RegistrationStore::getShardIndex(StringView node) const
+{
+    return std::hash<StringView> {} (node) % Parameters::ShardCount;
+}
+
+RegistrationStore::Shard& RegistrationStore::getShard(StringView node)
+{
+    return mShards[getShardIndex(node)];
+}
+
+const RegistrationStore::Shard& RegistrationStore::getShard(StringView node) const
+{
+    return mShards[getShardIndex(node)];
+}
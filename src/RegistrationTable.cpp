@@ -0,0 +1,435 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "RegistrationTable.hpp"
+
+#include <stdexcept>
+
+using namespace Oshiya;
+
+const RegistrationTable::IdT RegistrationTable::InvalidId;
+const RegistrationTable::IdT RegistrationTable::Index::Empty;
+const RegistrationTable::IdT RegistrationTable::Index::Deleted;
+
+void RegistrationTable::Index::erase(std::size_t hash, IdT id)
+{
+    if(mSlots.empty())
+    {
+        return;
+    }
+
+    for(std::size_t pos {mix(hash) & mMask}; ; pos = (pos + 1) & mMask)
+    {
+        Slot& slot = mSlots[pos];
+
+        if(slot.id == Empty)
+        {
+            return;
+        }
+
+        if(slot.id == id)
+        {
+            slot.id = Deleted;
+            --mLive;
+
+            return;
+        }
+    }
+}
+
+void RegistrationTable::Index::reserve(std::size_t count)
+{
+    if(makeCapacity(count) > mSlots.size())
+    {
+        // only ever called on an empty index, nothing to rehash
+        mSlots.assign(makeCapacity(count), Slot {0, Empty});
+        mMask = mSlots.size() - 1;
+        mUsed = mLive;
+    }
+}
+
+std::size_t RegistrationTable::Index::mix(std::size_t hash)
+{
+    // murmur3's finalizer, the string hashes' low bits aren't well mixed
+    uint64_t h {hash};
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+
+    return static_cast<std::size_t>(h);
+}
+
+uint32_t RegistrationTable::Index::makeTag(std::size_t hash)
+{
+    return static_cast<uint32_t>(static_cast<uint64_t>(hash) >> 32) ^
+           static_cast<uint32_t>(hash);
+}
+
+void RegistrationTable::Index::place(std::size_t hash, IdT id)
+{
+    for(std::size_t pos {mix(hash) & mMask}; ; pos = (pos + 1) & mMask)
+    {
+        Slot& slot = mSlots[pos];
+
+        if(slot.id == Empty or slot.id == Deleted)
+        {
+            if(slot.id == Empty)
+            {
+                ++mUsed;
+            }
+
+            slot.tag = makeTag(hash);
+            slot.id = id;
+            ++mLive;
+
+            return;
+        }
+    }
+}
+
+std::size_t RegistrationTable::Index::makeCapacity(std::size_t count)
+{
+    // at most 3/4 full
+    std::size_t capacity {16};
+
+    while(capacity * 3 < count * 4)
+    {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+RegistrationTable::RegistrationTable()
+    : mGarbage {0}, mSize {0}
+{
+
+}
+
+void RegistrationTable::reserve(std::size_t count)
+{
+    mRows.reserve(count);
+
+    if(mSize == 0)
+    {
+        mNodes.reserve(count);
+        mDevices.reserve(count);
+        mUsers.reserve(count);
+    }
+}
+
+bool RegistrationTable::insert(const std::string& node, const Registration& reg)
+{
+    if(find(node) != InvalidId)
+    {
+        return false;
+    }
+
+    IdT id;
+
+    if(mFreeIds.empty())
+    {
+        if(mRows.size() >= InvalidId - 1)
+        {
+            throw std::length_error {"RegistrationTable: too many registrations"};
+        }
+
+        id = static_cast<IdT>(mRows.size());
+        mRows.emplace_back();
+    }
+
+    else
+    {
+        id = mFreeIds.back();
+        mFreeIds.pop_back();
+    }
+
+    Row& row = mRows[id];
+
+    row.node = addString(node);
+    row.deviceId = addString(reg.getDeviceId());
+    row.deviceName = addString(reg.getDeviceName());
+    row.token = addString(reg.getToken());
+    row.appId = addString(reg.getAppId());
+    row.user = reg.getUser();
+    row.backendId = reg.getBackendId();
+    row.timestamp = static_cast<int64_t>(reg.getTimestamp());
+    row.used = true;
+
+    ++mSize;
+
+    auto hashNodeOf = [this](IdT i) {return hashNode(i);};
+    auto hashDeviceOf = [this](IdT i) {return hashDevice(i);};
+
+    mNodes.insert(hashNode(id), id, hashNodeOf);
+
+    // the newest registration of a device is the one found for it
+    IdT previous {findDevice(row.user, getDeviceId(id))};
+
+    if(previous != InvalidId)
+    {
+        mDevices.erase(hashDevice(previous), previous);
+    }
+
+    mDevices.insert(hashDevice(id), id, hashDeviceOf);
+
+    linkUser(id);
+
+    return true;
+}
+
+void RegistrationTable::set(const std::string& node, const Registration& reg)
+{
+    erase(node);
+    insert(node, reg);
+}
+
+void RegistrationTable::merge(const RegistrationTable& other)
+{
+    reserve(mSize + other.size());
+
+    other.forEach(
+        [this, &other](IdT id)
+        {
+            std::string node {other.getNode(id).str()};
+            Registration reg {other.getRegistration(id)};
+
+            if(not insert(node, reg))
+            {
+                set(node, reg);
+            }
+        }
+    );
+}
+
+bool RegistrationTable::erase(StringView node)
+{
+    IdT id {find(node)};
+
+    if(id == InvalidId)
+    {
+        return false;
+    }
+
+    erase(id);
+
+    return true;
+}
+
+void RegistrationTable::erase(IdT id)
+{
+    Row& row = mRows[id];
+
+    mNodes.erase(hashNode(id), id);
+    mDevices.erase(hashDevice(id), id);
+    unlinkUser(id);
+
+    mGarbage += row.node.length + row.deviceId.length + row.deviceName.length +
+                row.token.length + row.appId.length;
+
+    row = Row {};
+    row.used = false;
+
+    mFreeIds.push_back(id);
+    --mSize;
+
+    if(mGarbage >= Parameters::MinCompactionGarbage and mGarbage * 2 > mStrings.size())
+    {
+        compactStrings();
+    }
+}
+
+RegistrationTable::IdT RegistrationTable::find(StringView node) const
+{
+    return mNodes.find(std::hash<StringView> {} (node),
+                       [this, node](IdT id) {return getNode(id) == node;});
+}
+
+RegistrationTable::IdT
+RegistrationTable::findDevice(const Jid& user, StringView deviceId) const
+{
+    return
+    mDevices.find(makeDeviceHash(user, deviceId),
+                  [this, &user, deviceId](IdT id)
+                  {
+                      return
+                      getDeviceId(id) == deviceId and mRows[id].user.equalsBare(user);
+                  });
+}
+
+Registration RegistrationTable::getRegistration(IdT id) const
+{
+    return
+    Registration
+    {
+        getUser(id),
+        getDeviceId(id).str(),
+        getDeviceName(id).str(),
+        getToken(id).str(),
+        getAppId(id).str(),
+        getBackendId(id),
+        getTimestamp(id)
+    };
+}
+
+std::size_t RegistrationTable::getMemoryUsage() const
+{
+    return
+    mRows.capacity() * sizeof(Row) +
+    mFreeIds.capacity() * sizeof(IdT) +
+    mStrings.capacity() +
+    mNodes.getMemoryUsage() +
+    mDevices.getMemoryUsage() +
+    mUsers.getMemoryUsage();
+}
+
+std::size_t RegistrationTable::makeDeviceHash(const Jid& user, StringView deviceId)
+{
+    // boost::hash_combine's mixing on the cached hash of the bare JID
+    std::size_t hash {user.bareHash()};
+
+    return
+    hash ^ (std::hash<StringView> {} (deviceId) + 0x9e3779b9 + (hash << 6) + (hash >> 2));
+}
+
+RegistrationTable::StringRef RegistrationTable::addString(StringView str)
+{
+    if(mStrings.size() + str.size() > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::length_error {"RegistrationTable: string arena full"};
+    }
+
+    StringRef ref {static_cast<uint32_t>(mStrings.size()),
+                   static_cast<uint32_t>(str.size())};
+
+    mStrings.insert(mStrings.end(), str.begin(), str.end());
+
+    return ref;
+}
+
+RegistrationTable::IdT RegistrationTable::findUserHead(const Jid& user) const
+{
+    return mUsers.find(user.bareHash(),
+                       [this, &user](IdT id) {return mRows[id].user.equalsBare(user);});
+}
+
+std::size_t RegistrationTable::hashNode(IdT id) const
+{
+    return std::hash<StringView> {} (getNode(id));
+}
+
+std::size_t RegistrationTable::hashDevice(IdT id) const
+{
+    return makeDeviceHash(mRows[id].user, getDeviceId(id));
+}
+
+std::size_t RegistrationTable::hashUser(IdT id) const
+{
+    return mRows[id].user.bareHash();
+}
+
+void RegistrationTable::linkUser(IdT id)
+{
+    Row& row = mRows[id];
+    IdT head {findUserHead(row.user)};
+
+    row.prevOfUser = InvalidId;
+    row.nextOfUser = InvalidId;
+
+    if(head == InvalidId)
+    {
+        mUsers.insert(hashUser(id), id, [this](IdT i) {return hashUser(i);});
+        return;
+    }
+
+    // right behind the head, which keeps the index as is
+    Row& headRow = mRows[head];
+
+    row.prevOfUser = head;
+    row.nextOfUser = headRow.nextOfUser;
+
+    if(headRow.nextOfUser != InvalidId)
+    {
+        mRows[headRow.nextOfUser].prevOfUser = id;
+    }
+
+    headRow.nextOfUser = id;
+}
+
+void RegistrationTable::unlinkUser(IdT id)
+{
+    Row& row = mRows[id];
+
+    if(row.prevOfUser != InvalidId)
+    {
+        mRows[row.prevOfUser].nextOfUser = row.nextOfUser;
+
+        if(row.nextOfUser != InvalidId)
+        {
+            mRows[row.nextOfUser].prevOfUser = row.prevOfUser;
+        }
+
+        return;
+    }
+
+    // the head, the next row takes its place in the index
+    mUsers.erase(hashUser(id), id);
+
+    if(row.nextOfUser != InvalidId)
+    {
+        IdT next {row.nextOfUser};
+
+        mRows[next].prevOfUser = InvalidId;
+        mUsers.insert(hashUser(next), next, [this](IdT i) {return hashUser(i);});
+    }
+}
+
+void RegistrationTable::compactStrings()
+{
+    std::vector<char> strings;
+    strings.reserve(mStrings.size() - mGarbage);
+
+    auto relocate =
+    [this, &strings](StringRef& ref)
+    {
+        uint32_t offset {static_cast<uint32_t>(strings.size())};
+
+        strings.insert(strings.end(),
+                       mStrings.begin() + ref.offset,
+                       mStrings.begin() + ref.offset + ref.length);
+
+        ref.offset = offset;
+    };
+
+    for(Row& row : mRows)
+    {
+        if(row.used)
+        {
+            relocate(row.node);
+            relocate(row.deviceId);
+            relocate(row.deviceName);
+            relocate(row.token);
+            relocate(row.appId);
+        }
+    }
+
+    mStrings.swap(strings);
+    mGarbage = 0;
+}
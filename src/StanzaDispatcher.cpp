@@ -17,12 +17,83 @@
  */
 
 #include "StanzaDispatcher.hpp"
+#include "Logger.hpp"
 
-// DEBUG:
-#include <iostream>
 
 using namespace Oshiya;
 
+namespace
+{
+    const char* getTypeStr(InPacket::Type type)
+    {
+        using Type = InPacket::Type;
+
+        switch(type)
+        {
+            case Type::AdhocCommand: return "adhoc_command";
+            case Type::IqResult: return "iq_result";
+            case Type::IqError: return "iq_error";
+            case Type::PushNotification: return "push_notification";
+            case Type::Invalid: return "invalid";
+        }
+
+        return "";
+    }
+}
+
+StanzaDispatcher::StanzaDispatcher(const std::string& component, unsigned int workerCount)
+{
+    using TypeT = std::underlying_type<InPacket::Type>::type;
+
+    for(TypeT t {0}; t <= static_cast<TypeT>(InPacket::Type::Invalid); ++t)
+    {
+        mReceivedCounters.push_back(
+            &Metrics::getRegistry().getCounter(
+                "oshiya_stanzas_received_total",
+                "Stanzas received, by the packet type they were parsed as.",
+                {{"component", component},
+                 {"type", getTypeStr(static_cast<InPacket::Type>(t))}}
+            )
+        );
+    }
+
+    for(unsigned int i {0}; i < workerCount; ++i)
+    {
+        mWorkers.emplace_back(make_unique<Worker>());
+    }
+
+    for(auto& worker : mWorkers)
+    {
+        worker->thread = std::thread {&StanzaDispatcher::runWorker, this, std::ref(*worker)};
+    }
+}
+
+StanzaDispatcher::~StanzaDispatcher()
+{
+    stopWorkers();
+}
+
+void StanzaDispatcher::stopWorkers()
+{
+    for(auto& worker : mWorkers)
+    {
+        {
+            std::lock_guard<std::mutex> lk {worker->mutex};
+            worker->stop = true;
+        }
+
+        worker->cv.notify_one();
+    }
+
+    for(auto& worker : mWorkers)
+    {
+        if(worker->thread.joinable())
+        {
+            worker->thread.join();
+        }
+    }
+}
+
 void StanzaDispatcher::handleMessage(const XmlElement& message)
 {
     const auto& makeString = Util::makeString;
@@ -76,9 +147,7 @@ void StanzaDispatcher::handleIq(const XmlElement& iq)
         {
             // we're ignoring iq results without id
 
-            // TODO:
-            // log warning
-            std::cout << "WARNING: received iq result without id" << std::endl;
+            LOG_WARNING(Stanza, "received iq result without id");
         }
 
         return;
@@ -95,9 +164,7 @@ void StanzaDispatcher::handleIq(const XmlElement& iq)
         {
             // we're ignoring iq errors without id
             
-            // TODO:
-            // log warning
-            std::cout << "WARNING: received iq error without id" << std::endl;
+            LOG_WARNING(Stanza, "received iq error without id");
         }
 
         return;
@@ -139,16 +206,17 @@ void StanzaDispatcher::handlePubsubEvent(const XmlElement& event,
 
                     if(xdata and makeString(xmpp_stanza_get_name(xdata)) == "x")
                     {
-                        XData parsedXData {Util::parseXData(XmlElement {xdata})};
-
+                        // read right off the stanza, the payload map is the
+                        // only copy
                         dispatch(
-                            InStanza<Type::PushNotification>
-                            {
+                            make_unique<InStanza<Type::PushNotification>>
+                            (
                                 getStanzaHandler<Type::PushNotification>(),
                                 from,
                                 node,
-                                parsedXData
-                            }
+                                Util::makeValueMap(XDataView {xdata})
+                            ),
+                            node
                         );
                     }
                 }
@@ -202,15 +270,16 @@ void StanzaDispatcher::handleIqSet(const XmlElement& iq,
             }
 
             dispatch(
-                InStanza<Type::AdhocCommand>
-                {
+                make_unique<InStanza<Type::AdhocCommand>>
+                (
                     getStanzaHandler<Type::AdhocCommand>(),
                     from,
                     id,
-                    action,
-                    node,
-                    parsedXData
-                }
+                    std::move(action),
+                    std::move(node),
+                    std::move(parsedXData)
+                ),
+                from.bare()
             );
 
             return;
@@ -229,16 +298,17 @@ void StanzaDispatcher::handleIqResult(const XmlElement&,
 {
     using Type = InPacket::Type;
 
-    // DEBUG:
-    std::cout << "handleIq: dispatching IqResult" << std::endl;
+    LOG_DEBUG(Stanza, "handleIq: dispatching IqResult");
 
     dispatch(
-        InStanza<Type::IqResult>
-        {
+        make_unique<InStanza<Type::IqResult>>
+        (
             getStanzaHandler<Type::IqResult>(),
             from,
             id
-        }
+        ),
+        // every answer comes from the pubsub service, its ids spread them
+        id
     );
 }
 
@@ -269,14 +339,15 @@ void StanzaDispatcher::handleIqError(const XmlElement& iq,
         }
 
         dispatch(
-            InStanza<Type::IqError>
-            {
+            make_unique<InStanza<Type::IqError>>
+            (
                 getStanzaHandler<Type::IqError>(),
                 from,
                 id,
-                type,
-                errors
-            }
+                std::move(type),
+                std::move(errors)
+            ),
+            id
         );
     }
 }
@@ -290,8 +361,7 @@ void StanzaDispatcher::handleInvalidStanza(const XmlElement& iq,
 {
     using Type = InPacket::Type;
 
-    // DEBUG:
-    std::cout << "DEBUG: in handleInvalidStanza" << std::endl;
+    LOG_DEBUG(Stanza, "in handleInvalidStanza");
 
     XmlElement error
     {
@@ -303,13 +373,82 @@ void StanzaDispatcher::handleInvalidStanza(const XmlElement& iq,
                               appSpecificNs)
     };
 
-    dispatch(InStanza<Type::Invalid> {getStanzaHandler<Type::Invalid>(), error});
-}
+    // the error stanza is sent right away by the handler, which must happen
+    // on the strophe thread
+    InStanza<Type::Invalid> packet {getStanzaHandler<Type::Invalid>(), std::move(error)};
+
+    mReceivedCounters[static_cast<std::size_t>(Type::Invalid)]->increment();
 
-void StanzaDispatcher::dispatch(const InPacket& packet)
-{
     if(packet.hasHandler())
     {
         packet.callHandler();
     }
 }
+
+void StanzaDispatcher::dispatch(std::unique_ptr<InPacket>&& packet,
+                                const std::string& shardKey)
+{
+    mReceivedCounters[static_cast<std::size_t>(packet->getType())]->increment();
+
+    if(not packet->hasHandler())
+    {
+        return;
+    }
+
+    if(mWorkers.empty())
+    {
+        packet->callHandler();
+        return;
+    }
+
+    Worker& worker = *mWorkers[std::hash<std::string> {} (shardKey) % mWorkers.size()];
+
+    {
+        std::lock_guard<std::mutex> lk {worker.mutex};
+        worker.queue.emplace_back(std::move(packet));
+    }
+
+    worker.cv.notify_one();
+}
+
+void StanzaDispatcher::runWorker(Worker& worker)
+{
+    std::deque<std::unique_ptr<InPacket>> packets;
+
+    while(true)
+    {
+        bool stop;
+
+        {
+            std::unique_lock<std::mutex> lk {worker.mutex};
+
+            worker.cv.wait(
+                lk,
+                [&worker]() {return worker.stop or not worker.queue.empty();}
+            );
+
+            stop = worker.stop;
+            packets.swap(worker.queue);
+        }
+
+        if(stop and not packets.empty())
+        {
+            // nothing is dispatched anymore, what's left still gets handled,
+            // e.g. notifications still reach the backends and their spools
+            LOG_INFO(Stanza, "handling " << packets.size()
+                             << " packets queued at shutdown");
+        }
+
+        for(const auto& packet : packets)
+        {
+            packet->callHandler();
+        }
+
+        packets.clear();
+
+        if(stop)
+        {
+            return;
+        }
+    }
+}
@@ -17,7 +17,9 @@
  */
 
 #include "UbuntuBackend.hpp"
+#include "Logger.hpp"
 
+#include "SmartPointerUtil.hpp"
 #include "curl_header.h"
 #include <cstring>
 
@@ -25,27 +27,35 @@ using namespace Oshiya;
 
 UbuntuBackend::UbuntuBackend(const Jid& host,
                              const std::string& appName,
-                             const std::string& certFile)
+                             const std::string& certFile,
+                             const Options& options)
     : 
         Backend(Backend::Type::Ubuntu,
                 host,
                 appName,
-                certFile)
+                certFile,
+                options)
 {
-    startWorker();
+    for(std::size_t i {0}; i < options.workers; ++i)
+    {
+        mCurls.push_back(make_unique<curl::curl_easy>());
+    }
+
+    startWorkers();
 }
 
 UbuntuBackend::~UbuntuBackend()
 {
-
+    stopWorkers();
 }
 
 Backend::NotificationQueueT
-UbuntuBackend::send(const NotificationQueueT& notifications)
+UbuntuBackend::send(const NotificationQueueT& notifications, std::size_t worker)
 {
-    std::cout << "DEBUG: in UbuntuBackend::send" << std::endl;
+    LOG_DEBUG(Backend, "in UbuntuBackend::send");
 
     NotificationQueueT retryQueue;
+    curl::curl_easy& curl = *mCurls[worker];
 
     for(auto it = notifications.cbegin(); it != notifications.cend(); ++it)
     {
@@ -63,52 +73,53 @@ UbuntuBackend::send(const NotificationQueueT& notifications)
         curl_header header;
         header.add("Content-Type:application/json");
 
-        mCurl.add(
+        curl.add(
             curl_pair<CURLoption, curl_header>
             {CURLOPT_HTTPHEADER, header}
         );
 
-        mCurl.add(
+        curl.add(
             curl_pair<CURLoption, std::string>
-            {CURLOPT_URL, "https://push.ubuntu.com/notify"}
+            {CURLOPT_URL,
+             options.url.empty() ? "https://push.ubuntu.com/notify" : options.url}
         );
 
-        mCurl.add(
+        curl.add(
             curl_pair<CURLoption, std::string>
             {CURLOPT_SSLCERT, certFile}
         );
 
-        mCurl.add(
+        curl.add(
             curl_pair<CURLoption, std::string>
             {CURLOPT_SSLKEY, certFile}
         );
 
-        mCurl.add(
+        curl.add(
             curl_pair<CURLoption, bool>
             {CURLOPT_SSL_VERIFYPEER, true}
         );
 
-        mCurl.add(
+        curl.add(
             curl_pair<CURLoption, std::string>
             {CURLOPT_POSTFIELDS, payload}
         );
 
-        mCurl.add(
+        curl.add(
             curl_pair<CURLoption, void*>
             {CURLOPT_WRITEDATA, &responseBody}
         );
 
-        mCurl.add(
+        curl.add(
             curl_pair<CURLoption, decltype(&UbuntuBackend::bodyWriteCb)>
             {CURLOPT_WRITEFUNCTION, bodyWriteCb}
         );
 
         try
         {
-            mCurl.perform();
+            curl.perform();
 
             std::unique_ptr<long> responseCode
-            {mCurl.get_info<long>(CURLINFO_RESPONSE_CODE)};
+            {curl.get_info<long>(CURLINFO_RESPONSE_CODE)};
 
             /**
              * Error conditions - extracted from
@@ -165,15 +176,14 @@ UbuntuBackend::send(const NotificationQueueT& notifications)
 
         catch(curl_easy_exception error)
         {
-            // DEBUG:
-            std::cout << "DEBUG: curl exception!" << std::endl;
+            LOG_DEBUG(Backend, "curl exception!");
             error.print_traceback();
 
             // connection error
             retryQueue.insert(retryQueue.end(), it, notifications.cend());
         }
 
-        mCurl.reset();
+        curl.reset();
     }
 
     return retryQueue;
@@ -224,15 +234,22 @@ std::string UbuntuBackend::makePayload(const std::string& appId,
     jsonPayload["clear_pending"] = true;
     jsonPayload["data"] = data;
 
-    return mWriter.write(jsonPayload);
+    // writers keep state, so every call (and worker) gets its own
+    Json::StyledWriter writer;
+
+    return writer.write(jsonPayload);
 }
 
 std::string UbuntuBackend::getIso8601Date(const std::chrono::system_clock::time_point& date)
 {
     std::time_t t {std::chrono::system_clock::to_time_t(date)};
 
+    // gmtime() isn't thread-safe and the workers run concurrently
+    std::tm tm;
+    gmtime_r(&t, &tm);
+
     char buf[sizeof "2011-10-08T07:07:09Z"];
-    std::strftime(buf, sizeof buf, "%FT%TZ", gmtime(&t));
+    std::strftime(buf, sizeof buf, "%FT%TZ", &tm);
 
     return buf;
 }
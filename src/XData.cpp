@@ -22,10 +22,10 @@
 
 using namespace Oshiya;
 
-XData::Field::Field(const std::string& _type,
-                    const std::string& _var,
-                    const std::vector<std::string>& _values)
-    : type {_type}, var {_var}, values {_values}
+XData::Field::Field(std::string _type,
+                    std::string _var,
+                    std::vector<std::string> _values)
+    : type {std::move(_type)}, var {std::move(_var)}, values {std::move(_values)}
 {
 
 }
@@ -40,43 +40,45 @@ std::string XData::Field::singleValue() const
     return values.empty() ? "" : values.front();
 }
 
-XData::Item::Item(const std::vector<Field>& fields)
-    : mFields {fields}
+XData::Item::Item(std::vector<Field> fields)
+    : mFields {std::move(fields)}
 {
 
 }
 
-XData::XData(const std::string& type)
-    : mType {type}
+XData::XData(std::string type)
+    : mType {std::move(type)}
 {
 
 }
 
-XData::XData(const std::string& type, const std::vector<Field>& fields)
-    : mType {type}, mFields {fields}
+XData::XData(std::string type, std::vector<Field> fields)
+    : mType {std::move(type)}, mFields {std::move(fields)}
 {
 
 }
 
-XData::XData(const std::string& type, const std::vector<Item>& items)
-    : mType {type}, mItems {items}
+XData::XData(std::string type, std::vector<Item> items)
+    : mType {std::move(type)}, mItems {std::move(items)}
 {
 
 }
 
-void XData::addField(const Field& field)
+void XData::addField(Field field)
 {
-    mFields.push_back(field);
+    mFields.push_back(std::move(field));
 }
 
-void XData::addItem(const Item& item)
+void XData::addItem(Item item)
 {
-    mItems.push_back(item);
+    mItems.push_back(std::move(item));
 }
 
-XData::Field XData::getField(const std::string& var,
-                             const std::string& type) const
+const XData::Field& XData::getField(const std::string& var,
+                                    const std::string& type) const
 {
+    static const Field invalid {};
+
     auto result =
     std::find_if(mFields.begin(), mFields.end(),
                  [&var](const Field& f) {return f.var == var;});
@@ -89,5 +91,5 @@ XData::Field XData::getField(const std::string& var,
         }
     }
 
-    return Field {};
+    return invalid;
 }
@@ -0,0 +1,107 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "XDataView.hpp"
+
+#include <cstring>
+
+using namespace Oshiya;
+
+void XDataView::Field::appendValue(std::string& out) const
+{
+    xmpp_stanza_t* value {getFirstValue()};
+
+    if(value == nullptr)
+    {
+        return;
+    }
+
+    for(xmpp_stanza_t* text {xmpp_stanza_get_children(value)};
+        text != nullptr;
+        text = xmpp_stanza_get_next(text))
+    {
+        // null for elements, values only hold text though
+        const char* chunk {xmpp_stanza_get_text_ptr(text)};
+
+        if(chunk != nullptr)
+        {
+            out.append(chunk);
+        }
+    }
+}
+
+xmpp_stanza_t* XDataView::Field::getFirstValue() const
+{
+    for(xmpp_stanza_t* child {xmpp_stanza_get_children(mField)};
+        child != nullptr;
+        child = xmpp_stanza_get_next(child))
+    {
+        const char* name {xmpp_stanza_get_name(child)};
+
+        if(name != nullptr and std::strcmp(name, "value") == 0)
+        {
+            return child;
+        }
+    }
+
+    return nullptr;
+}
+
+xmpp_stanza_t* XDataView::FieldIterator::skip(xmpp_stanza_t* child)
+{
+    while(child != nullptr)
+    {
+        const char* name {xmpp_stanza_get_name(child)};
+
+        if(name != nullptr and std::strcmp(name, "field") == 0)
+        {
+            return child;
+        }
+
+        child = xmpp_stanza_get_next(child);
+    }
+
+    return nullptr;
+}
+
+std::map<std::string, std::string> Util::makeValueMap(const XDataView& form)
+{
+    std::map<std::string, std::string> ret;
+
+    for(const XDataView::Field& field : form)
+    {
+        StringView var {field.getVar()};
+        StringView type {field.getType()};
+
+        if(var.empty() or not (type.empty() or type == "text-single") or
+           not field.hasValue())
+        {
+            continue;
+        }
+
+        auto result = ret.emplace(var.str(), std::string {});
+
+        if(result.second)
+        {
+            field.appendValue(result.first->second);
+        }
+    }
+
+    return ret;
+}
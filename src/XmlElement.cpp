@@ -49,23 +49,23 @@ XmlElement& XmlElement::operator=(const XmlElement& other)
     return *this;
 }
 
-//XmlElement::XmlElement(XmlElement&& other)
-//    : mStanza {other.mStanza}
-//{
-//    other.mStanza = nullptr;
-//}
+XmlElement::XmlElement(XmlElement&& other) noexcept
+    : mStanza {other.mStanza}
+{
+    other.mStanza = nullptr;
+}
+
+XmlElement& XmlElement::operator=(XmlElement&& other) noexcept
+{
+    if(this != &other)
+    {
+        free();
+        mStanza = other.mStanza;
+        other.mStanza = nullptr;
+    }
 
-//XmlElement& XmlElement::operator=(XmlElement&& other)
-//{
-//    if(this != &other)
-//    {
-//        free();
-//        mStanza = other.mStanza;
-//        other.mStanza = nullptr;
-//    }
-//
-//    return *this;
-//}
+    return *this;
+}
 
 XmlElement::~XmlElement()
 {
@@ -124,7 +124,7 @@ XData Util::parseXData(const XmlElement& el)
 
     std::string type {makeString(xmpp_stanza_get_type(elPtr))};
      
-    XData ret {type};
+    XData ret {std::move(type)};
 
     while(field)
     {
@@ -149,14 +149,15 @@ XData Util::parseXData(const XmlElement& el)
                 value = xmpp_stanza_get_next(value);
             }
 
-            XData::Field newField {fieldType, var, values};
+            XData::Field newField
+            {std::move(fieldType), std::move(var), std::move(values)};
 
             if(not newField.isValid())
             {
                 throw std::runtime_error {""};
             }
 
-            ret.addField(newField);
+            ret.addField(std::move(newField));
         }
 
         field = xmpp_stanza_get_next(field);
@@ -172,7 +173,7 @@ XmlElement Util::makeXDataElement(const XData& xdata, xmpp_ctx_t* ctx)
     xmpp_stanza_set_name(x, "x");
     xmpp_stanza_set_ns(x, "jabber:x:data");
     
-    std::string formType {xdata.getType()};
+    const std::string& formType = xdata.getType();
 
     if(not formType.empty())
     {
@@ -212,7 +213,7 @@ XmlElement Util::makeXDataElement(const XData& xdata, xmpp_ctx_t* ctx)
         }
     };
 
-    std::vector<XData::Field> fields {xdata.getFields()};
+    const std::vector<XData::Field>& fields = xdata.getFields();
    
     if(not fields.empty())
     {
@@ -264,5 +265,5 @@ XmlElement Util::makeXDataElement(const XData& xdata, xmpp_ctx_t* ctx)
     XmlElement ret {x};
     xmpp_stanza_release(x);
 
-    return x;
+    return ret;
 }
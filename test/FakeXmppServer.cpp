@@ -0,0 +1,437 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "FakeXmppServer.hpp"
+#include "XmppUtils.hpp"
+
+#include <openssl/evp.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+
+using namespace Oshiya;
+
+namespace
+{
+    const std::string RegistrationIdPrefix {"reg"};
+}
+
+FakeXmppServer::FakeXmppServer(const std::string& componentJid,
+                               const std::string& password,
+                               const std::string& pubsubJid)
+    :
+        mComponentJid {componentJid},
+        mPassword {password},
+        mPubsubJid {pubsubJid},
+        mContext {xmpp_ctx_new(nullptr, nullptr)},
+        mListenFd {socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)},
+        mWakeupFd {eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
+        mPort {0},
+        mFd {-1},
+        mStreamCount {0},
+        mStreamClosed {false},
+        mConnected {false},
+        mAnsweredRegistrations {0},
+        mNextRegistrationId {0},
+        mPubsubRequestCount {0}
+{
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLength {sizeof addr};
+
+    if(mListenFd == -1 or mWakeupFd == -1 or
+       bind(mListenFd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == -1 or
+       listen(mListenFd, SOMAXCONN) == -1 or
+       getsockname(mListenFd, reinterpret_cast<sockaddr*>(&addr), &addrLength) == -1)
+    {
+        int error {errno};
+
+        close(mListenFd);
+        close(mWakeupFd);
+        xmpp_ctx_free(mContext);
+
+        throw std::system_error {error, std::generic_category(),
+                                 "could not set up the fake XMPP server"};
+    }
+
+    mPort = ntohs(addr.sin_port);
+
+    mThread = std::thread {&FakeXmppServer::run, this};
+}
+
+FakeXmppServer::~FakeXmppServer()
+{
+    uint64_t one {1};
+
+    while(write(mWakeupFd, &one, sizeof one) == -1 and errno == EINTR) { }
+
+    mThread.join();
+
+    close(mListenFd);
+    close(mWakeupFd);
+
+    xmpp_ctx_free(mContext);
+}
+
+bool FakeXmppServer::waitForComponent(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lk {mMutex};
+
+    return mCv.wait_for(lk, timeout, [this]() {return mConnected;});
+}
+
+void FakeXmppServer::registerDevice(const std::string& user,
+                                    const std::string& backendType,
+                                    const std::string& token)
+{
+    uint64_t id;
+
+    {
+        std::lock_guard<std::mutex> lk {mMutex};
+        id = mNextRegistrationId++;
+    }
+
+    send("<iq type='set' id='" + RegistrationIdPrefix + std::to_string(id) + "'"
+         " from='" + user + "' to='" + mComponentJid + "'>"
+         "<command xmlns='http://jabber.org/protocol/commands'"
+         " node='register-push-" + backendType + "' action='execute'>"
+         "<x xmlns='jabber:x:data' type='submit'>"
+         "<field var='token'><value>" + token + "</value></field>"
+         "<field var='device-name'><value>benchmark</value></field>"
+         "</x></command></iq>");
+}
+
+bool FakeXmppServer::waitForRegistrations(std::size_t count,
+                                          std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lk {mMutex};
+
+    return
+    mCv.wait_for(lk, timeout, [this, count]() {return mAnsweredRegistrations >= count;});
+}
+
+std::vector<std::string> FakeXmppServer::getNodes() const
+{
+    std::lock_guard<std::mutex> lk {mMutex};
+
+    return mNodes;
+}
+
+std::size_t FakeXmppServer::getFailedRegistrations() const
+{
+    std::lock_guard<std::mutex> lk {mMutex};
+
+    return mAnsweredRegistrations - mNodes.size();
+}
+
+void FakeXmppServer::publish(const std::string& node,
+                             const std::string& seqField,
+                             uint64_t seq)
+{
+    // a summary as XEP-0357 describes it, as an XMPP server would publish it
+    send("<message from='" + mPubsubJid + "' to='" + mComponentJid + "'"
+         " id='pub" + std::to_string(seq) + "'>"
+         "<event xmlns='http://jabber.org/protocol/pubsub#event'>"
+         "<items node='" + node + "'><item>"
+         "<notification xmlns='urn:xmpp:push:0'>"
+         "<x xmlns='jabber:x:data'>"
+         "<field var='FORM_TYPE'><value>urn:xmpp:push:summary</value></field>"
+         "<field var='message-count'><value>1</value></field>"
+         "<field var='last-message-sender'>"
+         "<value>juliet@capulet.example/balcony</value></field>"
+         "<field var='last-message-body'>"
+         "<value>Wherefore art thou, Romeo?</value></field>"
+         "<field var='" + seqField + "'><value>" + std::to_string(seq) + "</value></field>"
+         "</x></notification></item></items></event></message>");
+}
+
+void FakeXmppServer::run()
+{
+    while(true)
+    {
+        pollfd fds[2] {};
+        fds[0].fd = mListenFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = mWakeupFd;
+        fds[1].events = POLLIN;
+
+        if(poll(fds, 2, -1) == -1 and errno != EINTR)
+        {
+            return;
+        }
+
+        if(fds[1].revents != 0)
+        {
+            return;
+        }
+
+        if(fds[0].revents == 0)
+        {
+            continue;
+        }
+
+        int fd {accept4(mListenFd, nullptr, nullptr, SOCK_CLOEXEC)};
+
+        if(fd != -1)
+        {
+            // a reconnecting component gets the next connection
+            serveConnection(fd);
+        }
+    }
+}
+
+void FakeXmppServer::serveConnection(int fd)
+{
+    parser_t* parser {parser_new(mContext, streamStartCb, streamEndCb, stanzaCb, this)};
+
+    mStreamClosed = false;
+
+    {
+        std::lock_guard<std::mutex> lk {mSendMutex};
+        mFd = fd;
+    }
+
+    while(not mStreamClosed)
+    {
+        pollfd fds[2] {};
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = mWakeupFd;
+        fds[1].events = POLLIN;
+
+        if(poll(fds, 2, -1) == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        if(fds[1].revents != 0)
+        {
+            break;
+        }
+
+        char chunk[16384];
+        ssize_t count {read(fd, chunk, sizeof chunk)};
+
+        if(count <= 0 or not parser_feed(parser, chunk, static_cast<int>(count)))
+        {
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lk {mSendMutex};
+        mFd = -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk {mMutex};
+        mConnected = false;
+    }
+
+    parser_free(parser);
+    close(fd);
+}
+
+void FakeXmppServer::send(const std::string& data)
+{
+    std::lock_guard<std::mutex> lk {mSendMutex};
+
+    std::size_t written {0};
+
+    while(mFd != -1 and written < data.size())
+    {
+        ssize_t count {::send(mFd, data.data() + written, data.size() - written, MSG_NOSIGNAL)};
+
+        if(count == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            // the connection's thread notices as well
+            return;
+        }
+
+        written += count;
+    }
+}
+
+void FakeXmppServer::streamStartCb(char*, char**, void* const userData)
+{
+    FakeXmppServer* server {static_cast<FakeXmppServer*>(userData)};
+
+    server->mStreamId = "bench" + std::to_string(++server->mStreamCount);
+
+    server->send("<?xml version='1.0'?>"
+                 "<stream:stream xmlns='jabber:component:accept'"
+                 " xmlns:stream='http://etherx.jabber.org/streams'"
+                 " from='" + server->mComponentJid + "'"
+                 " id='" + server->mStreamId + "'>");
+}
+
+void FakeXmppServer::streamEndCb(char*, void* const userData)
+{
+    FakeXmppServer* server {static_cast<FakeXmppServer*>(userData)};
+
+    server->send("</stream:stream>");
+    server->mStreamClosed = true;
+}
+
+void FakeXmppServer::stanzaCb(xmpp_stanza_t* stanza, void* const userData)
+{
+    static_cast<FakeXmppServer*>(userData)->handleStanza(stanza);
+}
+
+void FakeXmppServer::handleStanza(xmpp_stanza_t* stanza)
+{
+    std::string name {Util::makeString(xmpp_stanza_get_name(stanza))};
+
+    if(name == "handshake")
+    {
+        handleHandshake(stanza);
+    }
+
+    else if(name == "iq")
+    {
+        handleIq(stanza);
+    }
+}
+
+void FakeXmppServer::handleHandshake(xmpp_stanza_t* stanza)
+{
+    // the component proves it knows the password with SHA-1(stream id + password)
+    std::string input {mStreamId + mPassword};
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength {0};
+
+    EVP_Digest(input.data(), input.size(), digest, &digestLength, EVP_sha1(), nullptr);
+
+    std::string expected;
+
+    for(unsigned int i {0}; i < digestLength; ++i)
+    {
+        char hex[3];
+        std::snprintf(hex, sizeof hex, "%02x", digest[i]);
+        expected += hex;
+    }
+
+    char* text {xmpp_stanza_get_text(stanza)};
+    std::string received {Util::makeString(text)};
+    xmpp_free(mContext, text);
+
+    if(received != expected)
+    {
+        send("<stream:error>"
+             "<not-authorized xmlns='urn:ietf:params:xml:ns:xmpp-streams'/>"
+             "</stream:error></stream:stream>");
+        mStreamClosed = true;
+        return;
+    }
+
+    send("<handshake/>");
+
+    {
+        std::lock_guard<std::mutex> lk {mMutex};
+        mConnected = true;
+    }
+
+    mCv.notify_all();
+}
+
+void FakeXmppServer::handleIq(xmpp_stanza_t* stanza)
+{
+    const auto& makeString = Util::makeString;
+
+    std::string type {makeString(xmpp_stanza_get_type(stanza))};
+    std::string id {makeString(xmpp_stanza_get_id(stanza))};
+    std::string to {makeString(xmpp_stanza_get_attribute(stanza, "to"))};
+
+    if(to == mPubsubJid)
+    {
+        // node creation, affiliations, subscriptions, deletion: all granted
+        if(type == "set" or type == "get")
+        {
+            ++mPubsubRequestCount;
+
+            send("<iq type='result' from='" + mPubsubJid + "'"
+                 " to='" + mComponentJid + "' id='" + id + "'/>");
+        }
+
+        return;
+    }
+
+    // otherwise it's the answer to a user's command
+    if((type != "result" and type != "error") or
+       id.compare(0, RegistrationIdPrefix.size(), RegistrationIdPrefix) != 0)
+    {
+        return;
+    }
+
+    std::string node;
+
+    if(type == "result")
+    {
+        xmpp_stanza_t* command {xmpp_stanza_get_child_by_name(stanza, "command")};
+        xmpp_stanza_t* xdata
+        {command ? xmpp_stanza_get_child_by_ns(command, "jabber:x:data") : nullptr};
+
+        if(xdata)
+        {
+            try
+            {
+                node = Util::parseXData(XmlElement {xdata}).getField("node").singleValue();
+            }
+
+            catch(const std::runtime_error&)
+            {
+                // counts as failed
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lk {mMutex};
+
+        ++mAnsweredRegistrations;
+
+        if(not node.empty())
+        {
+            mNodes.push_back(node);
+        }
+    }
+
+    mCv.notify_all();
+}
@@ -0,0 +1,158 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OSHIYA_FAKE_XMPP_SERVER__H
+#define OSHIYA_FAKE_XMPP_SERVER__H
+
+extern "C"
+{
+    #include "strophe.h"
+    #include "src/parser.h"
+}
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Oshiya
+{
+    /**
+     * stand-in for the XMPP server a component connects to (XEP-0114) and
+     * for the XEP-0357 pubsub service behind it. The pubsub service grants
+     * every request right away, users send adhoc commands and notifications
+     * are published on the nodes their registrations got. Serves one
+     * component connection at a time on an ephemeral port of 127.0.0.1.
+     */
+    class FakeXmppServer
+    {
+        public:
+        ///////
+
+        /**
+         * throws std::system_error if it can't listen
+         */
+        FakeXmppServer(const std::string& componentJid,
+                       const std::string& password,
+                       const std::string& pubsubJid);
+
+        FakeXmppServer(const FakeXmppServer&) = delete;
+        FakeXmppServer(FakeXmppServer&&) = delete;
+
+        ~FakeXmppServer();
+
+        unsigned short getPort() const {return mPort;}
+
+        /**
+         * waits for the component to complete the handshake
+         */
+        bool waitForComponent(std::chrono::milliseconds timeout);
+
+        /**
+         * executes register-push-<backendType> from user (a full JID, the
+         * resource becomes the device id)
+         */
+        void registerDevice(const std::string& user,
+                            const std::string& backendType,
+                            const std::string& token);
+
+        /**
+         * waits until count registrations have been answered, successfully
+         * or not
+         */
+        bool waitForRegistrations(std::size_t count, std::chrono::milliseconds timeout);
+
+        /**
+         * the nodes of the successful registrations
+         */
+        std::vector<std::string> getNodes() const;
+
+        std::size_t getFailedRegistrations() const;
+
+        /**
+         * publishes a notification on node, seq is added to the summary in
+         * the text-single field seqField
+         */
+        void publish(const std::string& node,
+                     const std::string& seqField,
+                     uint64_t seq);
+
+        // pubsub requests the component sent
+        uint64_t getPubsubRequestCount() const {return mPubsubRequestCount;}
+
+        private:
+        ////////
+
+        void run();
+
+        void serveConnection(int fd);
+
+        /**
+         * writes to the component connection, nothing if there is none
+         */
+        void send(const std::string& data);
+
+        static void streamStartCb(char* name, char** attrs, void* const userData);
+
+        static void streamEndCb(char* name, void* const userData);
+
+        static void stanzaCb(xmpp_stanza_t* stanza, void* const userData);
+
+        void handleStanza(xmpp_stanza_t* stanza);
+
+        void handleHandshake(xmpp_stanza_t* stanza);
+
+        void handleIq(xmpp_stanza_t* stanza);
+
+        const std::string mComponentJid;
+        const std::string mPassword;
+        const std::string mPubsubJid;
+
+        xmpp_ctx_t* mContext;
+
+        int mListenFd;
+        int mWakeupFd;
+        unsigned short mPort;
+        std::thread mThread;
+
+        // the component connection, -1 if there is none
+        std::mutex mSendMutex;
+        int mFd;
+
+        // only touched by the connection's thread
+        std::string mStreamId;
+        uint64_t mStreamCount;
+        bool mStreamClosed;
+
+        mutable std::mutex mMutex;
+        std::condition_variable mCv;
+        bool mConnected;
+        std::size_t mAnsweredRegistrations;
+        std::vector<std::string> mNodes;
+        uint64_t mNextRegistrationId;
+
+        std::atomic<uint64_t> mPubsubRequestCount;
+    };
+}
+
+#endif
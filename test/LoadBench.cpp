@@ -0,0 +1,584 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * end-to-end load generator: runs an AppServer against a stand-in XMPP
+ * server with a pubsub service and a mock push service, registers devices,
+ * publishes notifications at a fixed rate and reports the throughput and the
+ * latency from publishing a notification to its arrival at the push service.
+ */
+
+#include "AppServer.hpp"
+#include "Base64.hpp"
+#include "FakeXmppServer.hpp"
+#include "Logger.hpp"
+#include "MockPushService.hpp"
+#include "SmartPointerUtil.hpp"
+
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+
+#include <yaml-cpp/yaml.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <ftw.h>
+#include <unistd.h>
+
+
+using namespace Oshiya;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    const std::string ComponentJid {"push.bench.localhost"};
+    const std::string PubsubJid {"pubsub.bench.localhost"};
+    const std::string Password {"benchmark"};
+    // the payload field carrying a notification's sequence number
+    const std::string SeqField {"bench-seq"};
+
+    const std::chrono::milliseconds ConnectTimeout {10000};
+    const std::chrono::milliseconds RegistrationTimeout {60000};
+
+    struct Options
+    {
+        std::string backend {"gcm"};
+        std::string logLevel {"warning"};
+        unsigned long users {1000};
+        unsigned long registrationRate {1000}; // per s
+        unsigned long rate {1000}; // notifications per s
+        unsigned long count {10000};
+        unsigned long dispatchThreads {0};
+        unsigned long workers {1};
+        unsigned long maxBatchSize {100};
+        unsigned long linger {0}; // ms
+        unsigned long concurrentRequests {100};
+        unsigned long drainTimeout {10000}; // ms
+        bool spool {true};
+    };
+
+    void printUsage(const char* name)
+    {
+        Options defaults;
+
+        std::cerr
+        << "usage: " << name << " [options]\n"
+        << "  --backend gcm|apns2          push service to mock (" << defaults.backend << ")\n"
+        << "  --users N                    devices to register (" << defaults.users << ")\n"
+        << "  --registration-rate N        registrations per second ("
+        << defaults.registrationRate << ")\n"
+        << "  --rate N                     notifications published per second ("
+        << defaults.rate << ")\n"
+        << "  --count N                    notifications to publish (" << defaults.count << ")\n"
+        << "  --dispatch-threads N         component option dispatch_threads ("
+        << defaults.dispatchThreads << ")\n"
+        << "  --workers N                  backend option workers (" << defaults.workers << ")\n"
+        << "  --max-batch-size N           backend option max_batch_size ("
+        << defaults.maxBatchSize << ")\n"
+        << "  --linger MS                  backend option linger (" << defaults.linger << ")\n"
+        << "  --concurrent-requests N      backend option concurrent_requests ("
+        << defaults.concurrentRequests << ")\n"
+        << "  --no-spool                   backend option spool: false\n"
+        << "  --drain-timeout MS           give up waiting for stragglers after MS without"
+        << " progress (" << defaults.drainTimeout << ")\n"
+        << "  --log-level LEVEL            the component's log level ("
+        << defaults.logLevel << ")\n";
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options)
+    {
+        std::map<std::string, unsigned long*> numeric
+        {
+            {"--users", &options.users},
+            {"--registration-rate", &options.registrationRate},
+            {"--rate", &options.rate},
+            {"--count", &options.count},
+            {"--dispatch-threads", &options.dispatchThreads},
+            {"--workers", &options.workers},
+            {"--max-batch-size", &options.maxBatchSize},
+            {"--linger", &options.linger},
+            {"--concurrent-requests", &options.concurrentRequests},
+            {"--drain-timeout", &options.drainTimeout}
+        };
+
+        for(int i {1}; i < argc; ++i)
+        {
+            std::string arg {argv[i]};
+
+            if(arg == "--no-spool")
+            {
+                options.spool = false;
+                continue;
+            }
+
+            if(i + 1 == argc)
+            {
+                return false;
+            }
+
+            std::string value {argv[++i]};
+
+            if(arg == "--backend")
+            {
+                options.backend = value;
+                continue;
+            }
+
+            if(arg == "--log-level")
+            {
+                options.logLevel = value;
+                continue;
+            }
+
+            auto result = numeric.find(arg);
+            char* end;
+
+            if(result == numeric.end() or value.empty())
+            {
+                return false;
+            }
+
+            *result->second = std::strtoul(value.c_str(), &end, 10);
+
+            if(*end != '\0')
+            {
+                return false;
+            }
+        }
+
+        return
+        (options.backend == "gcm" or options.backend == "apns2") and
+        options.users > 0 and options.registrationRate > 0 and
+        options.rate > 0 and options.count > 0;
+    }
+
+    /**
+     * publish times and end-to-end latencies, indexed by sequence number.
+     * Lock-free, arrivals are recorded on the mock's connection threads.
+     */
+    class LatencyRecorder
+    {
+        public:
+        ///////
+
+        explicit LatencyRecorder(std::size_t count)
+            :
+                mCount {count},
+                mPublished {new std::atomic<int64_t>[count]},
+                mLatencies {new std::atomic<int64_t>[count]},
+                mDelivered {0},
+                mDuplicates {0},
+                mUnknown {0},
+                mLastArrival {0}
+        {
+            for(std::size_t i {0}; i < mCount; ++i)
+            {
+                mPublished[i] = 0;
+                mLatencies[i] = -1;
+            }
+        }
+
+        void published(uint64_t seq, Clock::time_point time)
+        {
+            mPublished[seq] = toNs(time);
+        }
+
+        void arrived(uint64_t seq)
+        {
+            int64_t now {toNs(Clock::now())};
+
+            if(seq >= mCount)
+            {
+                ++mUnknown;
+                return;
+            }
+
+            if(mLatencies[seq].exchange(now - mPublished[seq]) != -1)
+            {
+                ++mDuplicates;
+                return;
+            }
+
+            ++mDelivered;
+            mLastArrival = now;
+        }
+
+        std::size_t getDelivered() const {return mDelivered;}
+        std::size_t getDuplicates() const {return mDuplicates;}
+        std::size_t getUnknown() const {return mUnknown;}
+
+        Clock::time_point getLastArrival() const
+        {
+            return Clock::time_point {std::chrono::nanoseconds {mLastArrival}};
+        }
+
+        /**
+         * the latencies of all delivered notifications in ns, ascending
+         */
+        std::vector<int64_t> getSortedLatencies() const
+        {
+            std::vector<int64_t> ret;
+            ret.reserve(mDelivered);
+
+            for(std::size_t i {0}; i < mCount; ++i)
+            {
+                if(mLatencies[i] != -1)
+                {
+                    ret.push_back(mLatencies[i]);
+                }
+            }
+
+            std::sort(ret.begin(), ret.end());
+
+            return ret;
+        }
+
+        private:
+        ////////
+
+        static int64_t toNs(Clock::time_point time)
+        {
+            return
+            std::chrono::duration_cast<std::chrono::nanoseconds>
+            (time.time_since_epoch()).count();
+        }
+
+        const std::size_t mCount;
+        std::unique_ptr<std::atomic<int64_t>[]> mPublished;
+        // -1 until the notification arrives
+        std::unique_ptr<std::atomic<int64_t>[]> mLatencies;
+        std::atomic<std::size_t> mDelivered;
+        std::atomic<std::size_t> mDuplicates;
+        std::atomic<std::size_t> mUnknown;
+        std::atomic<int64_t> mLastArrival;
+    };
+
+    /**
+     * nearest rank, sorted must not be empty
+     */
+    double getPercentileMs(const std::vector<int64_t>& sorted, double percentile)
+    {
+        std::size_t rank {static_cast<std::size_t>(percentile / 100 * sorted.size())};
+
+        return sorted[std::min(rank, sorted.size() - 1)] / 1e6;
+    }
+
+    double getSeconds(Clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::duration<double>>(duration).count();
+    }
+
+    /**
+     * a fresh ES256 key for the provider tokens, in PKCS#8 like the ones
+     * Apple hands out
+     */
+    bool writeSigningKey(const std::string& path)
+    {
+        std::unique_ptr<EVP_PKEY_CTX, void(*)(EVP_PKEY_CTX*)>
+        ctx {EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr), EVP_PKEY_CTX_free};
+
+        EVP_PKEY* key {nullptr};
+
+        if(not ctx or
+           EVP_PKEY_keygen_init(ctx.get()) != 1 or
+           EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx.get(), NID_X9_62_prime256v1) != 1 or
+           EVP_PKEY_keygen(ctx.get(), &key) != 1)
+        {
+            return false;
+        }
+
+        std::unique_ptr<EVP_PKEY, void(*)(EVP_PKEY*)> keyPtr {key, EVP_PKEY_free};
+
+        std::FILE* file {std::fopen(path.c_str(), "w")};
+
+        if(file == nullptr)
+        {
+            return false;
+        }
+
+        bool success
+        {PEM_write_PrivateKey(file, key, nullptr, nullptr, 0, nullptr, nullptr) == 1};
+
+        return std::fclose(file) == 0 and success;
+    }
+
+    /**
+     * APNs device tokens are 32 bytes, base64-encoded by the client
+     */
+    std::string makeToken(const std::string& backend, std::size_t user)
+    {
+        if(backend == "gcm")
+        {
+            return "bench-token-" + std::to_string(user);
+        }
+
+        std::string binaryToken(32, '\0');
+
+        for(std::size_t i {0}; i < binaryToken.size(); ++i)
+        {
+            binaryToken[i] = static_cast<char>((user >> (8 * (i % 8))) ^ i);
+        }
+
+        return Util::base64Encode(binaryToken);
+    }
+
+    int removeFile(const char* path, const struct stat*, int, FTW*)
+    {
+        return std::remove(path);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    if(not parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    Logger::Level level;
+
+    if(Logger::parseLevel(options.logLevel, level))
+    {
+        Logger::getInstance().setLevel(level);
+    }
+
+    char storageDir[] {"/tmp/oshiya-bench-XXXXXX"};
+
+    if(mkdtemp(storageDir) == nullptr)
+    {
+        std::cerr << "could not create a storage directory" << std::endl;
+        return 1;
+    }
+
+    // the component's registrations and spool, and the APNs signing key
+    struct StorageGuard
+    {
+        ~StorageGuard() {nftw(path, removeFile, 16, FTW_DEPTH | FTW_PHYS);}
+        const char* path;
+    } storageGuard {storageDir};
+
+    std::string keyFile {std::string {storageDir} + "/signing_key.p8"};
+
+    if(options.backend == "apns2" and not writeSigningKey(keyFile))
+    {
+        std::cerr << "could not create an APNs signing key" << std::endl;
+        return 1;
+    }
+
+    LatencyRecorder recorder {options.count};
+
+    std::unique_ptr<MockPushService> pushService;
+    std::unique_ptr<FakeXmppServer> xmppServer;
+
+    try
+    {
+        pushService =
+        make_unique<MockPushService>(
+            options.backend == "gcm" ?
+            MockPushService::Kind::Gcm :
+            MockPushService::Kind::Apns,
+            SeqField,
+            [&recorder](uint64_t seq) {recorder.arrived(seq);}
+        );
+
+        xmppServer = make_unique<FakeXmppServer>(ComponentJid, Password, PubsubJid);
+    }
+
+    catch(const std::system_error& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    YAML::Node backend;
+    backend["type"] = options.backend;
+    backend["app_name"] = "bench";
+    backend["max_batch_size"] = options.maxBatchSize;
+    backend["linger"] = options.linger;
+    backend["concurrent_requests"] = options.concurrentRequests;
+    backend["workers"] = options.workers;
+    backend["spool"] = options.spool;
+
+    if(options.backend == "gcm")
+    {
+        backend["certfile"] = "";
+        backend["auth_key"] = "benchmark";
+        backend["url"] = pushService->getUrl() + "/gcm/send";
+    }
+
+    else
+    {
+        backend["key_file"] = keyFile;
+        backend["key_id"] = "BENCHKEY01";
+        backend["team_id"] = "BENCHTEAM1";
+        backend["topic"] = "org.oshiya.bench";
+        backend["url"] = pushService->getUrl();
+    }
+
+    YAML::Node component;
+    component["host"] = ComponentJid;
+    component["server_host"] = "127.0.0.1";
+    component["port"] = xmppServer->getPort();
+    component["password"] = Password;
+    component["pubsub_host"] = PubsubJid;
+    component["storage_dir"] = std::string {storageDir} + "/";
+    component["dispatch_threads"] = options.dispatchThreads;
+    component["backends"].push_back(backend);
+
+    std::unique_ptr<AppServer> appServer;
+
+    try
+    {
+        appServer = make_unique<AppServer>(Config {component});
+    }
+
+    catch(const Config::InvalidConfig& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if(not xmppServer->waitForComponent(ConnectTimeout))
+    {
+        std::cerr << "the component did not connect" << std::endl;
+        return 1;
+    }
+
+    // registrations
+    Clock::time_point registrationStart {Clock::now()};
+
+    for(std::size_t i {0}; i < options.users; ++i)
+    {
+        std::this_thread::sleep_until(
+            registrationStart +
+            std::chrono::nanoseconds {i * 1000000000ull / options.registrationRate}
+        );
+
+        xmppServer->registerDevice("user" + std::to_string(i) + "@bench.localhost/device",
+                                   options.backend,
+                                   makeToken(options.backend, i));
+    }
+
+    if(not xmppServer->waitForRegistrations(options.users, RegistrationTimeout))
+    {
+        std::cerr << "registrations were not answered in time" << std::endl;
+        return 1;
+    }
+
+    double registrationTime {getSeconds(Clock::now() - registrationStart)};
+    std::vector<std::string> nodes {xmppServer->getNodes()};
+
+    if(nodes.empty())
+    {
+        std::cerr << "no registration succeeded" << std::endl;
+        return 1;
+    }
+
+    // notifications, open loop: latencies count from the scheduled publish
+    // time, so a publisher held up by the component doesn't hide the delay
+    Clock::time_point publishStart {Clock::now()};
+
+    for(std::size_t i {0}; i < options.count; ++i)
+    {
+        Clock::time_point scheduled
+        {publishStart + std::chrono::nanoseconds {i * 1000000000ull / options.rate}};
+
+        std::this_thread::sleep_until(scheduled);
+
+        recorder.published(i, scheduled);
+        xmppServer->publish(nodes[i % nodes.size()], SeqField, i);
+    }
+
+    double publishTime {getSeconds(Clock::now() - publishStart)};
+
+    std::size_t delivered {0};
+    Clock::time_point lastProgress {Clock::now()};
+
+    while(recorder.getDelivered() < options.count and
+          Clock::now() - lastProgress < std::chrono::milliseconds {options.drainTimeout})
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds {10});
+
+        if(recorder.getDelivered() != delivered)
+        {
+            delivered = recorder.getDelivered();
+            lastProgress = Clock::now();
+        }
+    }
+
+    appServer.reset();
+
+    delivered = recorder.getDelivered();
+    std::vector<int64_t> latencies {recorder.getSortedLatencies()};
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "backend:        " << options.backend
+              << ", " << options.workers << " workers"
+              << ", max batch size " << options.maxBatchSize
+              << ", linger " << options.linger << " ms"
+              << ", " << options.dispatchThreads << " dispatch threads"
+              << (options.spool ? ", spool" : ", no spool") << "\n"
+              << "registrations:  " << nodes.size() << " of " << options.users
+              << " in " << registrationTime << " s ("
+              << nodes.size() / registrationTime << "/s), "
+              << xmppServer->getFailedRegistrations() << " failed, "
+              << xmppServer->getPubsubRequestCount() << " pubsub requests\n"
+              << "published:      " << options.count << " in " << publishTime << " s ("
+              << options.count / publishTime << "/s, target " << options.rate << "/s)\n"
+              << "delivered:      " << delivered << ", missing " << options.count - delivered
+              << ", duplicates " << recorder.getDuplicates()
+              << ", unknown " << recorder.getUnknown()
+              << ", malformed requests " << pushService->getMalformedCount() << "\n"
+              << "requests:       " << pushService->getRequestCount() << " ("
+              << static_cast<double>(pushService->getNotificationCount()) /
+                 std::max<uint64_t>(pushService->getRequestCount(), 1)
+              << " notifications/request)\n";
+
+    if(not latencies.empty())
+    {
+        std::cout << "throughput:     "
+                  << delivered / getSeconds(recorder.getLastArrival() - publishStart)
+                  << " notifications/s\n"
+                  << "latency (ms):   p50 " << getPercentileMs(latencies, 50)
+                  << ", p99 " << getPercentileMs(latencies, 99)
+                  << ", p999 " << getPercentileMs(latencies, 99.9)
+                  << ", max " << latencies.back() / 1e6 << "\n";
+    }
+
+    std::cout << std::flush;
+
+    return delivered == options.count ? 0 : 1;
+}
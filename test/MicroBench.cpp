@@ -0,0 +1,491 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * microbenchmarks for the steps every stanza and notification goes through.
+ * Reports the time per operation and the heap allocations per operation,
+ * both through operator new and through libstrophe's allocator. Exits with 1
+ * if a notification's stanza gets copied.
+ */
+
+#include "Apns2Backend.hpp"
+#include "Base64.hpp"
+#include "GcmBackend.hpp"
+#include "OutPacket.hpp"
+#include "RegistrationStore.hpp"
+#include "RegistrationTable.hpp"
+#include "StanzaDispatcher.hpp"
+#include "XmppUtils.hpp"
+#include "XDataView.hpp"
+
+extern "C"
+{
+    #include "src/parser.h"
+}
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+
+using namespace Oshiya;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // each benchmark runs at least this long
+    const std::chrono::milliseconds MinRunTime {200};
+
+    /**
+     * allocations made by the benchmarking thread, other threads (e.g. the
+     * logger's) don't count
+     */
+    struct AllocationCounters
+    {
+        uint64_t allocations;
+        uint64_t bytes;
+        uint64_t xmppAllocations;
+    };
+
+    thread_local AllocationCounters counters {0, 0, 0};
+
+    // made by any thread, a dispatch worker copies as well
+    std::atomic<uint64_t> stanzaCopies {0};
+
+    void* countingAlloc(const size_t size, void* const)
+    {
+        ++counters.xmppAllocations;
+        return std::malloc(size);
+    }
+
+    void countingFree(void* p, void* const)
+    {
+        std::free(p);
+    }
+
+    void* countingRealloc(void* p, const size_t size, void* const)
+    {
+        ++counters.xmppAllocations;
+        return std::realloc(p, size);
+    }
+
+    xmpp_mem_t countingMem {countingAlloc, countingFree, countingRealloc, nullptr};
+
+    /**
+     * keeps the compiler from optimizing value's computation away
+     */
+    template <typename T>
+    void keep(const T& value)
+    {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    /**
+     * runs func often enough to take MinRunTime and prints the averages, if
+     * name contains filter. Returns the stanza copies per operation.
+     */
+    double run(const std::string& name,
+               const std::string& filter,
+               const std::function<void()>& func)
+    {
+        if(name.find(filter) == std::string::npos)
+        {
+            return 0;
+        }
+
+        // warms up and finds an iteration count taking long enough
+        uint64_t iterations {1};
+
+        while(true)
+        {
+            Clock::time_point start {Clock::now()};
+
+            for(uint64_t i {0}; i < iterations; ++i)
+            {
+                func();
+            }
+
+            if(Clock::now() - start >= MinRunTime / 10)
+            {
+                iterations *= 10;
+                break;
+            }
+
+            iterations *= 2;
+        }
+
+        AllocationCounters before {counters};
+        uint64_t copiesBefore {stanzaCopies.load()};
+        Clock::time_point start {Clock::now()};
+
+        for(uint64_t i {0}; i < iterations; ++i)
+        {
+            func();
+        }
+
+        double ns
+        {static_cast<double>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()
+        )};
+
+        double copies
+        {static_cast<double>(stanzaCopies.load() - copiesBefore) / iterations};
+
+        std::printf("%-44s %10.1f %10.2f %10.1f %12.2f %12.2f\n",
+                    name.c_str(),
+                    ns / iterations,
+                    static_cast<double>(counters.allocations - before.allocations) /
+                    iterations,
+                    static_cast<double>(counters.bytes - before.bytes) / iterations,
+                    static_cast<double>(counters.xmppAllocations - before.xmppAllocations) /
+                    iterations,
+                    copies);
+
+        return copies;
+    }
+
+    /**
+     * parses a single stanza the way strophe parses what it receives
+     */
+    XmlElement parseStanza(xmpp_ctx_t* ctx, const std::string& xml)
+    {
+        XmlElement ret;
+
+        parser_t* parser
+        {
+            parser_new(ctx,
+                       nullptr,
+                       nullptr,
+                       [](xmpp_stanza_t* stanza, void* const userData)
+                       {*static_cast<XmlElement*>(userData) = XmlElement {stanza};},
+                       &ret)
+        };
+
+        std::string stream {"<stream>" + xml + "</stream>"};
+        parser_feed(parser, &stream[0], static_cast<int>(stream.size()));
+        parser_free(parser);
+
+        return ret;
+    }
+
+    const std::string NotificationMessage
+    {
+        "<message from='pubsub.example.org' to='push.example.org' id='n1'>"
+        "<event xmlns='http://jabber.org/protocol/pubsub#event'>"
+        "<items node='yxs32uqsflafdk3iuqo'><item id='1'>"
+        "<notification xmlns='urn:xmpp:push:0'>"
+        "<x xmlns='jabber:x:data'>"
+        "<field var='FORM_TYPE'><value>urn:xmpp:push:summary</value></field>"
+        "<field var='message-count'><value>1</value></field>"
+        "<field var='last-message-sender'>"
+        "<value>juliet@capulet.example/balcony</value></field>"
+        "<field var='last-message-body'>"
+        "<value>Wherefore art thou, Romeo?</value></field>"
+        "</x></notification></item></items></event></message>"
+    };
+
+    const std::string RegisterCommand
+    {
+        "<iq type='set' id='reg1' from='romeo@montague.example/orchard'"
+        " to='push.example.org'>"
+        "<command xmlns='http://jabber.org/protocol/commands'"
+        " node='register-push-gcm' action='execute'>"
+        "<x xmlns='jabber:x:data' type='submit'>"
+        "<field var='token'><value>bWFzZXJhdGkgbW9uYXN0ZXJ5IGdhcmRlbg</value></field>"
+        "<field var='device-name'><value>Romeo's phone</value></field>"
+        "</x></command></iq>"
+    };
+
+    // neither a command nor anything else handled, answered with an error
+    const std::string BadRequest
+    {
+        "<iq type='set' id='bad1' from='romeo@montague.example/orchard'"
+        " to='push.example.org'><query xmlns='jabber:iq:version'/></iq>"
+    };
+}
+
+/**
+ * counts the stanza tree copies made through XmlElement's copy operations,
+ * the benchmark links with --wrap=xmpp_stanza_copy
+ */
+extern "C"
+{
+    xmpp_stanza_t* __real_xmpp_stanza_copy(const xmpp_stanza_t* const stanza);
+
+    xmpp_stanza_t* __wrap_xmpp_stanza_copy(const xmpp_stanza_t* const stanza)
+    {
+        ++stanzaCopies;
+        return __real_xmpp_stanza_copy(stanza);
+    }
+}
+
+/**
+ * the replacements stay out of line, inlined into a caller the free() of a
+ * pointer from the replaced operator new looks mismatched to GCC
+ */
+__attribute__((noinline)) void* operator new(std::size_t size)
+{
+    ++counters.allocations;
+    counters.bytes += size;
+
+    void* p {std::malloc(size > 0 ? size : 1)};
+
+    if(p == nullptr)
+    {
+        throw std::bad_alloc {};
+    }
+
+    return p;
+}
+
+__attribute__((noinline)) void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+int main(int argc, char** argv)
+{
+    // e.g. "Base64" runs the Base64 benchmarks only
+    std::string filter {argc > 1 ? argv[1] : ""};
+
+    xmpp_ctx_t* ctx {xmpp_ctx_new(&countingMem, nullptr)};
+
+    const Jid component {"", "push.example.org", ""};
+    const Jid pubsub {"", "pubsub.example.org", ""};
+    const Jid user {"romeo", "montague.example", "orchard"};
+    const std::string node {"yxs32uqsflafdk3iuqo"};
+    const std::string secret {"eruio234vzxc2kla-91"};
+
+    XmlElement message {parseStanza(ctx, NotificationMessage)};
+    XmlElement iq {parseStanza(ctx, RegisterCommand)};
+    XmlElement badIq {parseStanza(ctx, BadRequest)};
+
+    XmlElement summaryElement
+    {
+        xmpp_stanza_get_child_by_ns(
+            xmpp_stanza_get_child_by_ns(
+                xmpp_stanza_get_child_by_name(
+                    xmpp_stanza_get_child_by_name(
+                        xmpp_stanza_get_child_by_ns(message.getStanzaPtr(),
+                                                    "http://jabber.org/protocol/pubsub#event"),
+                        "items"),
+                    "item"),
+                "urn:xmpp:push:0"),
+            "jabber:x:data")
+    };
+
+    Backend::PayloadT payload {Util::makeValueMap(XDataView {summaryElement.getStanzaPtr()})};
+
+    XData nodeConfig
+    {
+        "submit",
+        {
+            {"hidden", "FORM_TYPE", {"http://jabber.org/protocol/pubsub#node_config"}},
+            {"", "pubsub#secret", {secret}}
+        }
+    };
+
+    XData registerResult
+    {
+        "result",
+        {
+            {"", "jid", {pubsub.full()}},
+            {"", "node", {node}},
+            {"", "secret", {secret}}
+        }
+    };
+
+    // 32 byte APNs device token, base64 as clients register it
+    const std::string apnsToken {"3q2+7wAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA="};
+    const std::string binaryToken {Util::base64Decode(apnsToken)};
+
+    Backend::PushNotification notification
+    {
+        1, std::time(nullptr), 0, payload, "bWFzZXJhdGkgbW9uYXN0ZXJ5IGdhcmRlbg",
+        "", "", []() { }
+    };
+
+    GcmBackend::RecipientsT recipients {&notification};
+
+    // one device each for RegistrationCount users, with GCM sized tokens
+    const std::size_t RegistrationCount {100000};
+
+    RegistrationTable regs;
+    std::vector<std::string> regNodes;
+
+    for(std::size_t i {0}; i < RegistrationCount; ++i)
+    {
+        regNodes.push_back("node" + std::to_string(i));
+
+        Registration reg
+        {
+            Jid {"user" + std::to_string(i), "montague.example", "phone"},
+            "phone",
+            "Romeo's phone",
+            std::string(152, 'x') + std::to_string(i),
+            "org.example.chat",
+            1,
+            std::time(nullptr)
+        };
+
+        regs.insert(regNodes.back(), reg);
+    }
+
+    // as AppServer holds them, sharded behind reader-writer locks
+    RegistrationStore regStore
+    {
+        [](const std::string&, const Registration&) { },
+        [](const RegistrationTable&, RegistrationTable::IdT) { }
+    };
+
+    regStore.load(regs);
+
+    std::size_t nextReg {0};
+
+    StanzaDispatcher dispatcher {component.full()};
+
+    using InType = InPacket::Type;
+    dispatcher.addStanzaHandler<InType::PushNotification>(
+        [](const Jid&, const std::string&, const Backend::PayloadT&) { }
+    );
+    dispatcher.addStanzaHandler<InType::AdhocCommand>(
+        [](const Jid&, const std::string&, const std::string&,
+           const std::string&, const XData&) { }
+    );
+
+    using OutType = OutPacket::Type;
+
+    OutStanza<OutType::CreatePubsubNode> createNode
+    {component, pubsub, "id1", node, nodeConfig};
+    OutStanza<OutType::DeletePubsubNode> deleteNode
+    {component, pubsub, "id1", node};
+    OutStanza<OutType::SetPubsubAffiliation> setAffiliation
+    {component, pubsub, "id1", node, Jid {"romeo", "montague.example", ""}, "publish-only"};
+    OutStanza<OutType::PubsubSubscribe> subscribe
+    {component, pubsub, "id1", node};
+    OutStanza<OutType::CommandCompleted> commandCompleted
+    {component, user, "reg1", "register-push-gcm", registerResult};
+    OutStanza<OutType::CommandError> commandError
+    {component, user, "reg1", "register-push-gcm", "execute", "modify", "bad-request",
+     "bad-payload"};
+
+    std::printf("%-44s %10s %10s %10s %12s %12s\n",
+                "benchmark", "ns/op", "allocs/op", "bytes/op", "xmpp allocs/op",
+                "copies/op");
+
+    bool ok {true};
+
+    // a notification is read right off the stanza strophe received
+    if(run("StanzaDispatcher::handleMessage (notification)", filter,
+           [&]() {dispatcher.handleMessage(message);}) != 0)
+    {
+        std::fprintf(stderr, "a notification's stanza was copied\n");
+        ok = false;
+    }
+    run("StanzaDispatcher::handleIq (register command)", filter,
+        [&]() {dispatcher.handleIq(iq);});
+    run("StanzaDispatcher::handleIq (bad request)", filter,
+        [&]() {dispatcher.handleIq(badIq);});
+
+    run("OutStanza<CreatePubsubNode>::makeXmlElement", filter,
+        [&]() {keep(createNode.makeXmlElement(ctx));});
+    run("OutStanza<DeletePubsubNode>::makeXmlElement", filter,
+        [&]() {keep(deleteNode.makeXmlElement(ctx));});
+    run("OutStanza<SetPubsubAffiliation>::makeXmlElement", filter,
+        [&]() {keep(setAffiliation.makeXmlElement(ctx));});
+    run("OutStanza<PubsubSubscribe>::makeXmlElement", filter,
+        [&]() {keep(subscribe.makeXmlElement(ctx));});
+    run("OutStanza<CommandCompleted>::makeXmlElement", filter,
+        [&]() {keep(commandCompleted.makeXmlElement(ctx));});
+    run("OutStanza<CommandError>::makeXmlElement", filter,
+        [&]() {keep(commandError.makeXmlElement(ctx));});
+
+    run("Util::parseXData (summary)", filter,
+        [&]() {keep(Util::parseXData(summaryElement));});
+    run("Util::makeXDataElement (node config)", filter,
+        [&]() {keep(Util::makeXDataElement(nodeConfig, ctx));});
+    run("Util::makeValueMap (summary view)", filter,
+        [&]() {keep(Util::makeValueMap(XDataView {summaryElement.getStanzaPtr()}));});
+
+    run("Util::base64Decode (APNs token)", filter,
+        [&]() {keep(Util::base64Decode(apnsToken));});
+    run("Apns2Backend::binaryToHex", filter,
+        [&]() {keep(Apns2Backend::binaryToHex(binaryToken));});
+
+    run("GcmBackend::makePayload", filter,
+        [&]() {keep(GcmBackend::makePayload(recipients, payload));});
+    run("Apns2Backend::makePayload", filter,
+        [&]() {keep(Apns2Backend::makePayload(payload));});
+
+    run("RegistrationTable::find (100k registrations)", filter,
+        [&]()
+        {
+            keep(regs.find(regNodes[nextReg]));
+            nextReg = (nextReg + 1) % RegistrationCount;
+        });
+
+    // what AppServer::pushNotificationReceived() does for a notification
+    run("RegistrationStore::read (100k registrations)", filter,
+        [&]()
+        {
+            regStore.read(
+                regNodes[nextReg],
+                [](const RegistrationTable& table, RegistrationTable::IdT id)
+                {keep(table.getToken(id).str());}
+            );
+            nextReg = (nextReg + 1) % RegistrationCount;
+        });
+
+    if(std::string {"RegistrationTable"}.find(filter) != std::string::npos)
+    {
+        std::printf("\nRegistrationTable: %.1f bytes per registration\n",
+                    static_cast<double>(regs.getMemoryUsage()) / regs.size());
+    }
+
+    xmpp_ctx_free(ctx);
+
+    return ok ? 0 : 1;
+}
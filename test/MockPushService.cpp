@@ -0,0 +1,322 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "MockPushService.hpp"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <system_error>
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+
+using namespace Oshiya;
+
+MockPushService::MockPushService(Kind kind,
+                                 const std::string& seqField,
+                                 const ArrivalCbT& arrivalCb)
+    :
+        mKind {kind},
+        mSeqField {seqField},
+        mArrivalCb {arrivalCb},
+        mListenFd {socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)},
+        mWakeupFd {eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
+        mPort {0},
+        mRequestCount {0},
+        mNotificationCount {0},
+        mMalformedCount {0}
+{
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLength {sizeof addr};
+
+    if(mListenFd == -1 or mWakeupFd == -1 or
+       bind(mListenFd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == -1 or
+       listen(mListenFd, SOMAXCONN) == -1 or
+       getsockname(mListenFd, reinterpret_cast<sockaddr*>(&addr), &addrLength) == -1)
+    {
+        int error {errno};
+
+        close(mListenFd);
+        close(mWakeupFd);
+
+        throw std::system_error {error, std::generic_category(),
+                                 "could not set up the mock push service"};
+    }
+
+    mPort = ntohs(addr.sin_port);
+
+    mAcceptThread = std::thread {&MockPushService::acceptConnections, this};
+}
+
+MockPushService::~MockPushService()
+{
+    // wakes up the accepting thread and all connection threads for good
+    uint64_t one {1};
+
+    while(write(mWakeupFd, &one, sizeof one) == -1 and errno == EINTR) { }
+
+    mAcceptThread.join();
+
+    for(std::thread& connection : mConnections)
+    {
+        connection.join();
+    }
+
+    close(mListenFd);
+    close(mWakeupFd);
+}
+
+std::string MockPushService::getUrl() const
+{
+    return "http://127.0.0.1:" + std::to_string(mPort);
+}
+
+void MockPushService::acceptConnections()
+{
+    while(true)
+    {
+        pollfd fds[2] {};
+        fds[0].fd = mListenFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = mWakeupFd;
+        fds[1].events = POLLIN;
+
+        if(poll(fds, 2, -1) == -1 and errno != EINTR)
+        {
+            return;
+        }
+
+        if(fds[1].revents != 0)
+        {
+            return;
+        }
+
+        if(fds[0].revents == 0)
+        {
+            continue;
+        }
+
+        int fd {accept4(mListenFd, nullptr, nullptr, SOCK_CLOEXEC)};
+
+        if(fd != -1)
+        {
+            std::lock_guard<std::mutex> lk {mConnectionsMutex};
+            mConnections.emplace_back(&MockPushService::serveConnection, this, fd);
+        }
+    }
+}
+
+void MockPushService::serveConnection(int fd)
+{
+    std::string buffer;
+
+    while(serveRequest(fd, buffer)) { }
+
+    close(fd);
+}
+
+bool MockPushService::serveRequest(int fd, std::string& buffer)
+{
+    std::string::size_type headerEnd;
+
+    while((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+    {
+        if(not readMore(fd, buffer))
+        {
+            return false;
+        }
+    }
+
+    std::string header {buffer.substr(0, headerEnd)};
+    buffer.erase(0, headerEnd + 4);
+
+    // header names are case-insensitive, values aren't looked at closely
+    std::transform(header.begin(), header.end(), header.begin(),
+                   [](char c) {return std::tolower(static_cast<unsigned char>(c));});
+
+    std::size_t contentLength {0};
+    std::string::size_type pos {header.find("\r\ncontent-length:")};
+
+    if(pos != std::string::npos)
+    {
+        contentLength = std::strtoul(header.c_str() + pos + 17, nullptr, 10);
+    }
+
+    // curl holds back larger bodies until it's told to go on
+    if(header.find("\r\nexpect: 100-continue") != std::string::npos and
+       buffer.size() < contentLength and
+       not writeAll(fd, "HTTP/1.1 100 Continue\r\n\r\n"))
+    {
+        return false;
+    }
+
+    while(buffer.size() < contentLength)
+    {
+        if(not readMore(fd, buffer))
+        {
+            return false;
+        }
+    }
+
+    std::string body {handleRequest(buffer.substr(0, contentLength))};
+    buffer.erase(0, contentLength);
+
+    return writeAll(fd,
+                    "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: application/json\r\n"
+                    "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                    "\r\n" +
+                    body);
+}
+
+bool MockPushService::readMore(int fd, std::string& buffer)
+{
+    pollfd fds[2] {};
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = mWakeupFd;
+    fds[1].events = POLLIN;
+
+    while(poll(fds, 2, -1) == -1)
+    {
+        if(errno != EINTR)
+        {
+            return false;
+        }
+    }
+
+    if(fds[1].revents != 0)
+    {
+        return false;
+    }
+
+    char chunk[16384];
+    ssize_t count {read(fd, chunk, sizeof chunk)};
+
+    if(count <= 0)
+    {
+        return false;
+    }
+
+    buffer.append(chunk, count);
+
+    return true;
+}
+
+bool MockPushService::writeAll(int fd, const std::string& data)
+{
+    std::size_t written {0};
+
+    while(written < data.size())
+    {
+        ssize_t count {send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL)};
+
+        if(count == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        written += count;
+    }
+
+    return true;
+}
+
+std::string MockPushService::handleRequest(const std::string& body)
+{
+    ++mRequestCount;
+
+    Json::Value root;
+    Json::Reader reader;
+
+    if(not reader.parse(body, root) or not root.isObject())
+    {
+        ++mMalformedCount;
+        return "{}";
+    }
+
+    // GCM carries the payload in "data" and may address several devices,
+    // APNs gets the fields next to "aps" and a single device per request
+    std::size_t recipients {1};
+    Json::Value seq;
+
+    if(mKind == Kind::Gcm)
+    {
+        if(root["registration_ids"].isArray())
+        {
+            recipients = root["registration_ids"].size();
+        }
+
+        seq = root["data"].get(mSeqField, Json::Value {});
+    }
+
+    else
+    {
+        seq = root.get(mSeqField, Json::Value {});
+    }
+
+    // the backends turn numeric fields into JSON numbers
+    if(not seq.isIntegral())
+    {
+        ++mMalformedCount;
+    }
+
+    else
+    {
+        for(std::size_t i {0}; i < recipients; ++i)
+        {
+            ++mNotificationCount;
+            mArrivalCb(seq.asUInt64());
+        }
+    }
+
+    if(mKind == Kind::Apns)
+    {
+        return "";
+    }
+
+    std::string response
+    {
+        "{\"multicast_id\":1,\"success\":" + std::to_string(recipients) +
+        ",\"failure\":0,\"canonical_ids\":0,\"results\":["
+    };
+
+    for(std::size_t i {0}; i < recipients; ++i)
+    {
+        response += i == 0 ? "{\"message_id\":\"0:1\"}" : ",{\"message_id\":\"0:1\"}";
+    }
+
+    return response + "]}";
+}
@@ -0,0 +1,123 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OSHIYA_MOCK_PUSH_SERVICE__H
+#define OSHIYA_MOCK_PUSH_SERVICE__H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace Oshiya
+{
+    /**
+     * plain HTTP/1.1 stand-in for GCM or the APNs provider API, a backend
+     * reaches it through its "url" option. Every request is answered with
+     * success. The notification's sequence number is read from the payload
+     * field seqField and handed to the arrival callback, on the thread of the
+     * connection the request came in on. Listens on an ephemeral port of
+     * 127.0.0.1, with a thread per connection.
+     */
+    class MockPushService
+    {
+        public:
+        ///////
+
+        enum class Kind
+        {
+            Gcm,
+            Apns
+        };
+
+        using ArrivalCbT = std::function<void(uint64_t seq)>;
+
+        /**
+         * throws std::system_error if it can't listen
+         */
+        MockPushService(Kind kind,
+                        const std::string& seqField,
+                        const ArrivalCbT& arrivalCb);
+
+        MockPushService(const MockPushService&) = delete;
+        MockPushService(MockPushService&&) = delete;
+
+        ~MockPushService();
+
+        /**
+         * "http://127.0.0.1:<port>", without a path
+         */
+        std::string getUrl() const;
+
+        uint64_t getRequestCount() const {return mRequestCount;}
+
+        // notifications, a GCM multicast request counts once per recipient
+        uint64_t getNotificationCount() const {return mNotificationCount;}
+
+        // requests without a readable sequence number
+        uint64_t getMalformedCount() const {return mMalformedCount;}
+
+        private:
+        ////////
+
+        void acceptConnections();
+
+        void serveConnection(int fd);
+
+        /**
+         * reads a request from fd and answers it, buffer keeps what was read
+         * beyond it. False once the connection is done.
+         */
+        bool serveRequest(int fd, std::string& buffer);
+
+        /**
+         * waits for data on fd, false once the service is stopped or the
+         * peer is gone
+         */
+        bool readMore(int fd, std::string& buffer);
+
+        bool writeAll(int fd, const std::string& data);
+
+        /**
+         * records the request, returns the response body
+         */
+        std::string handleRequest(const std::string& body);
+
+        const Kind mKind;
+        const std::string mSeqField;
+        const ArrivalCbT mArrivalCb;
+
+        int mListenFd;
+        int mWakeupFd;
+        unsigned short mPort;
+
+        std::thread mAcceptThread;
+        std::mutex mConnectionsMutex;
+        std::list<std::thread> mConnections;
+
+        std::atomic<uint64_t> mRequestCount;
+        std::atomic<uint64_t> mNotificationCount;
+        std::atomic<uint64_t> mMalformedCount;
+    };
+}
+
+#endif
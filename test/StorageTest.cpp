@@ -0,0 +1,361 @@
+/**
+ * This file is part of Oshiya, an XEP-0357 compatible XMPP component
+ * Copyright (C) 2015 Christian Ulrich <christian@rechenwerk.net>
+ * 
+ * Oshiya is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Oshiya is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Oshiya.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * checks the on-disk registration storage: the journal's replay, how it cuts
+ * off torn and corrupt records, and its rotation, and the snapshots' round
+ * trip, including the legacy text format. Exits with 1 if a check fails.
+ */
+
+#include "RegistrationJournal.hpp"
+#include "RegistrationSnapshot.hpp"
+#include "RegistrationStore.hpp"
+#include "RegistrationTable.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+using namespace Oshiya;
+
+namespace
+{
+    bool failed {false};
+
+    void check(bool condition, const std::string& what)
+    {
+        if(not condition)
+        {
+            std::cerr << "FAILED: " << what << std::endl;
+            failed = true;
+        }
+    }
+
+    int removeFile(const char* path, const struct stat*, int, FTW*)
+    {
+        return std::remove(path);
+    }
+
+    long fileSize(const std::string& path)
+    {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 ? static_cast<long>(st.st_size) : -1;
+    }
+
+    bool exists(const std::string& path)
+    {
+        return access(path.c_str(), F_OK) == 0;
+    }
+
+    Registration makeReg(const std::string& name)
+    {
+        return
+        {
+            Jid {name, "montague.example", "phone"},
+            "phone",
+            name + "'s phone",
+            "token-" + name,
+            "org.example.chat",
+            1,
+            1500000000
+        };
+    }
+
+    bool hasReg(const RegistrationTable& regs, const std::string& node, const std::string& name)
+    {
+        RegistrationTable::IdT id {regs.find(node)};
+
+        return
+        id != RegistrationTable::InvalidId and
+        regs.getToken(id).str() == "token-" + name and
+        regs.getDeviceName(id).str() == name + "'s phone";
+    }
+
+    /**
+     * every field of the registration under node equals reg's
+     */
+    bool equals(const RegistrationTable& regs, const std::string& node, const Registration& reg)
+    {
+        RegistrationTable::IdT id {regs.find(node)};
+
+        return
+        id != RegistrationTable::InvalidId and
+        regs.getUser(id) == reg.getUser() and
+        regs.getDeviceId(id).str() == reg.getDeviceId() and
+        regs.getDeviceName(id).str() == reg.getDeviceName() and
+        regs.getToken(id).str() == reg.getToken() and
+        regs.getAppId(id).str() == reg.getAppId() and
+        regs.getBackendId(id) == reg.getBackendId() and
+        regs.getTimestamp(id) == reg.getTimestamp();
+    }
+
+    RegistrationTable replay(const std::string& path)
+    {
+        RegistrationTable regs;
+        RegistrationJournal::replay(path, regs);
+        return regs;
+    }
+
+    void testJournal(const std::string& dir)
+    {
+        std::string path {dir + "/regs.journal"};
+
+        {
+            RegistrationJournal journal {path, []() { }};
+            journal.logAdd("n1", makeReg("romeo"));
+            journal.logAdd("n2", makeReg("juliet"));
+            journal.logDelete("n1");
+        }
+
+        long intactSize {fileSize(path)};
+
+        {
+            RegistrationTable regs {replay(path)};
+            check(regs.size() == 1, "replay applies additions and deletions");
+            check(hasReg(regs, "n2", "juliet"), "replay restores the registration");
+            check(regs.find("n1") == RegistrationTable::InvalidId, "replay applies deletions");
+        }
+
+        // a record cut short by a crash
+        {
+            RegistrationJournal journal {path, []() { }};
+            journal.logAdd("n3", makeReg("mercutio"));
+        }
+
+        check(truncate(path.c_str(), fileSize(path) - 3) == 0, "truncating the journal");
+
+        {
+            RegistrationTable regs {replay(path)};
+            check(regs.size() == 1 and hasReg(regs, "n2", "juliet"),
+                  "replay drops a torn record");
+            check(fileSize(path) == intactSize, "replay truncates a torn record");
+        }
+
+        // a record whose payload doesn't match its checksum
+        {
+            RegistrationJournal journal {path, []() { }};
+            journal.logAdd("n4", makeReg("tybalt"));
+        }
+
+        {
+            std::fstream file {path, std::fstream::in | std::fstream::out | std::fstream::binary};
+            file.seekp(-1, std::fstream::end);
+            file.put('\xff');
+        }
+
+        {
+            RegistrationTable regs {replay(path)};
+            check(regs.size() == 1 and hasReg(regs, "n2", "juliet"),
+                  "replay drops a corrupt record");
+            check(fileSize(path) == intactSize, "replay truncates a corrupt record");
+        }
+    }
+
+    void testRotation(const std::string& dir)
+    {
+        std::string path {dir + "/rotated.journal"};
+        std::string rotatedPath {path + ".1"};
+
+        RegistrationJournal journal {path, []() { }};
+
+        journal.logAdd("n1", makeReg("romeo"));
+        check(journal.rotate(), "rotate() moves the journal aside");
+        check(exists(rotatedPath), "rotate() leaves the rotated journal");
+
+        long rotatedSize {fileSize(rotatedPath)};
+
+        // as if the snapshot failed, the rotated journal stays
+        journal.logAdd("n2", makeReg("juliet"));
+        check(not journal.rotate(), "rotate() refuses to replace a rotated journal");
+        check(fileSize(rotatedPath) == rotatedSize, "the rotated journal is kept as it was");
+
+        {
+            RegistrationTable regs {replay(path)};
+            check(regs.size() == 2 and
+                  hasReg(regs, "n1", "romeo") and
+                  hasReg(regs, "n2", "juliet"),
+                  "replay reads both journals");
+        }
+
+        journal.removeRotated();
+        check(not exists(rotatedPath), "removeRotated() deletes the rotated journal");
+        check(journal.rotate(), "rotate() works again once the snapshot is done");
+    }
+
+    void testSnapshot(const std::string& dir)
+    {
+        using Result = RegistrationSnapshot::Result;
+
+        std::string path {dir + "/regs"};
+
+        {
+            RegistrationTable regs;
+            check(RegistrationSnapshot::read(path, regs) == Result::NotFound,
+                  "read() reports a missing snapshot");
+        }
+
+        // enough records to be decoded in several chunks
+        const std::size_t count {3 * RegistrationSnapshot::MinRecordsPerThread};
+
+        RegistrationTable written;
+
+        for(std::size_t i {0}; i < count; ++i)
+        {
+            written.insert("n" + std::to_string(i), makeReg("user" + std::to_string(i)));
+        }
+
+        Registration odd
+        {
+            Jid {"", "capulet.example", ""},
+            "",
+            "with\nnewline",
+            std::string(1000, 't'),
+            "",
+            42,
+            0
+        };
+
+        written.insert("odd", odd);
+
+        check(RegistrationSnapshot::write(path, written), "write() writes a snapshot");
+        check(not exists(path + ".tmp"), "write() renames the temporary file");
+
+        {
+            RegistrationTable regs;
+            check(RegistrationSnapshot::read(path, regs) == Result::Ok, "read() reads it back");
+            check(regs.size() == count + 1, "read() restores every registration");
+            check(equals(regs, "odd", odd), "read() restores every field");
+
+            bool allEqual {true};
+
+            for(std::size_t i {0}; i < count; i += 997)
+            {
+                allEqual =
+                allEqual and
+                equals(regs, "n" + std::to_string(i), makeReg("user" + std::to_string(i)));
+            }
+
+            check(allEqual, "read() restores the registrations of all chunks");
+        }
+
+        // as AppServer loads it, in parallel into the shards
+        {
+            std::vector<RegistrationTable> tables;
+            check(RegistrationSnapshot::read(path, tables) == Result::Ok,
+                  "read() reads it into tables");
+
+            RegistrationStore store
+            {
+                [](const std::string&, const Registration&) { },
+                [](const RegistrationTable&, RegistrationTable::IdT) { }
+            };
+
+            store.load(tables);
+
+            std::size_t loaded {0};
+            store.forEach([&loaded](const RegistrationTable&, RegistrationTable::IdT) {++loaded;});
+
+            check(loaded == count + 1, "load() adds every registration of the tables");
+            check(store.read("odd",
+                             [&odd](const RegistrationTable& regs, RegistrationTable::IdT)
+                             {check(equals(regs, "odd", odd), "load() keeps every field");}),
+                  "load() adds the registrations to their shards");
+        }
+
+        // the snapshot AppServer takes of its shards
+        {
+            std::vector<RegistrationTable> shards (2);
+            shards[0].insert("a", makeReg("romeo"));
+            shards[1].insert("b", makeReg("juliet"));
+
+            check(RegistrationSnapshot::write(path, shards), "write() writes shards");
+
+            RegistrationTable regs;
+            check(RegistrationSnapshot::read(path, regs) == Result::Ok and
+                  regs.size() == 2 and
+                  equals(regs, "a", makeReg("romeo")) and
+                  equals(regs, "b", makeReg("juliet")),
+                  "read() merges the shards");
+        }
+
+        // a record cut short
+        check(truncate(path.c_str(), fileSize(path) - 1) == 0, "truncating the snapshot");
+
+        {
+            RegistrationTable regs;
+            check(RegistrationSnapshot::read(path, regs) == Result::Invalid,
+                  "read() rejects a truncated snapshot");
+        }
+    }
+
+    void testLegacySnapshot(const std::string& dir)
+    {
+        using Result = RegistrationSnapshot::Result;
+
+        std::string path {dir + "/legacy"};
+
+        {
+            std::ofstream file {path};
+
+            // node, then one line per field
+            file << "n1\nromeo\nmontague.example\nphone\nphone\nromeo's phone\n"
+                    "token-romeo\norg.example.chat\n1\n1500000000\n"
+                    "n2\njuliet\nmontague.example\nphone\nphone\njuliet's phone\n"
+                    "token-juliet\norg.example.chat\n1\n1500000000\n";
+        }
+
+        RegistrationTable regs;
+
+        check(RegistrationSnapshot::read(path, regs) == Result::Legacy,
+              "read() recognizes the legacy format");
+        check(RegistrationSnapshot::readLegacy(path, regs) == Result::Ok,
+              "readLegacy() reads it");
+        check(regs.size() == 2 and
+              equals(regs, "n1", makeReg("romeo")) and
+              equals(regs, "n2", makeReg("juliet")),
+              "readLegacy() restores every field");
+    }
+}
+
+int main()
+{
+    char dir[] {"/tmp/oshiya-storage-test-XXXXXX"};
+
+    if(mkdtemp(dir) == nullptr)
+    {
+        std::cerr << "could not create a directory" << std::endl;
+        return 1;
+    }
+
+    testJournal(dir);
+    testRotation(dir);
+    testSnapshot(dir);
+    testLegacySnapshot(dir);
+
+    nftw(dir, removeFile, 16, FTW_DEPTH | FTW_PHYS);
+
+    return failed ? 1 : 0;
+}